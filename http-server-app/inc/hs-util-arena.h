@@ -0,0 +1,48 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_ARENA_H__
+#define __HTTP_SERVER_UTIL_ARENA_H__
+
+#include <glib.h>
+#include <stdarg.h>
+
+/*
+ * Bump allocator for temporaries of one request: nothing is freed on its
+ * own, all of it goes at once with the arena. Not thread safe, it is
+ * used by whichever thread runs the handler.
+ */
+struct util_arena;
+
+struct util_arena *util_arena_new(void);
+void util_arena_free(struct util_arena *arena);
+
+/* NULL if out of memory, aligned for any type */
+gpointer util_arena_alloc(struct util_arena *arena, gsize size);
+
+char *util_arena_strdup(struct util_arena *arena, const char *str);
+char *util_arena_strconcat(struct util_arena *arena,
+				const char *str, ...) G_GNUC_NULL_TERMINATED;
+char *util_arena_strdup_vprintf(struct util_arena *arena,
+				const char *fmt, va_list args);
+char *util_arena_strdup_printf(struct util_arena *arena,
+				const char *fmt, ...) G_GNUC_PRINTF(2, 3);
+
+/* Bytes handed out, and allocated from malloc for it */
+gsize util_arena_get_used(struct util_arena *arena);
+gsize util_arena_get_size(struct util_arena *arena);
+
+#endif /* __HTTP_SERVER_UTIL_ARENA_H__ */
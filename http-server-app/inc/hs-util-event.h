@@ -0,0 +1,55 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_EVENT_H__
+#define __HTTP_SERVER_UTIL_EVENT_H__
+
+#include <glib.h>
+
+#define UTIL_EVENT_TYPE_CONNECTION "connection"
+#define UTIL_EVENT_TYPE_STORAGE "storage"
+#define UTIL_EVENT_TYPE_APP "app"
+
+struct util_event {
+	guint64 id;
+	const char *type;
+	const char *data;
+};
+
+typedef void (*util_event_listener_cb) (const struct util_event *event,
+						gpointer user_data);
+
+/*
+ * The event hub outlives the http server, so it is initialized from the
+ * app lifecycle.
+ * All functions must be called from the main loop.
+ */
+int util_event_init(void);
+void util_event_fini(void);
+
+/* Events with the same type and key are coalesced, latest data wins */
+void util_event_publish(const char *type, const char *key, char *data);
+
+guint util_event_listener_add(util_event_listener_cb callback, gpointer user_data);
+void util_event_listener_remove(guint listener_id);
+
+guint64 util_event_get_last_id(void);
+
+/* Returns FALSE if some events after last_id are no longer kept */
+gboolean util_event_foreach_since(guint64 last_id,
+				util_event_listener_cb callback, gpointer user_data);
+
+#endif /* __HTTP_SERVER_UTIL_EVENT_H__ */
@@ -0,0 +1,73 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_HEAP_H__
+#define __HTTP_SERVER_UTIL_HEAP_H__
+
+#include <glib.h>
+
+#define UTIL_HEAP_MAX_DEPTH 16
+#define UTIL_HEAP_ROUTE_MAX 48
+
+/*
+ * Counters of a call site, estimated from the sampled allocations. In a
+ * diff of two snapshots they are the growth, which may be negative.
+ */
+struct util_heap_site {
+	const char *route;
+	void *const *frames;
+	int depth;
+	gint64 live_bytes;
+	gint64 live_count;
+	gint64 total_bytes;
+	gint64 total_count;
+};
+
+/*
+ * Samples about one allocation of each sample_bytes allocated by malloc,
+ * on all threads, for as long as it is enabled. Enabling again starts
+ * over. Fails if malloc of this binary is not the one in use, e.g. when
+ * it is loaded by another process rather than executed. GSlice hands out
+ * its own chunks, run with G_SLICE=always-malloc to see them too.
+ * This and the snapshots are for the main loop only.
+ */
+int util_heap_set_enabled(gboolean enabled, unsigned int sample_bytes);
+gboolean util_heap_is_enabled(void);
+unsigned int util_heap_get_sample_bytes(void);
+
+/* Samples which did not fit so far */
+guint64 util_heap_get_dropped(void);
+
+/*
+ * Attributes allocations of the calling thread to route until it is
+ * set back, NULL for none. Returns the previous one.
+ */
+const char *util_heap_route_set(const char *route);
+
+/* Keeps the counters of all sites, the oldest snapshots are dropped */
+guint util_heap_snapshot(void);
+
+typedef void (*util_heap_foreach_cb) (const struct util_heap_site *site,
+				gpointer user_data);
+
+/*
+ * Calls callback for each site of snapshot, 0 for now, less those of
+ * snapshot base, 0 for none. Returns -1 if either is unknown.
+ */
+int util_heap_foreach(guint snapshot, guint base,
+				util_heap_foreach_cb callback, gpointer user_data);
+
+#endif /* __HTTP_SERVER_UTIL_HEAP_H__ */
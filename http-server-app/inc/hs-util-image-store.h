@@ -0,0 +1,82 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_IMAGE_STORE_H__
+#define __HTTP_SERVER_UTIL_IMAGE_STORE_H__
+
+#include <glib.h>
+
+#define UTIL_IMAGE_STORE_DEFAULT_STORAGE -1
+
+typedef void (*util_image_store_drained_cb) (gpointer user_data);
+
+/* error is 0 or an errno value, id is the content hash of the file */
+typedef void (*util_image_store_commit_cb) (const char *id, const char *path,
+						gboolean duplicate, int error, gpointer user_data);
+
+/*
+ * Images are written by a background I/O thread and named after the
+ * SHA-256 of their content. The store outlives the http server, so it is
+ * initialized from the app lifecycle. Other functions must be called
+ * from the main loop.
+ */
+int util_image_store_init(void);
+void util_image_store_fini(void);
+
+/* Parses a storageId parameter, NULL is the default one. FALSE on garbage */
+gboolean util_image_store_parse_storage_id(const char *str, int *storage_id);
+
+/* Returns the image directory of storage_id, or NULL if it is not usable */
+char *util_image_store_get_dir(int storage_id);
+
+/* Returns the path of the stored image id on any storage, or NULL */
+char *util_image_store_lookup(const char *id, const char **content_type);
+
+struct util_image_store_file;
+
+struct util_image_store_file *util_image_store_file_new(const char *dir);
+
+/* Appends to a temp file kept by util_image_store_file_close() */
+struct util_image_store_file *util_image_store_file_resume(const char *tmp_path);
+
+const char *util_image_store_file_get_temp_path(struct util_image_store_file *file);
+
+/* Queues data for writing, returns 0 or the errno of an earlier write */
+int util_image_store_file_write(struct util_image_store_file *file,
+				const char *data, gsize len);
+
+/*
+ * Returns TRUE if the I/O thread is too far behind on file, the writer
+ * should stop reading until callback is called from the main loop. Handing
+ * the file over below drops the callback.
+ */
+gboolean util_image_store_file_wait_drained(struct util_image_store_file *file,
+				util_image_store_drained_cb callback, gpointer user_data);
+
+/*
+ * These hand the file over to the I/O thread, it must not be used after.
+ * callback is called from the main loop once the file is durable.
+ */
+void util_image_store_file_commit(struct util_image_store_file *file,
+				const char *content_type,
+				util_image_store_commit_cb callback, gpointer user_data);
+void util_image_store_file_abort(struct util_image_store_file *file);
+
+/* Keeps the temp file, written so far, for util_image_store_file_resume() */
+void util_image_store_file_close(struct util_image_store_file *file,
+				util_image_store_commit_cb callback, gpointer user_data);
+
+#endif /* __HTTP_SERVER_UTIL_IMAGE_STORE_H__ */
@@ -0,0 +1,41 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_LISTEN_FD_H__
+#define __HTTP_SERVER_UTIL_LISTEN_FD_H__
+
+#include <glib.h>
+
+typedef void (*util_listen_fd_handoff_cb) (gpointer user_data);
+
+/*
+ * Returns a listening socket of port passed by systemd (LISTEN_FDS) or
+ * handed over by a running instance, or -1 if there is none.
+ */
+int util_listen_fd_take(unsigned int port);
+
+/*
+ * Serves listen_fd to a successor taking it with util_listen_fd_take().
+ * callback is called from the main loop once the fd is handed over.
+ */
+int util_listen_fd_handoff_start(unsigned int port, int listen_fd,
+				util_listen_fd_handoff_cb callback, gpointer user_data);
+void util_listen_fd_handoff_stop(void);
+
+/* Swaps the socket behind fd for one which never gets a connection */
+int util_listen_fd_make_dormant(int fd);
+
+#endif /* __HTTP_SERVER_UTIL_LISTEN_FD_H__ */
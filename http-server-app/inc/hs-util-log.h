@@ -0,0 +1,66 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_LOG_H__
+#define __HTTP_SERVER_UTIL_LOG_H__
+
+#include <glib.h>
+
+#define UTIL_LOG_MSG_MAX 112
+
+struct util_log_record {
+	guint64 seq;
+	gint64 time;
+	const char *func;
+	int line;
+	int tid;
+	int prio;
+	char msg[UTIL_LOG_MSG_MAX];
+};
+
+/* lowest dlog priority which is logged, read by the log macros */
+extern int util_log_level;
+
+#define util_log_enabled(prio) ((prio) >= util_log_level)
+
+/*
+ * Starts the background thread writing records to dlog. Until then and
+ * after util_log_fini(), records are written to dlog at once.
+ */
+int util_log_init(void);
+void util_log_fini(void);
+
+void util_log_set_level(int prio);
+
+/* "verbose" to "error", -1 for anything else */
+int util_log_level_from_str(const char *str);
+const char *util_log_level_to_str(int prio);
+
+/* Use the _D() family of macros, they skip all of this below the level */
+void util_log_print(int prio, const char *func, int line,
+				const char *fmt, ...) G_GNUC_PRINTF(4, 5);
+
+typedef void (*util_log_foreach_cb) (const struct util_log_record *record,
+				gpointer user_data);
+
+/* Calls callback for recent records after seq since, oldest first */
+void util_log_foreach(guint64 since, util_log_foreach_cb callback,
+				gpointer user_data);
+
+/* Records lost because the ring of their thread was full */
+guint64 util_log_get_dropped(void);
+
+#endif /* __HTTP_SERVER_UTIL_LOG_H__ */
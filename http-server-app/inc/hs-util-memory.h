@@ -0,0 +1,72 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_MEMORY_H__
+#define __HTTP_SERVER_UTIL_MEMORY_H__
+
+#include <glib.h>
+
+enum util_memory_profile {
+	UTIL_MEMORY_PROFILE_DEFAULT,
+	UTIL_MEMORY_PROFILE_LOW,
+};
+
+/* what the memory budget is spent on */
+enum util_memory_account {
+	UTIL_MEMORY_REQUEST_BODIES,
+	UTIL_MEMORY_RESPONSE_CACHE,
+	UTIL_MEMORY_STREAMS,
+	UTIL_MEMORY_THUMBNAILS,
+	UTIL_MEMORY_ACCOUNT_MAX,
+};
+
+/*
+ * Picks the profile, from HTTP_SERVER_MEMORY_PROFILE ("low" or "default"),
+ * else from the size of the memory, and applies it to malloc, to the
+ * stacks of threads created later and to the budget. Call it before any
+ * thread is created.
+ */
+int util_memory_init(void);
+void util_memory_fini(void);
+
+enum util_memory_profile util_memory_get_profile(void);
+const char *util_memory_profile_to_str(enum util_memory_profile profile);
+
+#define util_memory_is_low() \
+	(util_memory_get_profile() == UTIL_MEMORY_PROFILE_LOW)
+
+/* Takes bytes from the budget for account, FALSE if they do not fit */
+gboolean util_memory_charge(enum util_memory_account account, gsize bytes);
+
+/* Takes bytes which are in use already, even over the budget */
+void util_memory_charge_force(enum util_memory_account account, gsize bytes);
+void util_memory_uncharge(enum util_memory_account account, gsize bytes);
+
+gboolean util_memory_is_over_budget(void);
+gsize util_memory_get_budget(void);
+gsize util_memory_get_used(void);
+
+typedef void (*util_memory_account_cb) (const char *name, gsize used,
+				gsize peak, guint64 refused, gpointer user_data);
+
+void util_memory_foreach_account(util_memory_account_cb callback,
+				gpointer user_data);
+
+/* malloc heap in use and free for reuse, and the resident set size */
+void util_memory_get_heap(gsize *in_use, gsize *free_bytes);
+gsize util_memory_get_rss(void);
+
+#endif /* __HTTP_SERVER_UTIL_MEMORY_H__ */
@@ -0,0 +1,49 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_MULTIPART_H__
+#define __HTTP_SERVER_UTIL_MULTIPART_H__
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+/* Callbacks return FALSE to abort parsing */
+struct util_multipart_callbacks {
+	gboolean (*part_begin) (SoupMessageHeaders *headers, gpointer user_data);
+	gboolean (*part_data) (const char *data, gsize len, gpointer user_data);
+	gboolean (*part_end) (gpointer user_data);
+};
+
+struct util_multipart_parser;
+
+/*
+ * Incremental multipart/form-data parser, memory use is bounded by the
+ * largest chunk fed plus the part headers, whatever the body size is.
+ */
+struct util_multipart_parser *
+util_multipart_parser_new(const char *boundary,
+				const struct util_multipart_callbacks *callbacks,
+				gpointer user_data);
+void util_multipart_parser_free(struct util_multipart_parser *parser);
+
+gboolean util_multipart_parser_feed(struct util_multipart_parser *parser,
+				const char *data, gsize len);
+gboolean util_multipart_parser_is_done(struct util_multipart_parser *parser);
+
+/* Returns the boundary of a multipart/form-data request, or NULL */
+char *util_multipart_get_boundary(SoupMessage *msg);
+
+#endif /* __HTTP_SERVER_UTIL_MULTIPART_H__ */
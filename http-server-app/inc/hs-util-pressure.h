@@ -0,0 +1,48 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_PRESSURE_H__
+#define __HTTP_SERVER_UTIL_PRESSURE_H__
+
+#include <glib.h>
+
+enum util_pressure_level {
+	UTIL_PRESSURE_NONE,
+	UTIL_PRESSURE_HIGH,
+	UTIL_PRESSURE_CRITICAL,
+};
+
+/* avg10 of /proc/pressure, in percent, 0 where PSI is not supported */
+struct util_pressure {
+	gboolean psi;
+	double cpu_some;
+	double memory_some;
+	double memory_full;
+	double io_some;
+	guint64 mem_available_kb;
+	guint64 mem_total_kb;
+	enum util_pressure_level level;
+};
+
+/*
+ * Returns the system pressure, sampled at most once a second so it is
+ * cheap enough to call for each request. Main loop only.
+ */
+const struct util_pressure *util_pressure_get(void);
+
+const char *util_pressure_level_to_str(enum util_pressure_level level);
+
+#endif /* __HTTP_SERVER_UTIL_PRESSURE_H__ */
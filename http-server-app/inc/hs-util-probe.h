@@ -0,0 +1,47 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_PROBE_H__
+#define __HTTP_SERVER_UTIL_PROBE_H__
+
+/*
+ * USDT probes of provider httpserver, e.g.
+ *   bpftrace -e 'usdt:./httpserver:httpserver:handler__return
+ *                { printf("%d %s %d\n", arg0, str(arg1), arg2); }'
+ * A probe is a nop until a tracer attaches to it. Without sys/sdt.h, or
+ * with HS_DISABLE_PROBES, they are compiled out and their arguments are
+ * not evaluated.
+ */
+#if !defined(HS_DISABLE_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#define HS_HAVE_PROBES 1
+#endif
+#endif
+
+#ifdef HS_HAVE_PROBES
+#include <sys/sdt.h>
+
+#define HS_PROBE2(name, a1, a2) DTRACE_PROBE2(httpserver, name, a1, a2)
+#define HS_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(httpserver, name, a1, a2, a3)
+#define HS_PROBE4(name, a1, a2, a3, a4) \
+	DTRACE_PROBE4(httpserver, name, a1, a2, a3, a4)
+#else
+#define HS_PROBE2(name, a1, a2) do { } while (0)
+#define HS_PROBE3(name, a1, a2, a3) do { } while (0)
+#define HS_PROBE4(name, a1, a2, a3, a4) do { } while (0)
+#endif
+
+#endif /* __HTTP_SERVER_UTIL_PROBE_H__ */
@@ -0,0 +1,54 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_PROFILE_H__
+#define __HTTP_SERVER_UTIL_PROFILE_H__
+
+#include <glib.h>
+
+#define UTIL_PROFILE_MAX_HZ 1000
+
+/*
+ * Samples the stacks of all threads with SIGPROF, hz times for each
+ * second of cpu time the process uses, keeping up to max_samples.
+ * One profile runs at a time. Main loop only.
+ */
+int util_profile_start(unsigned int hz, unsigned int max_samples);
+void util_profile_stop(void);
+gboolean util_profile_is_running(void);
+
+typedef void (*util_profile_foreach_cb) (const char *stack, guint count,
+				gpointer user_data);
+
+/*
+ * Calls callback for each distinct stack of the last profile, as
+ * "thread;outermost;...;innermost". Functions which are not exported,
+ * e.g. of an executable linked without -rdynamic, are named by their
+ * module and offset.
+ */
+void util_profile_foreach(util_profile_foreach_cb callback, gpointer user_data);
+
+/* Samples of the last profile, and those lost for lack of room */
+guint util_profile_get_samples(void);
+guint util_profile_get_dropped(void);
+
+/* Frees the samples of the last profile */
+void util_profile_clear(void);
+
+/* Name of the function at addr, as util_profile_foreach() names them */
+char *util_profile_symbol_name(const void *addr);
+
+#endif /* __HTTP_SERVER_UTIL_PROFILE_H__ */
@@ -0,0 +1,47 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_THUMBNAIL_H__
+#define __HTTP_SERVER_UTIL_THUMBNAIL_H__
+
+#include <glib.h>
+
+/* error is 0 or an errno value */
+typedef void (*util_thumbnail_cb) (const char *path, int error,
+					gpointer user_data);
+
+/*
+ * Thumbnails are JPEG files generated by a pool of worker threads and
+ * cached next to the original image. All functions must be called from
+ * the main loop.
+ */
+int util_thumbnail_init(void);
+void util_thumbnail_fini(void);
+
+/* Returns the smallest configured width not below width, 0 if none is */
+guint util_thumbnail_fit_width(guint width);
+
+char *util_thumbnail_get_path(const char *image_path, const char *id, guint width);
+
+/*
+ * Generates the thumbnail of width, or of every configured width when
+ * width is 0. callback is called from the main loop for each of them,
+ * and may be NULL.
+ */
+void util_thumbnail_generate(const char *image_path, const char *id, guint width,
+				util_thumbnail_cb callback, gpointer user_data);
+
+#endif /* __HTTP_SERVER_UTIL_THUMBNAIL_H__ */
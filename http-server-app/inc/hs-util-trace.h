@@ -0,0 +1,47 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_TRACE_H__
+#define __HTTP_SERVER_UTIL_TRACE_H__
+
+#include <glib.h>
+
+/* a complete span of Chrome trace-event format, times in us */
+struct util_trace_event {
+	const char *name;
+	guint id;
+	int tid;
+	gint64 ts;
+	gint64 dur;
+};
+
+extern int util_trace_on;
+
+#define util_trace_enabled() (util_trace_on)
+
+/* Recording allocates a fixed buffer, the oldest spans are overwritten */
+int util_trace_set_enabled(gboolean enabled);
+
+/* name must be a static string, it is kept as is */
+void util_trace_span(guint id, const char *name, gint64 begin, gint64 end);
+
+typedef void (*util_trace_foreach_cb) (const struct util_trace_event *event,
+				gpointer user_data);
+
+/* Calls callback for the recorded spans, oldest first */
+void util_trace_foreach(util_trace_foreach_cb callback, gpointer user_data);
+
+#endif /* __HTTP_SERVER_UTIL_TRACE_H__ */
@@ -0,0 +1,34 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_UPLOAD_QUOTA_H__
+#define __HTTP_SERVER_UTIL_UPLOAD_QUOTA_H__
+
+#include <glib.h>
+
+/*
+ * Bytes a client may store in an hour, over all upload routes. Clients
+ * without a host are not limited, as with the request rate. Main loop
+ * only.
+ */
+
+/* FALSE if length more bytes put host over its quota */
+gboolean util_upload_quota_check(const char *host, goffset length);
+void util_upload_quota_charge(const char *host, goffset length);
+
+void util_upload_quota_fini(void);
+
+#endif /* __HTTP_SERVER_UTIL_UPLOAD_QUOTA_H__ */
@@ -0,0 +1,44 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __HTTP_SERVER_UTIL_WATCHDOG_H__
+#define __HTTP_SERVER_UTIL_WATCHDOG_H__
+
+#include <glib.h>
+
+/* dispatch lag of the main loop, in us */
+struct util_watchdog_stats {
+	gint64 lag_avg;
+	gint64 lag_max;
+	guint64 stalls;
+};
+
+/*
+ * Beats on the main loop and watches it from a thread, which logs the
+ * main loop being stuck for stall_ms or more while it still is.
+ */
+int util_watchdog_start(unsigned int stall_ms);
+void util_watchdog_stop(void);
+
+/*
+ * Names what the main loop is busy with, NULL for nothing, for the
+ * stall log. name must stay valid until it is replaced. Main loop only.
+ */
+void util_watchdog_activity_set(const char *name);
+
+void util_watchdog_get_stats(struct util_watchdog_stats *stats);
+
+#endif /* __HTTP_SERVER_UTIL_WATCHDOG_H__ */
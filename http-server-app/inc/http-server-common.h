@@ -27,6 +27,28 @@ void http_server_destroy(void);
 int http_server_start(void);
 int http_server_stop(void);
 
+/*
+ * Responses of min_size bytes or more are sent gzip compressed at level
+ * to clients accepting it, level 0 disables compression.
+ */
+int http_server_set_compression(unsigned int min_size, int level);
+
+/*
+ * Each client gets burst tokens, refilled by rate a second. Requests
+ * cost one token unless their route sets otherwise, a client out of
+ * tokens is answered with 429 and Retry-After. rate 0 disables it.
+ */
+int http_server_set_client_rate(unsigned int rate, unsigned int burst);
+
+typedef void (*http_server_handoff_cb) (void *user_data);
+
+/*
+ * A new instance takes the listening socket over from a running one, so
+ * no connection is refused during an upgrade. callback is called once
+ * the running instance has handed it over and accepts no more.
+ */
+int http_server_set_handoff_callback(http_server_handoff_cb callback, void *user_data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -18,30 +18,47 @@
 #define __HTTP_SERVER_LOG_H__
 
 #include <dlog.h>
+#include "hs-util-log.h"
 
 #ifdef	LOG_TAG
 #undef	LOG_TAG
 #endif
 #define LOG_TAG "HTTPSERVER"
 
+/* arguments are not even evaluated below util_log_level */
 #if !defined(_V)
-#define _V(fmt, arg...) dlog_print(DLOG_VERBOSE, LOG_TAG, "[%s:%d] " fmt "\n", __func__, __LINE__, ##arg)
+#define _V(fmt, arg...) do { \
+	if (util_log_enabled(DLOG_VERBOSE)) \
+		util_log_print(DLOG_VERBOSE, __func__, __LINE__, fmt, ##arg); \
+} while (0)
 #endif
 
 #if !defined(_D)
-#define _D(fmt, arg...) dlog_print(DLOG_DEBUG, LOG_TAG, "[%s:%d] " fmt "\n", __func__, __LINE__, ##arg)
+#define _D(fmt, arg...) do { \
+	if (util_log_enabled(DLOG_DEBUG)) \
+		util_log_print(DLOG_DEBUG, __func__, __LINE__, fmt, ##arg); \
+} while (0)
 #endif
 
 #if !defined(_I)
-#define _I(fmt, arg...) dlog_print(DLOG_INFO, LOG_TAG, "[%s:%d] " fmt "\n", __func__, __LINE__, ##arg)
+#define _I(fmt, arg...) do { \
+	if (util_log_enabled(DLOG_INFO)) \
+		util_log_print(DLOG_INFO, __func__, __LINE__, fmt, ##arg); \
+} while (0)
 #endif
 
 #if !defined(_W)
-#define _W(fmt, arg...) dlog_print(DLOG_WARN, LOG_TAG, "[%s:%d] " fmt "\n", __func__, __LINE__, ##arg)
+#define _W(fmt, arg...) do { \
+	if (util_log_enabled(DLOG_WARN)) \
+		util_log_print(DLOG_WARN, __func__, __LINE__, fmt, ##arg); \
+} while (0)
 #endif
 
 #if !defined(_E)
-#define _E(fmt, arg...) dlog_print(DLOG_ERROR, LOG_TAG, "[%s:%d] " fmt "\n", __func__, __LINE__, ##arg)
+#define _E(fmt, arg...) do { \
+	if (util_log_enabled(DLOG_ERROR)) \
+		util_log_print(DLOG_ERROR, __func__, __LINE__, fmt, ##arg); \
+} while (0)
 #endif
 
 #define retvm_if(expr, val, fmt, arg...) do { \
@@ -35,12 +35,132 @@ int http_server_route_handler_add(const char *route_path,
 
 int http_server_route_handler_remove(const char *path);
 
+typedef void (*http_server_route_headers_callback) (SoupMessage *msg,
+						const char *path, SoupClientContext *client,
+						gpointer user_data);
+
+/*
+ * Called once the request headers of path are read, before the body.
+ * Handlers may prepare streaming of the request body, or set an error
+ * status to refuse the request.
+ */
+int http_server_route_headers_handler_add(const char *route_path,
+								http_server_route_headers_callback callback,
+								gpointer user_data,
+								GDestroyNotify destroy);
+
+/*
+ * Runs at most max_in_flight requests of path at once, until they are
+ * finished. Up to max_queued more wait paused for their turn, others are
+ * refused with 503 and Retry-After.
+ */
+int http_server_route_limit_set(const char *path,
+				unsigned int max_in_flight, unsigned int max_queued);
+
+typedef enum {
+	HTTP_SERVER_ROUTE_COST_NORMAL,
+	HTTP_SERVER_ROUTE_COST_HIGH,
+} http_server_route_cost_e;
+
+/*
+ * Marks path as expensive to serve. Under memory or io pressure its
+ * requests are refused with 503 and Retry-After, and if it has a limit,
+ * it runs one request at a time already once the system gets busy.
+ */
+int http_server_route_cost_set(const char *path, http_server_route_cost_e cost);
+
+/* Tokens a request of path takes from its client, see http_server_set_client_rate() */
+int http_server_route_rate_cost_set(const char *path, unsigned int tokens);
+
+/* Number of requests refused for system pressure so far */
+guint64 http_server_route_get_shed_count(void);
+
+/*
+ * Expects the handler of path to return within budget_ms. Once it runs
+ * over a few times in a row, it is moved off the main loop to worker
+ * threads, and back after a longer run within budget.
+ *
+ * Only for handlers which answer before they return: on a worker the
+ * handler gets a copy of the message which is not bound to a connection,
+ * client is NULL, and http_server_pause_message() and
+ * http_server_unpause_message() fail. Anything else it touches besides
+ * the message must be safe to use from another thread.
+ */
+int http_server_route_budget_set(const char *path, unsigned int budget_ms);
+
+typedef void (*http_server_route_budget_cb) (const char *path,
+						guint64 overruns, gboolean offloaded,
+						gpointer user_data);
+
+void http_server_route_foreach_budget(http_server_route_budget_cb callback,
+				gpointer user_data);
+
+typedef void (*http_server_route_stats_cb) (const char *path,
+						guint in_flight, guint queued, guint64 rejected,
+						gpointer user_data);
+
+void http_server_route_foreach_stats(http_server_route_stats_cb callback,
+				gpointer user_data);
+
+typedef void (*http_server_dispatch_done_cb) (SoupMessage *msg, gpointer user_data);
+
+/*
+ * Runs the handler registered for path on a message which is not bound
+ * to any connection. done is called from the main loop once the handler
+ * has filled the response, including handlers which pause the message.
+ */
+int http_server_route_dispatch(SoupMessage *msg, const char *path,
+						GHashTable *query, SoupClientContext *client,
+						http_server_dispatch_done_cb done, gpointer user_data);
+
 int http_server_pause_message(SoupMessage *msg);
 int http_server_unpause_message(SoupMessage *msg);
 
+/*
+ * Returns the cancellable of msg, cancelled when its client goes away
+ * before the response is sent. Handlers doing work in the background
+ * stop early on it and must not touch the message once it is cancelled,
+ * apart from releasing their reference.
+ */
+GCancellable *http_server_message_get_cancellable(SoupMessage *msg);
+
+typedef enum {
+	HTTP_SERVER_SPAN_PLATFORM,
+	HTTP_SERVER_SPAN_SERIALIZE,
+} http_server_span_e;
+
+/*
+ * Times platform calls and serialization of the handler of msg, for
+ * /api/debug/trace, the Server-Timing header and the span__begin and
+ * span__end probes. begin returns 0 if nobody looks, which end ignores.
+ * name must be a static string. Handlers may call these from their
+ * threads while msg is paused.
+ */
+gint64 http_server_message_span_begin(SoupMessage *msg, const char *name);
+void http_server_message_span_end(SoupMessage *msg, http_server_span_e type,
+				const char *name, gint64 begin);
+
+struct util_arena;
+
+/*
+ * Returns the arena of msg for temporaries of its handler, see
+ * hs-util-arena.h. It is freed once the response is sent, or with msg
+ * if the request is aborted, so nothing may outlive the request in it.
+ */
+struct util_arena *http_server_message_get_arena(SoupMessage *msg);
+
+/* Cancels msg, e.g. a dispatched message whose result is not wanted */
+void http_server_message_cancel(SoupMessage *msg);
+
 int http_server_auth_default_realm_path_add(const char *path);
 int http_server_auth_default_realm_path_remove(const char *path);
 
+/*
+ * Puts path under the admin realm alone, users of the default realm get
+ * 401. With writes_only, GET and HEAD stay under the default realm.
+ */
+int http_server_auth_admin_realm_path_add(const char *path, gboolean writes_only);
+
 #ifdef __cplusplus
 }
 #endif
@@ -224,6 +224,45 @@ function fetchApplicationList() {
 	httpRequestAsync("GET", "/api/applicationList", setAppliationList);
 }
 
+// device state events
+function isTabActive(tabId) {
+	return document.getElementById(tabId).classList.contains("active");
+}
+
+function refreshActiveTab() {
+	if (isTabActive("storage-tab"))
+		fetchStorageInfo();
+	else if (isTabActive("connection-tab"))
+		fetchConnectionStatus();
+	else if (isTabActive("application-tab"))
+		fetchApplicationList();
+}
+
+function subscribeEvents() {
+	if (!window.EventSource)
+		return;
+
+	// EventSource reconnects by itself and resumes with Last-Event-ID
+	var events = new EventSource("/api/events");
+
+	events.addEventListener("connection", function () {
+		if (isTabActive("connection-tab"))
+			fetchConnectionStatus();
+	});
+
+	events.addEventListener("storage", function () {
+		if (isTabActive("storage-tab"))
+			fetchStorageInfo();
+	});
+
+	events.addEventListener("app", function () {
+		if (isTabActive("application-tab"))
+			fetchApplicationList();
+	});
+
+	events.addEventListener("resync", refreshActiveTab);
+}
+
 (() => {
 	document.addEventListener("DOMContentLoaded", function () {
 		fetchSystemInfo();
@@ -245,4 +284,6 @@ function fetchApplicationList() {
 	document.getElementById("application-tab").addEventListener("click", function () {
 		fetchApplicationList();
 	});
+
+	subscribeEvents();
 })();
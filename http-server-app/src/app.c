@@ -14,6 +14,7 @@
  * limitations under the License.
  */
 
+#include <glib.h>
 #include <service_app.h>
 #include <net_connection.h>
 #include "http-server-log-private.h"
@@ -24,14 +25,40 @@
 #include "hs-route-api-sysinfo.h"
 #include "hs-route-api-storage.h"
 #include "hs-route-api-image-upload.h"
+#include "hs-route-api-events.h"
+#include "hs-route-api-telemetry.h"
+#include "hs-route-api-batch.h"
+#include "hs-route-api-images.h"
+#include "hs-route-api-uploads.h"
+#include "hs-route-api-logs.h"
+#include "hs-route-api-debug.h"
+#include "hs-util-event.h"
+#include "hs-util-image-store.h"
+#include "hs-util-thumbnail.h"
+#include "hs-util-upload-quota.h"
+#include "hs-util-log.h"
+#include "hs-util-memory.h"
+#include "hs-util-watchdog.h"
 
 
 #define SERVER_NAME "http-server-app"
 #define SERVER_PORT 8080
+/* below about one packet compression saves nothing */
+#define SERVER_COMPRESS_MIN_SIZE 1400
+/* close to the ratio of level 9 on JSON, at a fraction of the CPU */
+#define SERVER_COMPRESS_LEVEL 5
+/* a client may burst a page load, then about 5 requests a second */
+#define SERVER_CLIENT_RATE 5
+#define SERVER_CLIENT_BURST 30
+/* requests in flight get this long to finish after a handoff */
+#define SERVER_HANDOFF_DRAIN_SEC 10
+/* the main loop blocked this long is logged, with what it was doing */
+#define SERVER_STALL_MS 250
 
 struct app_data {
 	connection_h conn_h;
 	connection_type_e cur_conn_type;
+	bool server_started;
 };
 
 static int route_modules_init(void)
@@ -56,6 +83,27 @@ static int route_modules_init(void)
 	ret = hs_route_api_image_upload_init();
 	retv_if(ret, -1);
 
+	ret = hs_route_api_events_init();
+	retv_if(ret, -1);
+
+	ret = hs_route_api_telemetry_init();
+	retv_if(ret, -1);
+
+	ret = hs_route_api_batch_init();
+	retv_if(ret, -1);
+
+	ret = hs_route_api_images_init();
+	retv_if(ret, -1);
+
+	ret = hs_route_api_uploads_init();
+	retv_if(ret, -1);
+
+	ret = hs_route_api_logs_init();
+	retv_if(ret, -1);
+
+	ret = hs_route_api_debug_init();
+	retv_if(ret, -1);
+
 
 	return 0;
 }
@@ -66,6 +114,20 @@ static void server_destroy(void)
 	_D("server is destroyed");
 }
 
+static gboolean server_handoff_exit_cb(gpointer data)
+{
+	_D("exit after the listener handoff");
+	service_app_exit();
+
+	return G_SOURCE_REMOVE;
+}
+
+static void server_handed_off_cb(void *data)
+{
+	_D("listener is taken by a new instance");
+	g_timeout_add_seconds(SERVER_HANDOFF_DRAIN_SEC, server_handoff_exit_cb, NULL);
+}
+
 static int server_init_n_start(void)
 {
 	int ret = 0;
@@ -73,14 +135,28 @@ static int server_init_n_start(void)
 	ret = http_server_create(SERVER_NAME, SERVER_PORT);
 	retv_if(ret, -1);
 
+	ret = http_server_set_compression(SERVER_COMPRESS_MIN_SIZE,
+					SERVER_COMPRESS_LEVEL);
+	goto_if(ret, ERROR);
+
+	ret = http_server_set_client_rate(SERVER_CLIENT_RATE, SERVER_CLIENT_BURST);
+	goto_if(ret, ERROR);
+
+	ret = http_server_set_handoff_callback(server_handed_off_cb, NULL);
+	goto_if(ret, ERROR);
+
 	ret = route_modules_init();
-	retv_if(ret, -1);
+	goto_if(ret, ERROR);
 
 	ret = http_server_start();
-	retv_if(ret, -1);
+	goto_if(ret, ERROR);
 
 	_D("server is started");
 	return 0;
+
+ERROR:
+	server_destroy();
+	return -1;
 }
 
 static void conn_type_changed_cb(connection_type_e type, void *data)
@@ -89,19 +165,22 @@ static void conn_type_changed_cb(connection_type_e type, void *data)
 
 	_D("connection type is changed [%d] -> [%d]", ad->cur_conn_type, type);
 
-	server_destroy();
+	ad->cur_conn_type = type;
 
-	if (type != CONNECTION_TYPE_DISCONNECTED) {
-		int ret = 0;
-		_D("restart server");
-		ret = server_init_n_start();
-		if (ret) {
-			_E("failed to start server");
-			service_app_exit();
-		}
+	/*
+	 * The server listens on any address, so it keeps working on the new
+	 * network as it is, with its requests, sessions and caches.
+	 */
+	if (ad->server_started || type == CONNECTION_TYPE_DISCONNECTED)
+		return;
+
+	_D("start server on the first connection");
+	if (server_init_n_start()) {
+		_E("failed to start server");
+		service_app_exit();
+		return;
 	}
-
-	ad->cur_conn_type = type;
+	ad->server_started = true;
 
 	return;
 }
@@ -117,8 +196,27 @@ static bool service_app_create(void *data)
 
 	retv_if(!ad, false);
 
+	/* first, the threads created from here on get its stack size */
+	util_memory_init();
+
+	/* not fatal, records are written to dlog at once without it */
+	if (util_log_init())
+		_W("failed to start log thread");
+
+	if (util_watchdog_start(SERVER_STALL_MS))
+		_W("failed to start watchdog");
+
 	ret = connection_create(&ad->conn_h);
-	retv_if(ret, false);
+	goto_if(ret, ERROR);
+
+	ret = util_event_init();
+	goto_if(ret, ERROR);
+
+	ret = util_image_store_init();
+	goto_if(ret, ERROR);
+
+	ret = util_thumbnail_init();
+	goto_if(ret, ERROR);
 
 	ret = connection_set_type_changed_cb(ad->conn_h, conn_type_changed_cb, ad);
 	goto_if(ret, ERROR);
@@ -131,6 +229,7 @@ static bool service_app_create(void *data)
 
 	ret = server_init_n_start();
 	goto_if(ret, ERROR);
+	ad->server_started = true;
 
 	return true;
 
@@ -139,6 +238,13 @@ ERROR:
 		connection_destroy(ad->conn_h);
 
 	server_destroy();
+	util_thumbnail_fini();
+	util_image_store_fini();
+	util_upload_quota_fini();
+	util_event_fini();
+	util_watchdog_stop();
+	util_memory_fini();
+	util_log_fini();
 	return false;
 }
 
@@ -147,12 +253,21 @@ static void service_app_terminate(void *data)
 	struct app_data *ad = data;
 
 	server_destroy();
+	util_thumbnail_fini();
+	util_image_store_fini();
+	util_upload_quota_fini();
+	util_event_fini();
 
 	if (ad->conn_h) {
 		connection_destroy(ad->conn_h);
 		ad->conn_h = NULL;
 	}
 	ad->cur_conn_type = CONNECTION_TYPE_DISCONNECTED;
+	ad->server_started = false;
+
+	util_watchdog_stop();
+	util_memory_fini();
+	util_log_fini();
 
 	return;
 }
@@ -164,6 +279,7 @@ int main(int argc, char* argv[])
 
 	ad.conn_h = NULL;
 	ad.cur_conn_type = CONNECTION_TYPE_DISCONNECTED;
+	ad.server_started = false;
 
 	event_callback.create = service_app_create;
 	event_callback.terminate = service_app_terminate;
@@ -33,6 +33,20 @@
 #define APP_SERVICE "Service"
 #define APP_TERMINATED "Terminated"
 
+#define API_APPLIST "/api/applicationList"
+/* each request walks every installed app in a thread of its own */
+#define APPLIST_MAX_IN_FLIGHT 2
+#define APPLIST_MAX_QUEUED 8
+#define APPLIST_RATE_COST 5
+
+struct applist_data {
+	SoupMessage *msg;
+	GCancellable *cancellable;
+	JsonBuilder *builder;
+	char *response_msg;
+	gsize resp_msg_size;
+};
+
 static const char *__app_state_to_str(app_state_e state)
 {
 	const char *str = NULL;
@@ -58,7 +72,8 @@ static const char *__app_state_to_str(app_state_e state)
 
 static bool app_info_foreach_cb(app_info_h app_info, void *user_data)
 {
-	JsonBuilder *builder = user_data;
+	struct applist_data *data = user_data;
+	JsonBuilder *builder = data->builder;
 	char *app_id = NULL;
 	app_context_h app_context = NULL;
 	int pid = 0;
@@ -66,6 +81,10 @@ static bool app_info_foreach_cb(app_info_h app_info, void *user_data)
 	const char *app_state = NULL;
 	retv_if(!builder, false);
 
+	/* the client is gone, the rest of the apps are not looked up */
+	if (g_cancellable_is_cancelled(data->cancellable))
+		return false;
+
 	app_info_get_app_id(app_info, &app_id);
 	retv_if(!app_id, false);
 
@@ -99,30 +118,41 @@ static bool app_info_foreach_cb(app_info_h app_info, void *user_data)
 	return true;
 }
 
-static void app_info_response_append(SoupMessage *msg)
+/* Does not touch the message but its spans, it may run in a thread */
+static void app_info_response_build(struct applist_data *data)
 {
-	char *response_msg = NULL;
-	gsize resp_msg_size = 0;
-	JsonBuilder *builder = NULL;
+	gint64 begin = 0;
 
-	builder = json_builder_new();
+	data->builder = json_builder_new();
 
-	json_builder_begin_object(builder);
-	json_builder_set_member_name(builder, "installedAppList");
+	json_builder_begin_object(data->builder);
+	json_builder_set_member_name(data->builder, "installedAppList");
 
-	json_builder_begin_array(builder);
-	app_manager_foreach_app_info(app_info_foreach_cb, builder);
-	json_builder_end_array(builder);
+	json_builder_begin_array(data->builder);
+	begin = http_server_message_span_begin(data->msg,
+				"app_manager_foreach_app_info");
+	app_manager_foreach_app_info(app_info_foreach_cb, data);
+	http_server_message_span_end(data->msg, HTTP_SERVER_SPAN_PLATFORM,
+				"app_manager_foreach_app_info", begin);
+	json_builder_end_array(data->builder);
 
-	json_builder_end_object(builder);
+	json_builder_end_object(data->builder);
 
-	response_msg = util_json_generate_str(builder, &resp_msg_size);
-	g_clear_pointer(&builder, g_object_unref);
+	begin = http_server_message_span_begin(data->msg, "json");
+	data->response_msg = util_json_generate_str(data->builder,
+						&data->resp_msg_size);
+	http_server_message_span_end(data->msg, HTTP_SERVER_SPAN_SERIALIZE,
+				"json", begin);
+	g_clear_pointer(&data->builder, g_object_unref);
+}
 
-	soup_message_body_append(msg->response_body, SOUP_MEMORY_COPY,
-					response_msg, resp_msg_size);
+static void app_info_response_append(struct applist_data *data)
+{
+	SoupMessage *msg = data->msg;
 
-	g_clear_pointer(&response_msg, g_free);
+	soup_message_body_append(msg->response_body, SOUP_MEMORY_TAKE,
+					data->response_msg, data->resp_msg_size);
+	data->response_msg = NULL;
 
 	soup_message_headers_set_content_type(
 						msg->response_headers, "application/json", NULL);
@@ -130,21 +160,35 @@ static void app_info_response_append(SoupMessage *msg)
 	soup_message_set_status(msg, SOUP_STATUS_OK);
 }
 
+static void applist_data_free(struct applist_data *data)
+{
+	g_object_unref(data->cancellable);
+	g_object_unref(data->msg);
+	g_free(data->response_msg);
+	g_free(data);
+}
+
 #if ASYNC_RESPONSE
-static gboolean __handle_message_finished(gpointer data)
+static gboolean __handle_message_finished(gpointer user_data)
 {
-	SoupMessage *msg = data;
-	http_server_unpause_message(msg);
+	struct applist_data *data = user_data;
+
+	if (!g_cancellable_is_cancelled(data->cancellable)) {
+		app_info_response_append(data);
+		http_server_unpause_message(data->msg);
+	}
+	applist_data_free(data);
+
 	return FALSE;
 }
 
-static gpointer app_info_thread(gpointer data)
+static gpointer app_info_thread(gpointer user_data)
 {
-	SoupMessage *msg = data;
+	struct applist_data *data = user_data;
 
-	app_info_response_append(msg);
+	app_info_response_build(data);
 
-	g_idle_add(__handle_message_finished, msg);
+	g_idle_add(__handle_message_finished, data);
 
 	return NULL;
 }
@@ -154,26 +198,48 @@ static void route_api_applist_callback(SoupMessage *msg,
 					const char *path, GHashTable *query,
 					SoupClientContext *client, gpointer user_data)
 {
+	struct applist_data *data = NULL;
+
 	if (msg->method != SOUP_METHOD_GET) {
 		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
 		return;
 	}
 
+	data = g_new0(struct applist_data, 1);
+	data->msg = g_object_ref(msg);
+	data->cancellable = g_object_ref(http_server_message_get_cancellable(msg));
+
 #if ASYNC_RESPONSE
-	GThread *thread = g_thread_try_new(NULL, app_info_thread, msg, NULL);
+	GThread *thread = g_thread_try_new(NULL, app_info_thread, data, NULL);
 	if (!thread) {
 		_E("failed to create thread");
 		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		applist_data_free(data);
 		return;
 	}
+	g_thread_unref(thread);
 	http_server_pause_message(msg);
 #else
-	app_info_response_append(msg);
+	app_info_response_build(data);
+	app_info_response_append(data);
+	applist_data_free(data);
 #endif /* ASYNC_RESPONSE */
 }
 
 int hs_route_api_applist_init(void)
 {
-	return http_server_route_handler_add("/api/applicationList",
+	int ret = 0;
+
+	ret = http_server_route_handler_add(API_APPLIST,
 				route_api_applist_callback, NULL, NULL);
+	retv_if(ret, -1);
+
+	ret = http_server_route_cost_set(API_APPLIST, HTTP_SERVER_ROUTE_COST_HIGH);
+	retv_if(ret, -1);
+
+	ret = http_server_route_rate_cost_set(API_APPLIST, APPLIST_RATE_COST);
+	retv_if(ret, -1);
+
+	return http_server_route_limit_set(API_APPLIST,
+				APPLIST_MAX_IN_FLIGHT, APPLIST_MAX_QUEUED);
 }
@@ -0,0 +1,318 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+#include "http-server-log-private.h"
+#include "http-server-route.h"
+#include "hs-util-json.h"
+
+#define API_BATCH "/api/batch"
+
+#define BATCH_TIMEOUT_MS_DEFAULT 5000
+#define BATCH_TIMEOUT_MS_MAX 30000
+#define BATCH_INTERNAL_URI "http://localhost"
+
+/* only plain request/response resources can be batched */
+static const struct {
+	const char *name;
+	const char *path;
+} batch_resources[] = {
+	{ "systemInfo", "/api/systemInfo" },
+	{ "storage", "/api/storage" },
+	{ "connection", "/api/connection" },
+	{ "applicationList", "/api/applicationList" },
+	{ "wifiScan", "/api/connection/wifiScan" },
+};
+
+struct batch_data;
+
+struct batch_part {
+	struct batch_data *batch;
+	const char *name;
+	SoupMessage *msg;
+	gboolean done;
+};
+
+struct batch_data {
+	SoupMessage *msg;
+	gboolean msg_finished;
+	struct batch_part **parts;
+	guint n_parts;
+	guint n_pending;
+	guint timeout_source;
+};
+
+static int __resource_index(const char *name)
+{
+	guint i = 0;
+
+	for (i = 0; i < G_N_ELEMENTS(batch_resources); i++) {
+		if (0 == g_strcmp0(batch_resources[i].name, name))
+			return i;
+	}
+
+	return -1;
+}
+
+static void __batch_add_part_body(JsonBuilder *builder, SoupMessage *msg)
+{
+	SoupBuffer *body = NULL;
+	JsonParser *parser = NULL;
+
+	body = soup_message_body_flatten(msg->response_body);
+	if (!body->length) {
+		soup_buffer_free(body);
+		return;
+	}
+
+	json_builder_set_member_name(builder, "body");
+
+	parser = json_parser_new();
+	if (json_parser_load_from_data(parser, body->data, body->length, NULL)) {
+		json_builder_add_value(builder,
+				json_node_copy(json_parser_get_root(parser)));
+	} else {
+		char *text = g_strndup(body->data, body->length);
+		json_builder_add_string_value(builder, text);
+		g_free(text);
+	}
+
+	g_object_unref(parser);
+	soup_buffer_free(body);
+}
+
+static void __batch_respond(struct batch_data *batch)
+{
+	JsonBuilder *builder = NULL;
+	char *response_msg = NULL;
+	gsize resp_msg_size = 0;
+	guint i = 0;
+
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+
+	for (i = 0; i < batch->n_parts; i++) {
+		struct batch_part *part = batch->parts[i];
+
+		json_builder_set_member_name(builder, part->name);
+		json_builder_begin_object(builder);
+
+		if (part->done) {
+			util_json_add_int(builder, "status", part->msg->status_code);
+			__batch_add_part_body(builder, part->msg);
+		} else {
+			util_json_add_int(builder, "status", SOUP_STATUS_GATEWAY_TIMEOUT);
+			util_json_add_str(builder, "error", "timeout");
+		}
+
+		json_builder_end_object(builder);
+	}
+
+	json_builder_end_object(builder);
+
+	response_msg = util_json_generate_str(builder, &resp_msg_size);
+	g_clear_pointer(&builder, g_object_unref);
+
+	soup_message_body_append(batch->msg->response_body, SOUP_MEMORY_TAKE,
+					response_msg, resp_msg_size);
+
+	soup_message_headers_set_content_type(
+						batch->msg->response_headers, "application/json", NULL);
+
+	soup_message_set_status(batch->msg, SOUP_STATUS_OK);
+	http_server_unpause_message(batch->msg);
+}
+
+static void __batch_part_free(struct batch_part *part)
+{
+	g_object_unref(part->msg);
+	g_free(part);
+}
+
+static void __batch_finish(struct batch_data *batch)
+{
+	guint i = 0;
+
+	if (batch->timeout_source) {
+		g_source_remove(batch->timeout_source);
+		batch->timeout_source = 0;
+	}
+
+	if (!batch->msg_finished)
+		__batch_respond(batch);
+
+	g_signal_handlers_disconnect_by_data(batch->msg, batch);
+	g_object_unref(batch->msg);
+
+	/* parts still running are released when their handler is done */
+	for (i = 0; i < batch->n_parts; i++) {
+		struct batch_part *part = batch->parts[i];
+		if (part->done) {
+			__batch_part_free(part);
+		} else {
+			part->batch = NULL;
+			http_server_message_cancel(part->msg);
+		}
+	}
+
+	g_free(batch->parts);
+	g_free(batch);
+}
+
+static void __batch_part_done_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct batch_part *part = user_data;
+	struct batch_data *batch = part->batch;
+
+	if (!batch) {
+		_D("late part [%s] is dropped", part->name);
+		__batch_part_free(part);
+		return;
+	}
+
+	part->done = TRUE;
+	batch->n_pending--;
+	if (batch->n_pending == 0)
+		__batch_finish(batch);
+}
+
+static gboolean __batch_timeout_cb(gpointer user_data)
+{
+	struct batch_data *batch = user_data;
+
+	_W("batch timed out, [%u] parts are pending", batch->n_pending);
+	batch->timeout_source = 0;
+	__batch_finish(batch);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void __batch_msg_finished_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct batch_data *batch = user_data;
+
+	/* the client is gone before the parts are done, they are cancelled */
+	batch->msg_finished = TRUE;
+	__batch_finish(batch);
+}
+
+static guint __get_timeout(GHashTable *query)
+{
+	const char *timeout_str = NULL;
+	guint64 timeout = 0;
+
+	if (query)
+		timeout_str = g_hash_table_lookup(query, "timeout");
+
+	if (timeout_str)
+		timeout = g_ascii_strtoull(timeout_str, NULL, 10);
+
+	if (!timeout)
+		return BATCH_TIMEOUT_MS_DEFAULT;
+
+	return MIN(timeout, BATCH_TIMEOUT_MS_MAX);
+}
+
+static void route_api_batch_callback(SoupMessage *msg,
+					const char *path, GHashTable *query,
+					SoupClientContext *client, gpointer user_data)
+{
+	struct batch_data *batch = NULL;
+	const char *include = NULL;
+	char **names = NULL;
+	int *resources = NULL;
+	guint n_parts = 0;
+	guint i = 0;
+
+	if (msg->method != SOUP_METHOD_GET) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	if (query)
+		include = g_hash_table_lookup(query, "include");
+
+	if (!include || !*include) {
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	names = g_strsplit(include, ",", -1);
+	n_parts = g_strv_length(names);
+	resources = g_new0(int, n_parts);
+
+	for (i = 0; i < n_parts; i++) {
+		resources[i] = __resource_index(g_strstrip(names[i]));
+		if (resources[i] < 0) {
+			_E("unknown batch resource [%s]", names[i]);
+			g_strfreev(names);
+			g_free(resources);
+			soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+			return;
+		}
+	}
+	g_strfreev(names);
+
+	batch = g_new0(struct batch_data, 1);
+	batch->msg = g_object_ref(msg);
+	batch->parts = g_new0(struct batch_part *, n_parts);
+	batch->n_parts = n_parts;
+	batch->n_pending = n_parts;
+
+	for (i = 0; i < n_parts; i++) {
+		struct batch_part *part = g_new0(struct batch_part, 1);
+		char *uri = g_strconcat(BATCH_INTERNAL_URI,
+					batch_resources[resources[i]].path, NULL);
+
+		part->batch = batch;
+		part->name = batch_resources[resources[i]].name;
+		part->msg = soup_message_new(SOUP_METHOD_GET, uri);
+		g_free(uri);
+		batch->parts[i] = part;
+	}
+	g_free(resources);
+
+	g_signal_connect(msg, "finished", G_CALLBACK(__batch_msg_finished_cb), batch);
+	http_server_pause_message(msg);
+
+	batch->timeout_source = g_timeout_add(__get_timeout(query),
+						__batch_timeout_cb, batch);
+
+	/* async handlers keep running while the next part is dispatched */
+	for (i = 0; i < n_parts; i++) {
+		struct batch_part *part = batch->parts[i];
+		const char *part_path = soup_message_get_uri(part->msg)->path;
+
+		if (http_server_route_dispatch(part->msg, part_path, NULL, client,
+						__batch_part_done_cb, part)) {
+			soup_message_set_status(part->msg, SOUP_STATUS_NOT_FOUND);
+			part->done = TRUE;
+			batch->n_pending--;
+		}
+	}
+
+	if (batch->n_pending == 0)
+		__batch_finish(batch);
+}
+
+int hs_route_api_batch_init(void)
+{
+	return http_server_route_handler_add(API_BATCH,
+				route_api_batch_callback, NULL, NULL);
+}
@@ -26,18 +26,52 @@
 
 struct wifi_data {
 	SoupMessage *msg;
+	GCancellable *cancellable;
 	wifi_manager_h wifi;
 	bool activated;
+	gint64 span_begin;
 };
 
-static void wifi_deactivated_cb(wifi_manager_error_e result, void *user_data)
+static void wifi_data_finish(struct wifi_data *data)
 {
-	struct wifi_data *data = user_data;
 	wifi_manager_deinitialize(data->wifi);
-	http_server_unpause_message(data->msg);
+
+	/* the message of a gone client is only released */
+	if (!g_cancellable_is_cancelled(data->cancellable))
+		http_server_unpause_message(data->msg);
+
+	g_object_unref(data->cancellable);
+	g_object_unref(data->msg);
 	g_free(data);
 }
 
+static void wifi_data_fail(struct wifi_data *data)
+{
+	if (!g_cancellable_is_cancelled(data->cancellable))
+		soup_message_set_status(data->msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+}
+
+static void wifi_deactivated_cb(wifi_manager_error_e result, void *user_data)
+{
+	struct wifi_data *data = user_data;
+	wifi_data_finish(data);
+}
+
+/* wifi is turned off again if it was only activated for the scan */
+static void wifi_data_restore(struct wifi_data *data)
+{
+	int ret = 0;
+
+	if (!data->activated) {
+		ret = wifi_manager_deactivate(data->wifi, wifi_deactivated_cb, data);
+		if (!ret)
+			return;
+		_E("failed to wifi_manager_deactivate() - %d", ret);
+	}
+
+	wifi_data_finish(data);
+}
+
 static bool wifi_found_ap_cb(wifi_manager_ap_h ap, void *user_data)
 {
 	JsonBuilder *builder = user_data;
@@ -67,6 +101,7 @@ static void wifi_info_response_append(wifi_manager_h wifi, SoupMessage *msg)
 	char *response_msg = NULL;
 	gsize resp_msg_size = 0;
 	JsonBuilder *builder = NULL;
+	gint64 begin = 0;
 
 	builder = json_builder_new();
 
@@ -74,7 +109,10 @@ static void wifi_info_response_append(wifi_manager_h wifi, SoupMessage *msg)
 	json_builder_set_member_name(builder, "apList");
 
 	json_builder_begin_array(builder);
+	begin = http_server_message_span_begin(msg, "wifi_manager_foreach_found_ap");
 	wifi_manager_foreach_found_ap(wifi, wifi_found_ap_cb, builder);
+	http_server_message_span_end(msg, HTTP_SERVER_SPAN_PLATFORM,
+				"wifi_manager_foreach_found_ap", begin);
 	json_builder_end_array(builder);
 
 	json_builder_end_object(builder);
@@ -97,44 +135,49 @@ static void wifi_scan_finished_cb(wifi_manager_error_e result, void *user_data)
 	struct wifi_data *data = user_data;
 
 	_D("wifi scan finished");
+	http_server_message_span_end(data->msg, HTTP_SERVER_SPAN_PLATFORM,
+				"wifi_manager_scan", data->span_begin);
 
-	if (result != WIFI_MANAGER_ERROR_NONE) {
+	if (g_cancellable_is_cancelled(data->cancellable)) {
+		_D("wifi scan result is not wanted anymore");
+	} else if (result != WIFI_MANAGER_ERROR_NONE) {
 		_E("wifi_scan_finished_cb() with error(%x)", result);
-		soup_message_set_status(data->msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
-		goto OUT;
+		wifi_data_fail(data);
+	} else {
+		wifi_info_response_append(data->wifi, data->msg);
 	}
 
-	wifi_info_response_append(data->wifi, data->msg);
-
-	if (!data->activated) {
-		int ret = wifi_manager_deactivate(data->wifi, wifi_deactivated_cb, data);
-		if (ret) {
-			_E("failed to wifi_manager_deactivate() - %d", ret);
-			http_server_unpause_message(data->msg);
-		}
-		return;
-	}
-
-OUT:
-	wifi_manager_deinitialize(data->wifi);
-	http_server_unpause_message(data->msg);
-	g_free(data);
+	wifi_data_restore(data);
 }
 
 static void wifi_activated_cb(wifi_manager_error_e result, void *user_data)
 {
 	struct wifi_data *data = user_data;
+	int ret = 0;
+
+	http_server_message_span_end(data->msg, HTTP_SERVER_SPAN_PLATFORM,
+				"wifi_manager_activate", data->span_begin);
 
 	if (result != WIFI_MANAGER_ERROR_NONE) {
 		_E("wifi_activated_cb() with error(%x)", result);
-		soup_message_set_status(data->msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
-		wifi_manager_deinitialize(data->wifi);
-		http_server_unpause_message(data->msg);
-		g_free(data);
+		wifi_data_fail(data);
+		wifi_data_finish(data);
+		return;
+	}
+
+	/* the client went away while wifi was turned on, no scan is needed */
+	if (g_cancellable_is_cancelled(data->cancellable)) {
+		wifi_data_restore(data);
 		return;
 	}
 
-	wifi_manager_scan(data->wifi, wifi_scan_finished_cb, user_data);
+	data->span_begin = http_server_message_span_begin(data->msg, "wifi_manager_scan");
+	ret = wifi_manager_scan(data->wifi, wifi_scan_finished_cb, data);
+	if (ret) {
+		_E("failed to wifi_manager_scan() - %x", ret);
+		wifi_data_fail(data);
+		wifi_data_restore(data);
+	}
 }
 
 void handle_connection_wifi(SoupMessage *msg, GHashTable *query)
@@ -142,6 +185,7 @@ void handle_connection_wifi(SoupMessage *msg, GHashTable *query)
 	wifi_manager_h wifi = NULL;
 	bool activated = false;
 	struct wifi_data *data = NULL;
+	gint64 begin = 0;
 	int ret = 0;
 
 	if (msg->method != SOUP_METHOD_GET) {
@@ -156,7 +200,10 @@ void handle_connection_wifi(SoupMessage *msg, GHashTable *query)
 		return;
 	}
 
+	begin = http_server_message_span_begin(msg, "wifi_manager_initialize");
 	ret = wifi_manager_initialize(&wifi);
+	http_server_message_span_end(msg, HTTP_SERVER_SPAN_PLATFORM,
+				"wifi_manager_initialize", begin);
 	if (ret) {
 		_E("failed to wifi_manager_initialize");
 		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
@@ -170,9 +217,12 @@ void handle_connection_wifi(SoupMessage *msg, GHashTable *query)
 		goto ERROR;
 	}
 
-	data->msg = msg;
+	data->msg = g_object_ref(msg);
+	data->cancellable = g_object_ref(http_server_message_get_cancellable(msg));
 	data->wifi = wifi;
 	data->activated = activated;
+	data->span_begin = http_server_message_span_begin(msg,
+				activated ? "wifi_manager_scan" : "wifi_manager_activate");
 
 	if (activated)
 		ret = wifi_manager_scan(wifi, wifi_scan_finished_cb, data);
@@ -191,5 +241,9 @@ void handle_connection_wifi(SoupMessage *msg, GHashTable *query)
 ERROR:
 	soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
 	wifi_manager_deinitialize(wifi);
+	if (data->msg) {
+		g_object_unref(data->cancellable);
+		g_object_unref(data->msg);
+	}
 	g_free(data);
 }
@@ -31,6 +31,11 @@
 
 //declare sub modules
 #define API_SUB_WIFI "wifiScan"
+/* a scan takes seconds, concurrent ones only wait for each other */
+#define API_SUB_WIFI_MAX_IN_FLIGHT 1
+#define API_SUB_WIFI_MAX_QUEUED 4
+/* a scan keeps the radio busy, one every few seconds per client */
+#define API_SUB_WIFI_RATE_COST 15
 extern void handle_connection_wifi(SoupMessage *msg, GHashTable *query);
 
 
@@ -151,12 +156,14 @@ static void handle_connection_info(SoupMessage *msg)
 	connection_h connection = NULL;
 	SoupBuffer *buffer;
 	char *response_msg = NULL;
+	gint64 begin = 0;
 
 	if (msg->method != SOUP_METHOD_GET) {
 		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
 		return;
 	}
 
+	begin = http_server_message_span_begin(msg, "connection");
 	connection_create(&connection);
 
 	response_msg = g_strdup_printf(
@@ -171,6 +178,7 @@ static void handle_connection_info(SoupMessage *msg)
 
 	connection_destroy(connection);
 	connection = NULL;
+	http_server_message_span_end(msg, HTTP_SERVER_SPAN_PLATFORM, "connection", begin);
 
 	buffer = soup_buffer_new_with_owner(response_msg, strlen(response_msg),
 					response_msg, (GDestroyNotify)g_free);
@@ -201,6 +209,18 @@ int hs_route_api_connection_init(void)
 
 	ret = http_server_route_handler_add(API_CONNECTION,
 				route_api_connection_callback, NULL, NULL);
+	retv_if(ret, -1);
+
+	ret = http_server_route_cost_set(API_CONNECTION "/" API_SUB_WIFI,
+				HTTP_SERVER_ROUTE_COST_HIGH);
+	retv_if(ret, -1);
+
+	ret = http_server_route_rate_cost_set(API_CONNECTION "/" API_SUB_WIFI,
+				API_SUB_WIFI_RATE_COST);
+	retv_if(ret, -1);
+
+	ret = http_server_route_limit_set(API_CONNECTION "/" API_SUB_WIFI,
+				API_SUB_WIFI_MAX_IN_FLIGHT, API_SUB_WIFI_MAX_QUEUED);
 
 	return ret;
 }
@@ -0,0 +1,572 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+#include "http-server-log-private.h"
+#include "http-server-route.h"
+#include "hs-util-arena.h"
+#include "hs-util-heap.h"
+#include "hs-util-json.h"
+#include "hs-util-memory.h"
+#include "hs-util-profile.h"
+#include "hs-util-trace.h"
+
+#define API_DEBUG "/api/debug"
+#define API_SUB_TRACE "trace"
+#define API_SUB_PROFILE "profile"
+#define API_SUB_HEAP "heap"
+#define API_SUB_HEAP_SNAPSHOT "heap/snapshot"
+#define API_SUB_MEMORY "memory"
+
+#define PROFILE_DEFAULT_SECONDS 10
+#define PROFILE_MAX_SECONDS 60
+#define PROFILE_DEFAULT_HZ 99
+
+/* about 2 MiB, a minute at the default rate */
+#define PROFILE_MAX_SAMPLES 8192
+
+#define HEAP_DEFAULT_SAMPLE_BYTES (64 * 1024)
+#define HEAP_MAX_SAMPLE_BYTES (16 * 1024 * 1024)
+#define HEAP_DEFAULT_TOP 50
+#define HEAP_MAX_TOP 1024
+
+struct profile_data {
+	SoupMessage *msg;
+	GCancellable *cancellable;
+	gulong cancelled_id;
+	guint timeout_id;
+};
+
+static struct profile_data *profile_running;
+
+static void __response_set_json(SoupMessage *msg, JsonBuilder *builder)
+{
+	char *response_msg = NULL;
+	gsize resp_msg_size = 0;
+
+	response_msg = util_json_generate_str(builder, &resp_msg_size);
+
+	soup_message_body_append(msg->response_body, SOUP_MEMORY_TAKE,
+					response_msg, resp_msg_size);
+	soup_message_headers_set_content_type(
+					msg->response_headers, "application/json", NULL);
+	soup_message_headers_replace(msg->response_headers, "Cache-Control", "no-store");
+	soup_message_set_status(msg, SOUP_STATUS_OK);
+}
+
+static void __trace_add_event(const struct util_trace_event *event,
+				gpointer user_data)
+{
+	JsonBuilder *builder = user_data;
+
+	/* a lane for each request, the spans of one nest in it */
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "name", event->name);
+	util_json_add_str(builder, "cat", "http");
+	util_json_add_str(builder, "ph", "X");
+	util_json_add_int(builder, "ts", event->ts);
+	util_json_add_int(builder, "dur", event->dur);
+	util_json_add_int(builder, "pid", getpid());
+	util_json_add_int(builder, "tid", event->id);
+
+	json_builder_set_member_name(builder, "args");
+	json_builder_begin_object(builder);
+	util_json_add_int(builder, "thread", event->tid);
+	json_builder_end_object(builder);
+
+	json_builder_end_object(builder);
+}
+
+/*
+ * GET dumps the spans in Chrome trace-event format, for chrome://tracing.
+ * POST ?enabled=true starts recording from scratch, false stops it.
+ */
+static void __handle_trace(SoupMessage *msg, GHashTable *query)
+{
+	JsonBuilder *builder = NULL;
+	const char *enabled = NULL;
+
+	if (msg->method == SOUP_METHOD_POST) {
+		if (query)
+			enabled = g_hash_table_lookup(query, "enabled");
+		if (!enabled) {
+			soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+			return;
+		}
+
+		util_trace_set_enabled(FALSE);
+		if (!g_strcmp0(enabled, "true") && util_trace_set_enabled(TRUE)) {
+			soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+			return;
+		}
+		soup_message_set_status(msg, SOUP_STATUS_NO_CONTENT);
+		return;
+	}
+
+	if (msg->method != SOUP_METHOD_GET) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "displayTimeUnit", "ms");
+	json_builder_set_member_name(builder, "traceEvents");
+	json_builder_begin_array(builder);
+	util_trace_foreach(__trace_add_event, builder);
+	json_builder_end_array(builder);
+	json_builder_end_object(builder);
+
+	__response_set_json(msg, builder);
+	g_object_unref(builder);
+}
+
+static void __profile_add_stack(const char *stack, guint count,
+				gpointer user_data)
+{
+	GString *folded = user_data;
+
+	g_string_append_printf(folded, "%s %u\n", stack, count);
+}
+
+static void __profile_finish(struct profile_data *data)
+{
+	GString *folded = NULL;
+	char *value = NULL;
+	gsize len = 0;
+
+	util_profile_stop();
+	profile_running = NULL;
+
+	if (data->timeout_id)
+		g_source_remove(data->timeout_id);
+	g_signal_handler_disconnect(data->cancellable, data->cancelled_id);
+
+	if (!g_cancellable_is_cancelled(data->cancellable)) {
+		folded = g_string_new(NULL);
+		util_profile_foreach(__profile_add_stack, folded);
+
+		value = util_arena_strdup_printf(http_server_message_get_arena(data->msg),
+					"%u", util_profile_get_dropped());
+		if (value)
+			soup_message_headers_replace(data->msg->response_headers,
+						"X-Profile-Dropped", value);
+
+		len = folded->len;
+		soup_message_body_append(data->msg->response_body, SOUP_MEMORY_TAKE,
+					g_string_free(folded, FALSE), len);
+		soup_message_headers_set_content_type(data->msg->response_headers,
+					"text/plain", NULL);
+		soup_message_headers_replace(data->msg->response_headers,
+					"Cache-Control", "no-store");
+		soup_message_set_status(data->msg, SOUP_STATUS_OK);
+		http_server_unpause_message(data->msg);
+	}
+	util_profile_clear();
+
+	g_object_unref(data->cancellable);
+	g_object_unref(data->msg);
+	g_free(data);
+}
+
+static gboolean __profile_timeout_cb(gpointer user_data)
+{
+	struct profile_data *data = user_data;
+
+	data->timeout_id = 0;
+	__profile_finish(data);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void __profile_cancelled_cb(GCancellable *cancellable, gpointer user_data)
+{
+	_D("profile client went away");
+	__profile_finish(user_data);
+}
+
+static unsigned int __query_uint(GHashTable *query, const char *key,
+				unsigned int def, unsigned int max)
+{
+	const char *str = query ? g_hash_table_lookup(query, key) : NULL;
+	char *end = NULL;
+	unsigned long value = 0;
+
+	if (!str)
+		return def;
+
+	errno = 0;
+	value = strtoul(str, &end, 10);
+	if (errno || end == str || *end || value > max)
+		return 0;
+
+	return (unsigned int)value;
+}
+
+/*
+ * GET ?seconds=N&hz=M samples the cpu stacks of all threads for N
+ * seconds and returns them folded, for flamegraph.pl.
+ */
+static void __handle_profile(SoupMessage *msg, GHashTable *query)
+{
+	struct profile_data *data = NULL;
+	unsigned int seconds = 0;
+	unsigned int hz = 0;
+
+	if (msg->method != SOUP_METHOD_GET) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	seconds = __query_uint(query, "seconds",
+				PROFILE_DEFAULT_SECONDS, PROFILE_MAX_SECONDS);
+	hz = __query_uint(query, "hz", PROFILE_DEFAULT_HZ, UTIL_PROFILE_MAX_HZ);
+	if (!seconds || !hz) {
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	if (profile_running) {
+		soup_message_set_status(msg, SOUP_STATUS_CONFLICT);
+		return;
+	}
+
+	if (util_profile_start(hz, MIN(hz * seconds, PROFILE_MAX_SAMPLES))) {
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		return;
+	}
+
+	data = g_new0(struct profile_data, 1);
+	data->msg = g_object_ref(msg);
+	data->cancellable = g_object_ref(http_server_message_get_cancellable(msg));
+	data->cancelled_id = g_signal_connect(data->cancellable, "cancelled",
+				G_CALLBACK(__profile_cancelled_cb), data);
+	data->timeout_id = g_timeout_add_seconds(seconds, __profile_timeout_cb, data);
+	profile_running = data;
+
+	http_server_pause_message(msg);
+}
+
+struct heap_route {
+	gint64 live_bytes;
+	gint64 total_bytes;
+};
+
+struct heap_report {
+	GPtrArray *sites;
+	GHashTable *routes;
+};
+
+static void __heap_collect(const struct util_heap_site *site, gpointer user_data)
+{
+	struct heap_report *report = user_data;
+	struct util_heap_site *copy = NULL;
+	struct heap_route *route = NULL;
+	const char *key = site->route ? site->route : "";
+
+	if (!site->live_count && !site->total_count)
+		return;
+
+	route = g_hash_table_lookup(report->routes, key);
+	if (!route) {
+		route = g_new0(struct heap_route, 1);
+		g_hash_table_insert(report->routes, g_strdup(key), route);
+	}
+	route->live_bytes += site->live_bytes;
+	route->total_bytes += site->total_bytes;
+
+	copy = g_new(struct util_heap_site, 1);
+	*copy = *site;
+	g_ptr_array_add(report->sites, copy);
+}
+
+static gint __heap_site_compare(gconstpointer a, gconstpointer b)
+{
+	const struct util_heap_site *site_a = *(struct util_heap_site * const *)a;
+	const struct util_heap_site *site_b = *(struct util_heap_site * const *)b;
+	gint64 live_a = ABS(site_a->live_bytes);
+	gint64 live_b = ABS(site_b->live_bytes);
+
+	if (live_a != live_b)
+		return live_a < live_b ? 1 : -1;
+
+	return site_a->total_bytes < site_b->total_bytes ? 1
+			: site_a->total_bytes > site_b->total_bytes ? -1 : 0;
+}
+
+static void __heap_add_site(JsonBuilder *builder, GHashTable *symbols,
+				const struct util_heap_site *site)
+{
+	char *name = NULL;
+	int i = 0;
+
+	json_builder_begin_object(builder);
+	if (site->route)
+		util_json_add_str(builder, "route", site->route);
+	else
+		util_json_add_null(builder, "route");
+	util_json_add_int(builder, "liveBytes", site->live_bytes);
+	util_json_add_int(builder, "liveCount", site->live_count);
+	util_json_add_int(builder, "totalBytes", site->total_bytes);
+	util_json_add_int(builder, "totalCount", site->total_count);
+
+	/* innermost first, return addresses point past the call */
+	json_builder_set_member_name(builder, "stack");
+	json_builder_begin_array(builder);
+	for (i = 0; i < site->depth; i++) {
+		name = g_hash_table_lookup(symbols, site->frames[i]);
+		if (!name) {
+			name = util_profile_symbol_name((char *)site->frames[i] - 1);
+			g_hash_table_insert(symbols, site->frames[i], name);
+		}
+		json_builder_add_string_value(builder, name);
+	}
+	json_builder_end_array(builder);
+
+	json_builder_end_object(builder);
+}
+
+/*
+ * GET ?snapshot=ID&base=ID&top=N lists the call sites holding the most
+ * memory, now or at snapshot, and what they grew since base.
+ */
+static void __heap_report(SoupMessage *msg, GHashTable *query)
+{
+	struct heap_report report;
+	struct heap_route *route = NULL;
+	JsonBuilder *builder = NULL;
+	GHashTable *symbols = NULL;
+	GHashTableIter iter;
+	gpointer key = NULL;
+	unsigned int snapshot = 0;
+	unsigned int base = 0;
+	unsigned int top = 0;
+	guint i = 0;
+
+	snapshot = __query_uint(query, "snapshot", 0, G_MAXUINT);
+	base = __query_uint(query, "base", 0, G_MAXUINT);
+	top = __query_uint(query, "top", HEAP_DEFAULT_TOP, HEAP_MAX_TOP);
+	if (!top) {
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	report.sites = g_ptr_array_new_with_free_func(g_free);
+	report.routes = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+	if (util_heap_foreach(snapshot, base, __heap_collect, &report)) {
+		g_ptr_array_free(report.sites, TRUE);
+		g_hash_table_destroy(report.routes);
+		soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+		return;
+	}
+	g_ptr_array_sort(report.sites, __heap_site_compare);
+
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+	util_json_add_bool(builder, "enabled", util_heap_is_enabled());
+	util_json_add_int(builder, "sampleBytes", util_heap_get_sample_bytes());
+	util_json_add_int(builder, "dropped", util_heap_get_dropped());
+	util_json_add_int(builder, "snapshot", snapshot);
+	util_json_add_int(builder, "base", base);
+
+	json_builder_set_member_name(builder, "routes");
+	json_builder_begin_array(builder);
+	g_hash_table_iter_init(&iter, report.routes);
+	while (g_hash_table_iter_next(&iter, &key, (gpointer *)&route)) {
+		json_builder_begin_object(builder);
+		if (*(const char *)key)
+			util_json_add_str(builder, "route", key);
+		else
+			util_json_add_null(builder, "route");
+		util_json_add_int(builder, "liveBytes", route->live_bytes);
+		util_json_add_int(builder, "totalBytes", route->total_bytes);
+		json_builder_end_object(builder);
+	}
+	json_builder_end_array(builder);
+
+	symbols = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	json_builder_set_member_name(builder, "sites");
+	json_builder_begin_array(builder);
+	for (i = 0; i < report.sites->len && i < top; i++)
+		__heap_add_site(builder, symbols, g_ptr_array_index(report.sites, i));
+	json_builder_end_array(builder);
+	g_hash_table_destroy(symbols);
+
+	json_builder_end_object(builder);
+
+	__response_set_json(msg, builder);
+	g_object_unref(builder);
+
+	g_ptr_array_free(report.sites, TRUE);
+	g_hash_table_destroy(report.routes);
+}
+
+/*
+ * POST ?enabled=true&sampleBytes=N starts sampling from scratch, false
+ * stops it and keeps what was sampled.
+ */
+static void __handle_heap(SoupMessage *msg, GHashTable *query)
+{
+	const char *enabled = NULL;
+	unsigned int sample_bytes = 0;
+
+	if (msg->method == SOUP_METHOD_GET) {
+		__heap_report(msg, query);
+		return;
+	}
+
+	if (msg->method != SOUP_METHOD_POST) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	if (query)
+		enabled = g_hash_table_lookup(query, "enabled");
+	sample_bytes = __query_uint(query, "sampleBytes",
+				HEAP_DEFAULT_SAMPLE_BYTES, HEAP_MAX_SAMPLE_BYTES);
+	if (!enabled || !sample_bytes) {
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	if (util_heap_set_enabled(!g_strcmp0(enabled, "true"), sample_bytes)) {
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	soup_message_set_status(msg, SOUP_STATUS_NO_CONTENT);
+}
+
+/* POST keeps the counters of now, for GET heap?base= */
+static void __handle_heap_snapshot(SoupMessage *msg)
+{
+	JsonBuilder *builder = NULL;
+	guint id = 0;
+
+	if (msg->method != SOUP_METHOD_POST) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	id = util_heap_snapshot();
+	if (!id) {
+		soup_message_set_status(msg, SOUP_STATUS_CONFLICT);
+		return;
+	}
+
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+	util_json_add_int(builder, "id", id);
+	json_builder_end_object(builder);
+
+	__response_set_json(msg, builder);
+	g_object_unref(builder);
+}
+
+static void __memory_add_account(const char *name, gsize used, gsize peak,
+				guint64 refused, gpointer user_data)
+{
+	JsonBuilder *builder = user_data;
+
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "name", name);
+	util_json_add_int(builder, "used", used);
+	util_json_add_int(builder, "peak", peak);
+	util_json_add_int(builder, "refused", refused);
+	json_builder_end_object(builder);
+}
+
+/* where the memory budget is spent, next to what the process really holds */
+static void __handle_memory(SoupMessage *msg)
+{
+	JsonBuilder *builder = NULL;
+	gsize in_use = 0;
+	gsize free_bytes = 0;
+
+	if (msg->method != SOUP_METHOD_GET) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	util_memory_get_heap(&in_use, &free_bytes);
+
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "profile",
+			util_memory_profile_to_str(util_memory_get_profile()));
+	util_json_add_int(builder, "budget", util_memory_get_budget());
+	util_json_add_int(builder, "used", util_memory_get_used());
+
+	json_builder_set_member_name(builder, "accounts");
+	json_builder_begin_array(builder);
+	util_memory_foreach_account(__memory_add_account, builder);
+	json_builder_end_array(builder);
+
+	json_builder_set_member_name(builder, "process");
+	json_builder_begin_object(builder);
+	util_json_add_int(builder, "rss", util_memory_get_rss());
+	util_json_add_int(builder, "heapInUse", in_use);
+	util_json_add_int(builder, "heapFree", free_bytes);
+	json_builder_end_object(builder);
+
+	json_builder_end_object(builder);
+
+	__response_set_json(msg, builder);
+	g_object_unref(builder);
+}
+
+static void route_api_debug_callback(SoupMessage *msg,
+					const char *path, GHashTable *query,
+					SoupClientContext *client, gpointer user_data)
+{
+	const char *sub_path = NULL;
+
+	if (!g_str_has_prefix(path, API_DEBUG "/")) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+		return;
+	}
+	sub_path = path + strlen(API_DEBUG "/");
+
+	if (!strcmp(sub_path, API_SUB_TRACE))
+		__handle_trace(msg, query);
+	else if (!strcmp(sub_path, API_SUB_PROFILE))
+		__handle_profile(msg, query);
+	else if (!strcmp(sub_path, API_SUB_HEAP))
+		__handle_heap(msg, query);
+	else if (!strcmp(sub_path, API_SUB_HEAP_SNAPSHOT))
+		__handle_heap_snapshot(msg);
+	else if (!strcmp(sub_path, API_SUB_MEMORY))
+		__handle_memory(msg);
+	else
+		soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+}
+
+int hs_route_api_debug_init(void)
+{
+	int ret = 0;
+
+	/* profilers and tracing are for administrators only */
+	ret = http_server_auth_admin_realm_path_add(API_DEBUG, FALSE);
+	retv_if(ret, ret);
+
+	return http_server_route_handler_add(API_DEBUG,
+				route_api_debug_callback, NULL, NULL);
+}
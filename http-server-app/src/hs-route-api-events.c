@@ -0,0 +1,248 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+#include "http-server-log-private.h"
+#include "http-server-route.h"
+#include "hs-util-event.h"
+#include "hs-util-memory.h"
+
+#define API_EVENTS "/api/events"
+
+#define SSE_RETRY_MS 3000
+#define SSE_KEEPALIVE_SEC 15
+/* a subscriber which can't keep up is closed and resumes by Last-Event-ID */
+#define SSE_MAX_QUEUED_CHUNKS 64
+
+struct sse_data;
+
+struct sse_subscriber {
+	struct sse_data *sse;
+	SoupMessage *msg;
+	/* lengths of the chunks not written yet, charged to the budget */
+	GQueue queued;
+	gboolean closing;
+};
+
+struct sse_data {
+	GQueue subscribers;
+	guint listener_id;
+	guint keepalive_source;
+};
+
+static void __sse_write(struct sse_subscriber *sub, char *chunk)
+{
+	gsize len = 0;
+
+	if (sub->closing) {
+		g_free(chunk);
+		return;
+	}
+
+	len = strlen(chunk);
+	soup_message_body_append(sub->msg->response_body,
+				SOUP_MEMORY_TAKE, chunk, len);
+	util_memory_charge_force(UTIL_MEMORY_STREAMS, len);
+	g_queue_push_tail(&sub->queued, GSIZE_TO_POINTER(len));
+
+	/* with memory short, anyone behind is slow */
+	if (sub->queued.length > SSE_MAX_QUEUED_CHUNKS
+		|| (sub->queued.length > 1 && util_memory_is_over_budget())) {
+		_W("slow subscriber, closing stream");
+		sub->closing = TRUE;
+		soup_message_body_complete(sub->msg->response_body);
+	}
+
+	http_server_unpause_message(sub->msg);
+}
+
+static void __sse_write_event(const struct util_event *event, gpointer user_data)
+{
+	struct sse_subscriber *sub = user_data;
+
+	__sse_write(sub, g_strdup_printf("id: %" G_GUINT64_FORMAT "\n"
+					"event: %s\n"
+					"data: %s\n\n",
+					event->id, event->type, event->data));
+}
+
+static void __sse_event_cb(const struct util_event *event, gpointer user_data)
+{
+	struct sse_data *sse = user_data;
+
+	g_queue_foreach(&sse->subscribers, (GFunc)__sse_write_event, (gpointer)event);
+}
+
+static void __sse_write_keepalive(gpointer data, gpointer user_data)
+{
+	__sse_write(data, g_strdup(": keepalive\n\n"));
+}
+
+static gboolean __sse_keepalive_cb(gpointer user_data)
+{
+	struct sse_data *sse = user_data;
+
+	/* writing also detects peers which went away while idle */
+	g_queue_foreach(&sse->subscribers, __sse_write_keepalive, NULL);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void __sse_subscriber_free(struct sse_subscriber *sub)
+{
+	while (!g_queue_is_empty(&sub->queued))
+		util_memory_uncharge(UTIL_MEMORY_STREAMS,
+				GPOINTER_TO_SIZE(g_queue_pop_head(&sub->queued)));
+
+	g_signal_handlers_disconnect_by_data(sub->msg, sub);
+	g_object_unref(sub->msg);
+	g_free(sub);
+}
+
+static void __sse_wrote_chunk_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct sse_subscriber *sub = user_data;
+
+	if (!g_queue_is_empty(&sub->queued))
+		util_memory_uncharge(UTIL_MEMORY_STREAMS,
+				GPOINTER_TO_SIZE(g_queue_pop_head(&sub->queued)));
+}
+
+static void __sse_finished_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct sse_subscriber *sub = user_data;
+	struct sse_data *sse = sub->sse;
+
+	g_queue_remove(&sse->subscribers, sub);
+	__sse_subscriber_free(sub);
+
+	_D("subscriber is gone, remains [%u]", g_queue_get_length(&sse->subscribers));
+
+	if (g_queue_is_empty(&sse->subscribers) && sse->keepalive_source) {
+		g_source_remove(sse->keepalive_source);
+		sse->keepalive_source = 0;
+	}
+}
+
+static const char *__get_last_event_id(SoupMessage *msg, GHashTable *query)
+{
+	const char *last_event_id = NULL;
+
+	last_event_id = soup_message_headers_get_one(msg->request_headers,
+							"Last-Event-ID");
+	if (!last_event_id && query)
+		last_event_id = g_hash_table_lookup(query, "lastEventId");
+
+	return last_event_id;
+}
+
+static void route_api_events_callback(SoupMessage *msg,
+					const char *path, GHashTable *query,
+					SoupClientContext *client, gpointer user_data)
+{
+	struct sse_data *sse = user_data;
+	struct sse_subscriber *sub = NULL;
+	const char *last_event_id = NULL;
+
+	if (msg->method != SOUP_METHOD_GET) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	sub = g_try_new0(struct sse_subscriber, 1);
+	if (!sub) {
+		_E("failed to alloc sse_subscriber");
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	sub->sse = sse;
+	sub->msg = g_object_ref(msg);
+
+	soup_message_set_status(msg, SOUP_STATUS_OK);
+	soup_message_headers_set_content_type(msg->response_headers,
+						"text/event-stream", NULL);
+	soup_message_headers_replace(msg->response_headers,
+						"Cache-Control", "no-cache");
+	soup_message_headers_set_encoding(msg->response_headers,
+						SOUP_ENCODING_CHUNKED);
+	soup_message_body_set_accumulate(msg->response_body, FALSE);
+
+	g_signal_connect(msg, "wrote-chunk", G_CALLBACK(__sse_wrote_chunk_cb), sub);
+	g_signal_connect(msg, "finished", G_CALLBACK(__sse_finished_cb), sub);
+
+	__sse_write(sub, g_strdup_printf("retry: %d\n\n", SSE_RETRY_MS));
+
+	last_event_id = __get_last_event_id(msg, query);
+	if (last_event_id) {
+		guint64 last_id = g_ascii_strtoull(last_event_id, NULL, 10);
+		if (!util_event_foreach_since(last_id, __sse_write_event, sub)) {
+			/* missed events are gone, client has to fetch full states */
+			__sse_write(sub, g_strdup_printf("id: %" G_GUINT64_FORMAT "\n"
+						"event: resync\ndata: {}\n\n",
+						util_event_get_last_id()));
+		}
+	} else {
+		__sse_write(sub, g_strdup_printf("id: %" G_GUINT64_FORMAT "\n\n",
+						util_event_get_last_id()));
+	}
+
+	g_queue_push_tail(&sse->subscribers, sub);
+
+	if (!sse->keepalive_source)
+		sse->keepalive_source = g_timeout_add_seconds(SSE_KEEPALIVE_SEC,
+							__sse_keepalive_cb, sse);
+}
+
+static void __sse_data_free(gpointer data)
+{
+	struct sse_data *sse = data;
+	struct sse_subscriber *sub = NULL;
+
+	if (sse->listener_id)
+		util_event_listener_remove(sse->listener_id);
+
+	if (sse->keepalive_source)
+		g_source_remove(sse->keepalive_source);
+
+	while ((sub = g_queue_pop_head(&sse->subscribers)))
+		__sse_subscriber_free(sub);
+
+	g_free(sse);
+}
+
+int hs_route_api_events_init(void)
+{
+	struct sse_data *sse = NULL;
+	int ret = 0;
+
+	sse = g_try_new0(struct sse_data, 1);
+	retvm_if(!sse, -1, "failed to alloc sse_data");
+
+	g_queue_init(&sse->subscribers);
+
+	sse->listener_id = util_event_listener_add(__sse_event_cb, sse);
+	if (!sse->listener_id)
+		_W("event hub is not running, no events will be sent");
+
+	ret = http_server_route_handler_add(API_EVENTS,
+				route_api_events_callback, sse, __sse_data_free);
+	if (ret)
+		__sse_data_free(sse);
+
+	return ret;
+}
@@ -15,70 +15,402 @@
  */
 
 #include <glib.h>
+#include <errno.h>
 #include <libsoup/soup.h>
 #include <json-glib/json-glib.h>
 #include "http-server-log-private.h"
 #include "http-server-route.h"
+#include "hs-util-json.h"
+#include "hs-util-multipart.h"
+#include "hs-util-image-store.h"
+#include "hs-util-thumbnail.h"
+#include "hs-util-upload-quota.h"
 
-static void
-image_file_save(SoupMessage *msg,
-	const char *filename, const char *type, SoupBuffer *buffer)
+#define API_IMAGE_UPLOAD "/api/imageUpload"
+#define UPLOAD_FIELD_NAME "imageFile"
+#define UPLOAD_DATA_KEY "hs-image-upload"
+
+#define UPLOAD_MAX_SIZE (32 * 1024 * 1024)
+
+struct upload_data {
+	SoupMessage *msg;
+	struct util_multipart_parser *parser;
+	char *host;
+	int storage_id;
+	char *dir;
+	struct util_image_store_file *file;
+	goffset received;
+	gboolean in_file;
+	gboolean file_found;
+	char *filename;
+	char *type;
+	gsize size;
+	guint error_status;
+	gboolean draining;
+	gboolean msg_finished;
+};
+
+static guint __errno_to_status(int err)
+{
+	if (err == ENOSPC || err == EDQUOT)
+		return SOUP_STATUS_INSUFFICIENT_STORAGE;
+
+	return SOUP_STATUS_INTERNAL_SERVER_ERROR;
+}
+
+static gboolean __part_begin_cb(SoupMessageHeaders *headers, gpointer user_data)
+{
+	struct upload_data *upload = user_data;
+	GHashTable *params = NULL;
+	char *disposition = NULL;
+	const char *name = NULL;
+
+	upload->in_file = FALSE;
+
+	if (!soup_message_headers_get_content_disposition(headers,
+							&disposition, &params))
+		return TRUE;
+
+	name = g_hash_table_lookup(params, "name");
+	if (!upload->file_found && !g_strcmp0(name, UPLOAD_FIELD_NAME)) {
+		upload->file_found = TRUE;
+		upload->in_file = TRUE;
+		upload->filename = g_strdup(g_hash_table_lookup(params, "filename"));
+		upload->type = g_strdup(soup_message_headers_get_content_type(headers, NULL));
+
+		upload->file = util_image_store_file_new(upload->dir);
+		if (!upload->file)
+			upload->error_status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+	}
+
+	g_free(disposition);
+	g_hash_table_destroy(params);
+
+	return upload->error_status == 0;
+}
+
+static gboolean __part_data_cb(const char *data, gsize len, gpointer user_data)
+{
+	struct upload_data *upload = user_data;
+	int err = 0;
+
+	if (!upload->in_file)
+		return TRUE;
+
+	err = util_image_store_file_write(upload->file, data, len);
+	if (err) {
+		upload->error_status = __errno_to_status(err);
+		return FALSE;
+	}
+	upload->size += len;
+
+	return TRUE;
+}
+
+static gboolean __part_end_cb(gpointer user_data)
 {
+	struct upload_data *upload = user_data;
+
+	upload->in_file = FALSE;
+
+	return TRUE;
+}
+
+static const struct util_multipart_callbacks upload_callbacks = {
+	.part_begin = __part_begin_cb,
+	.part_data = __part_data_cb,
+	.part_end = __part_end_cb,
+};
+
+static void __upload_data_free(gpointer data)
+{
+	struct upload_data *upload = data;
+
+	/* not committed, the request failed or was aborted */
+	if (upload->file)
+		util_image_store_file_abort(upload->file);
+
+	util_multipart_parser_free(upload->parser);
+	g_free(upload->host);
+	g_free(upload->dir);
+	g_free(upload->filename);
+	g_free(upload->type);
+	g_free(upload);
+}
+
+static void __upload_drained_cb(gpointer user_data)
+{
+	struct upload_data *upload = user_data;
+
+	upload->draining = FALSE;
+	if (!upload->msg_finished)
+		http_server_unpause_message(upload->msg);
+}
+
+static void __got_chunk_cb(SoupMessage *msg, SoupBuffer *chunk, gpointer user_data)
+{
+	struct upload_data *upload = user_data;
+
+	if (upload->error_status)
+		return;
+
+	/* chunked bodies have no Content-Length to check up front */
+	upload->received += chunk->length;
+	if (upload->received > UPLOAD_MAX_SIZE) {
+		_E("upload from [%s] exceeds the size limit", upload->host);
+		upload->error_status = SOUP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+		return;
+	}
+
+	if (!util_multipart_parser_feed(upload->parser, chunk->data, chunk->length)
+		&& !upload->error_status)
+		upload->error_status = SOUP_STATUS_BAD_REQUEST;
+
+	/* reading is paused while the I/O thread is behind */
+	if (upload->file && !upload->draining
+		&& util_image_store_file_wait_drained(upload->file,
+						__upload_drained_cb, upload)) {
+		upload->draining = TRUE;
+		http_server_pause_message(msg);
+	}
+}
+
+static void __msg_finished_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct upload_data *upload = user_data;
+
+	upload->msg_finished = TRUE;
+}
+
+static void __upload_respond(struct upload_data *upload,
+				const char *id, gboolean duplicate)
+{
+	JsonBuilder *builder = NULL;
 	char *response_msg = NULL;
+	gsize resp_msg_size = 0;
+
+	_D("filename : %s, type : %s, file size : %" G_GSIZE_FORMAT ", id : %s",
+		upload->filename, upload->type, upload->size, id);
 
-	//TODO : save file(This is mock function, I'm not sure we really need save file?)
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "id", id);
+	util_json_add_str(builder, "filename", upload->filename);
+	util_json_add_str(builder, "type", upload->type);
+	util_json_add_int(builder, "size", upload->size);
+	util_json_add_int(builder, "storageId", upload->storage_id);
+	util_json_add_bool(builder, "duplicate", duplicate);
+	json_builder_end_object(builder);
 
-	response_msg = g_strdup_printf(""
-		"{ \"filename\": \"%s\", \"type\": \"%s\", \"size\": %d }",
-		filename, type, buffer->length);
+	response_msg = util_json_generate_str(builder, &resp_msg_size);
+	g_clear_pointer(&builder, g_object_unref);
 
-	soup_message_body_append(msg->response_body, SOUP_MEMORY_COPY,
-					response_msg, strlen(response_msg));
-	g_clear_pointer(&response_msg, g_free);
+	soup_message_body_append(upload->msg->response_body, SOUP_MEMORY_TAKE,
+					response_msg, resp_msg_size);
 
 	soup_message_headers_set_content_type(
-						msg->response_headers, "application/json", NULL);
+						upload->msg->response_headers, "application/json", NULL);
 
-	soup_message_set_status(msg, SOUP_STATUS_OK);
-	http_server_unpause_message(msg);
+	soup_message_set_status(upload->msg, SOUP_STATUS_OK);
+}
+
+static void __upload_commit_done_cb(const char *id, const char *path,
+					gboolean duplicate, int error, gpointer user_data)
+{
+	struct upload_data *upload = user_data;
+	SoupMessage *msg = upload->msg;
+
+	/* only what ends up stored counts, failures and duplicates are retried */
+	if (!error && !duplicate)
+		util_upload_quota_charge(upload->host, upload->size);
+
+	/* listing pages should not have to pull the originals */
+	if (!error && !duplicate)
+		util_thumbnail_generate(path, id, 0, NULL, NULL);
+
+	if (!upload->msg_finished) {
+		if (error) {
+			_E("failed to store upload - %s", g_strerror(error));
+			soup_message_set_status(msg, __errno_to_status(error));
+		} else {
+			__upload_respond(upload, id, duplicate);
+		}
+		http_server_unpause_message(msg);
+	}
+
+	/* taken at commit, the upload data may go away with it */
+	g_object_unref(msg);
+}
+
+static guint __upload_check_headers(SoupMessage *msg, const char *host)
+{
+	goffset length = 0;
+
+	if (soup_message_headers_get_encoding(msg->request_headers)
+		== SOUP_ENCODING_CONTENT_LENGTH)
+		length = soup_message_headers_get_content_length(msg->request_headers);
+
+	if (length > UPLOAD_MAX_SIZE) {
+		_E("upload from [%s] is too large - %" G_GOFFSET_FORMAT, host, length);
+		return SOUP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+	}
+
+	if (!util_upload_quota_check(host, length))
+		return SOUP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+
+	return SOUP_STATUS_OK;
+}
+
+/* storageId is one of the ids listed by /api/storage */
+static char *__upload_get_dir(SoupMessage *msg, int *storage_id)
+{
+	GHashTable *params = NULL;
+	const char *query = soup_message_get_uri(msg)->query;
+	const char *id_str = NULL;
+	gboolean valid = FALSE;
+
+	if (query) {
+		params = soup_form_decode(query);
+		id_str = g_hash_table_lookup(params, "storageId");
+	}
+
+	valid = util_image_store_parse_storage_id(id_str, storage_id);
+
+	if (params)
+		g_hash_table_destroy(params);
+
+	return valid ? util_image_store_get_dir(*storage_id) : NULL;
+}
+
+static void __upload_reject(SoupMessage *msg, guint status)
+{
+	/* a body sent anyway is dropped as it comes */
+	soup_message_body_set_accumulate(msg->request_body, FALSE);
+	soup_message_headers_replace(msg->response_headers, "Connection", "close");
+	soup_message_set_status(msg, status);
+}
+
+/*
+ * Runs after the auth domain and before the body is read, with the status
+ * at 100 Continue if the client sent "Expect: 100-continue". A status set
+ * here is sent instead, so such a client never transfers the body at all.
+ * Anything but a set up upload is rejected here, or the body would be
+ * buffered in full just to be refused.
+ */
+static void route_api_image_upload_headers_callback(SoupMessage *msg,
+						const char *path, SoupClientContext *client,
+						gpointer user_data)
+{
+	struct upload_data *upload = NULL;
+	const char *host = NULL;
+	char *boundary = NULL;
+	char *dir = NULL;
+	int storage_id = UTIL_IMAGE_STORE_DEFAULT_STORAGE;
+	guint status = SOUP_STATUS_OK;
+
+	if (msg->method != SOUP_METHOD_POST)
+		return;
+
+	host = soup_client_context_get_host(client);
+
+	boundary = util_multipart_get_boundary(msg);
+	if (!boundary)
+		status = SOUP_STATUS_UNSUPPORTED_MEDIA_TYPE;
+	else
+		status = __upload_check_headers(msg, host);
+
+	if (status == SOUP_STATUS_OK) {
+		dir = __upload_get_dir(msg, &storage_id);
+		if (!dir)
+			status = SOUP_STATUS_BAD_REQUEST;
+	}
+
+	if (status != SOUP_STATUS_OK) {
+		__upload_reject(msg, status);
+		g_free(boundary);
+		return;
+	}
+
+	upload = g_try_new0(struct upload_data, 1);
+	if (!upload) {
+		_E("failed to alloc upload_data");
+		__upload_reject(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		g_free(boundary);
+		g_free(dir);
+		return;
+	}
+
+	upload->parser = util_multipart_parser_new(boundary, &upload_callbacks, upload);
+	g_free(boundary);
+	if (!upload->parser) {
+		__upload_reject(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		g_free(dir);
+		g_free(upload);
+		return;
+	}
+	upload->msg = msg;
+	upload->host = g_strdup(host);
+	upload->storage_id = storage_id;
+	upload->dir = dir;
+
+	/* chunks are handed to the I/O thread as they come */
+	soup_message_body_set_accumulate(msg->request_body, FALSE);
+
+	g_object_set_data_full(G_OBJECT(msg), UPLOAD_DATA_KEY,
+				upload, __upload_data_free);
+	g_signal_connect(msg, "got-chunk", G_CALLBACK(__got_chunk_cb), upload);
+	g_signal_connect(msg, "finished", G_CALLBACK(__msg_finished_cb), upload);
 }
 
 static void route_api_image_upload_callback(SoupMessage *msg,
 					const char *path, GHashTable *query,
 					SoupClientContext *client, gpointer user_data)
 {
-	char *filename = NULL;
-	char *type = NULL;
-	SoupBuffer *buffer = NULL;
-	GHashTable *part_hash = NULL;
+	struct upload_data *upload = NULL;
+	guint status = SOUP_STATUS_OK;
 
 	if (msg->method != SOUP_METHOD_POST) {
 		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
 		return;
 	}
 
-	part_hash = soup_form_decode_multipart(msg, "imageFile",
-						&filename, &type, &buffer);
+	upload = g_object_get_data(G_OBJECT(msg), UPLOAD_DATA_KEY);
+	if (!upload) {
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
 
-	_D("filename : %s, type : %s, file size : %d",
-		filename, type, buffer->length);
+	if (upload->error_status)
+		status = upload->error_status;
+	else if (!util_multipart_parser_is_done(upload->parser) || !upload->file_found)
+		status = SOUP_STATUS_BAD_REQUEST;
 
-	http_server_pause_message(msg);
+	if (status != SOUP_STATUS_OK) {
+		_E("image upload failed - %u", status);
+		soup_message_set_status(msg, status);
+		return;
+	}
 
-	image_file_save(msg, filename, type, buffer);
+	http_server_pause_message(msg);
+	g_object_ref(msg);
 
-	g_free(filename);
-	g_free(type);
-	soup_buffer_free(buffer);
-	g_hash_table_destroy(part_hash);
+	util_image_store_file_commit(upload->file, upload->type,
+				__upload_commit_done_cb, upload);
+	upload->file = NULL;
 }
 
 int hs_route_api_image_upload_init(void)
 {
 	int ret = 0;
 
-	ret = http_server_route_handler_add("/api/imageUpload",
+	ret = http_server_route_headers_handler_add(API_IMAGE_UPLOAD,
+				route_api_image_upload_headers_callback, NULL, NULL);
+	retv_if(ret, -1);
+
+	ret = http_server_route_handler_add(API_IMAGE_UPLOAD,
 				route_api_image_upload_callback, NULL, NULL);
+	retv_if(ret, -1);
 
-	return ret;
+	return http_server_route_cost_set(API_IMAGE_UPLOAD,
+				HTTP_SERVER_ROUTE_COST_HIGH);
 }
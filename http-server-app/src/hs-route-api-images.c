@@ -0,0 +1,230 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+#include "http-server-log-private.h"
+#include "http-server-route.h"
+#include "hs-util-image-store.h"
+#include "hs-util-thumbnail.h"
+
+#define API_IMAGES "/api/images"
+
+/* images are content addressed, a given URI never changes */
+#define IMAGES_CACHE_CONTROL "public, max-age=31536000, immutable"
+
+struct images_request {
+	SoupMessage *msg;
+	char *etag;
+	gboolean msg_finished;
+};
+
+static gboolean __etag_matches(SoupMessage *msg, const char *etag)
+{
+	const char *header = NULL;
+	GSList *tags = NULL;
+	GSList *l = NULL;
+	gboolean matched = FALSE;
+
+	header = soup_message_headers_get_list(msg->request_headers, "If-None-Match");
+	if (!header)
+		return FALSE;
+
+	tags = soup_header_parse_list(header);
+	for (l = tags; l && !matched; l = l->next) {
+		const char *tag = l->data;
+
+		/* If-None-Match uses the weak comparison */
+		if (g_str_has_prefix(tag, "W/"))
+			tag += 2;
+
+		matched = !strcmp(tag, "*") || !strcmp(tag, etag);
+	}
+	soup_header_free_list(tags);
+
+	return matched;
+}
+
+static void __images_serve_file(SoupMessage *msg, const char *path,
+				const char *content_type, const char *etag)
+{
+	GMappedFile *map_file = NULL;
+	SoupBuffer *buffer = NULL;
+
+	map_file = g_mapped_file_new(path, FALSE, NULL);
+	if (!map_file) {
+		_E("failed to map [%s]", path);
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		return;
+	}
+
+	/* the body refers to the mapping, nothing is copied */
+	buffer = soup_buffer_new_with_owner(g_mapped_file_get_contents(map_file),
+					g_mapped_file_get_length(map_file),
+					map_file, (GDestroyNotify)g_mapped_file_unref);
+	soup_message_body_append_buffer(msg->response_body, buffer);
+	soup_buffer_free(buffer);
+
+	soup_message_headers_set_content_type(msg->response_headers,
+						content_type, NULL);
+	soup_message_headers_replace(msg->response_headers, "ETag", etag);
+	soup_message_headers_replace(msg->response_headers,
+					"Cache-Control", IMAGES_CACHE_CONTROL);
+
+	soup_message_set_status(msg, SOUP_STATUS_OK);
+}
+
+static void __images_request_finished_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct images_request *request = user_data;
+
+	request->msg_finished = TRUE;
+}
+
+static void __thumbnail_done_cb(const char *path, int error, gpointer user_data)
+{
+	struct images_request *request = user_data;
+	SoupMessage *msg = request->msg;
+
+	if (!request->msg_finished) {
+		if (!error)
+			__images_serve_file(msg, path, "image/jpeg", request->etag);
+		else if (error == ENOTSUP)
+			soup_message_set_status(msg, SOUP_STATUS_UNSUPPORTED_MEDIA_TYPE);
+		else if (error == EFBIG)
+			soup_message_set_status(msg, SOUP_STATUS_UNPROCESSABLE_ENTITY);
+		else if (error == ENOMEM)
+			soup_message_set_status(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+		else
+			soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+
+		http_server_unpause_message(msg);
+	}
+
+	g_signal_handlers_disconnect_by_data(msg, request);
+	g_object_unref(msg);
+	g_free(request->etag);
+	g_free(request);
+}
+
+static int __get_width(GHashTable *query, guint *width)
+{
+	const char *width_str = NULL;
+	char *end = NULL;
+	unsigned long value = 0;
+
+	*width = 0;
+
+	if (query)
+		width_str = g_hash_table_lookup(query, "w");
+
+	if (!width_str)
+		return 0;
+
+	errno = 0;
+	value = strtoul(width_str, &end, 10);
+	if (errno || end == width_str || *end || !value || value > G_MAXUINT)
+		return -1;
+
+	*width = value;
+
+	return 0;
+}
+
+static void route_api_images_callback(SoupMessage *msg,
+					const char *path, GHashTable *query,
+					SoupClientContext *client, gpointer user_data)
+{
+	struct images_request *request = NULL;
+	const char *id = NULL;
+	const char *content_type = NULL;
+	char *image_path = NULL;
+	char *thumbnail_path = NULL;
+	char *etag = NULL;
+	guint width = 0;
+
+	if (msg->method != SOUP_METHOD_GET) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	if (!g_str_has_prefix(path, API_IMAGES "/")) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+		return;
+	}
+	id = path + strlen(API_IMAGES "/");
+
+	if (__get_width(query, &width)) {
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	image_path = util_image_store_lookup(id, &content_type);
+	if (!image_path) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+		return;
+	}
+
+	/* wider than every thumbnail, the original is the best fit */
+	if (width)
+		width = util_thumbnail_fit_width(width);
+
+	if (width)
+		etag = g_strdup_printf("\"%s-%u\"", id, width);
+	else
+		etag = g_strdup_printf("\"%s\"", id);
+
+	if (__etag_matches(msg, etag)) {
+		soup_message_headers_replace(msg->response_headers, "ETag", etag);
+		soup_message_set_status(msg, SOUP_STATUS_NOT_MODIFIED);
+		goto OUT;
+	}
+
+	if (!width) {
+		__images_serve_file(msg, image_path, content_type, etag);
+		goto OUT;
+	}
+
+	thumbnail_path = util_thumbnail_get_path(image_path, id, width);
+	if (g_file_test(thumbnail_path, G_FILE_TEST_IS_REGULAR)) {
+		__images_serve_file(msg, thumbnail_path, "image/jpeg", etag);
+		goto OUT;
+	}
+
+	request = g_new0(struct images_request, 1);
+	request->msg = g_object_ref(msg);
+	request->etag = etag;
+	etag = NULL;
+	g_signal_connect(msg, "finished",
+			G_CALLBACK(__images_request_finished_cb), request);
+
+	http_server_pause_message(msg);
+	util_thumbnail_generate(image_path, id, width, __thumbnail_done_cb, request);
+
+OUT:
+	g_free(thumbnail_path);
+	g_free(image_path);
+	g_free(etag);
+}
+
+int hs_route_api_images_init(void)
+{
+	return http_server_route_handler_add(API_IMAGES,
+				route_api_images_callback, NULL, NULL);
+}
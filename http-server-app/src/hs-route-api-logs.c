@@ -0,0 +1,146 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <stdlib.h>
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+#include <dlog.h>
+#include "http-server-log-private.h"
+#include "http-server-route.h"
+#include "hs-util-json.h"
+#include "hs-util-log.h"
+
+#define API_LOGS "/api/logs"
+
+struct logs_query {
+	JsonBuilder *builder;
+	int min_prio;
+	guint64 last_seq;
+};
+
+static void __logs_add_record(const struct util_log_record *record,
+				gpointer user_data)
+{
+	struct logs_query *lq = user_data;
+
+	lq->last_seq = record->seq;
+	if (record->prio < lq->min_prio)
+		return;
+
+	json_builder_begin_object(lq->builder);
+	util_json_add_int(lq->builder, "seq", record->seq);
+	util_json_add_int(lq->builder, "time", record->time / G_TIME_SPAN_MILLISECOND);
+	util_json_add_str(lq->builder, "level", util_log_level_to_str(record->prio));
+	util_json_add_int(lq->builder, "tid", record->tid);
+	util_json_add_str(lq->builder, "func", record->func);
+	util_json_add_int(lq->builder, "line", record->line);
+	util_json_add_str(lq->builder, "msg", record->msg);
+	json_builder_end_object(lq->builder);
+}
+
+static void __logs_get(SoupMessage *msg, GHashTable *query)
+{
+	struct logs_query lq = { .min_prio = DLOG_VERBOSE, };
+	const char *since_str = NULL;
+	const char *level_str = NULL;
+	char *response_msg = NULL;
+	gsize resp_msg_size = 0;
+	guint64 since = 0;
+
+	if (query) {
+		since_str = g_hash_table_lookup(query, "since");
+		level_str = g_hash_table_lookup(query, "level");
+	}
+
+	if (since_str)
+		since = g_ascii_strtoull(since_str, NULL, 10);
+
+	if (level_str) {
+		lq.min_prio = util_log_level_from_str(level_str);
+		if (lq.min_prio < 0) {
+			soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+			return;
+		}
+	}
+	lq.last_seq = since;
+
+	lq.builder = json_builder_new();
+	json_builder_begin_object(lq.builder);
+	util_json_add_str(lq.builder, "level", util_log_level_to_str(util_log_level));
+	util_json_add_int(lq.builder, "dropped", util_log_get_dropped());
+
+	json_builder_set_member_name(lq.builder, "entries");
+	json_builder_begin_array(lq.builder);
+	util_log_foreach(since, __logs_add_record, &lq);
+	json_builder_end_array(lq.builder);
+
+	/* next since, also past entries filtered out by level */
+	util_json_add_int(lq.builder, "last", lq.last_seq);
+	json_builder_end_object(lq.builder);
+
+	response_msg = util_json_generate_str(lq.builder, &resp_msg_size);
+	g_clear_pointer(&lq.builder, g_object_unref);
+
+	soup_message_body_append(msg->response_body, SOUP_MEMORY_TAKE,
+					response_msg, resp_msg_size);
+	soup_message_headers_set_content_type(
+					msg->response_headers, "application/json", NULL);
+	soup_message_headers_replace(msg->response_headers, "Cache-Control", "no-store");
+	soup_message_set_status(msg, SOUP_STATUS_OK);
+}
+
+/* POST /api/logs?level=debug changes the level until the next start */
+static void __logs_set_level(SoupMessage *msg, GHashTable *query)
+{
+	int prio = -1;
+
+	if (query)
+		prio = util_log_level_from_str(g_hash_table_lookup(query, "level"));
+
+	if (prio < 0) {
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	_W("log level is changed to [%s]", util_log_level_to_str(prio));
+	util_log_set_level(prio);
+	soup_message_set_status(msg, SOUP_STATUS_NO_CONTENT);
+}
+
+static void route_api_logs_callback(SoupMessage *msg,
+					const char *path, GHashTable *query,
+					SoupClientContext *client, gpointer user_data)
+{
+	if (msg->method == SOUP_METHOD_GET)
+		__logs_get(msg, query);
+	else if (msg->method == SOUP_METHOD_POST)
+		__logs_set_level(msg, query);
+	else
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+}
+
+int hs_route_api_logs_init(void)
+{
+	int ret = 0;
+
+	/* anyone may read the logs, changing the level takes an administrator */
+	ret = http_server_auth_admin_realm_path_add(API_LOGS, TRUE);
+	retv_if(ret, ret);
+
+	return http_server_route_handler_add(API_LOGS,
+				route_api_logs_callback, NULL, NULL);
+}
@@ -22,6 +22,15 @@
 #include "http-server-route.h"
 #include "hs-util-json.h"
 
+#define STORAGE_BUDGET_MS 50
+
+struct storage_device {
+	int id;
+	storage_type_e type;
+	storage_state_e state;
+	char *path;
+};
+
 static const char *storage_type_to_str(storage_type_e type)
 {
 	const char *str = NULL;
@@ -67,37 +76,66 @@ static const char *storage_state_to_str(storage_state_e state)
 	return str;
 }
 
+static void storage_device_free(gpointer data)
+{
+	struct storage_device *device = data;
+
+	g_free(device->path);
+	g_free(device);
+}
+
+/* only collects the devices, their sizes are looked up in spans of their own */
 static bool storage_device_callback(int storage_id, storage_type_e type,
 					storage_state_e state, const char *path, void *user_data)
 {
-	JsonBuilder *builder = user_data;
+	GPtrArray *devices = user_data;
+	struct storage_device *device = NULL;
+
+	retv_if(!devices, false);
+
+	device = g_new0(struct storage_device, 1);
+	device->id = storage_id;
+	device->type = type;
+	device->state = state;
+	device->path = g_strdup(path);
+	g_ptr_array_add(devices, device);
+
+	return true;
+}
+
+static void storage_device_add(SoupMessage *msg, JsonBuilder *builder,
+					struct storage_device *device)
+{
 	unsigned long long total = 0;
 	unsigned long long avail = 0;
 	gint64 total_kb = 0;
 	gint64 avail_kb = 0;
-
-	retv_if(!builder, false);
+	gint64 begin = 0;
 
 	json_builder_begin_object(builder);
 
-	util_json_add_int(builder, "id", storage_id);
-	util_json_add_str(builder, "type", storage_type_to_str(type));
-	util_json_add_str(builder, "state", storage_state_to_str(state));
-	util_json_add_str(builder, "path", path);
+	util_json_add_int(builder, "id", device->id);
+	util_json_add_str(builder, "type", storage_type_to_str(device->type));
+	util_json_add_str(builder, "state", storage_state_to_str(device->state));
+	util_json_add_str(builder, "path", device->path);
 
-	storage_get_total_space(storage_id, &total);
+	begin = http_server_message_span_begin(msg, "storage_get_total_space");
+	storage_get_total_space(device->id, &total);
+	http_server_message_span_end(msg, HTTP_SERVER_SPAN_PLATFORM,
+				"storage_get_total_space", begin);
 	if (total > 0)
 		total_kb = total / 1024;
 	util_json_add_int(builder, "totalSpace", total_kb);
 
-	storage_get_available_space(storage_id, &avail);
+	begin = http_server_message_span_begin(msg, "storage_get_available_space");
+	storage_get_available_space(device->id, &avail);
+	http_server_message_span_end(msg, HTTP_SERVER_SPAN_PLATFORM,
+				"storage_get_available_space", begin);
 	if (avail > 0)
 		avail_kb = avail / 1024;
 	util_json_add_int(builder, "availSpace", avail_kb);
 
 	json_builder_end_object(builder);
-
-	return true;
 }
 
 static void route_api_storage_callback(SoupMessage *msg,
@@ -108,29 +146,41 @@ static void route_api_storage_callback(SoupMessage *msg,
 	char *response_msg = NULL;
 	gsize resp_msg_size = 0;
 	JsonBuilder *builder = NULL;
+	GPtrArray *devices = NULL;
+	gint64 begin = 0;
+	guint i = 0;
 
 	if (msg->method != SOUP_METHOD_GET) {
 		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
 		return;
 	}
 
+	devices = g_ptr_array_new_with_free_func(storage_device_free);
+	begin = http_server_message_span_begin(msg, "storage_foreach_device_supported");
+	ret = storage_foreach_device_supported(storage_device_callback, devices);
+	http_server_message_span_end(msg, HTTP_SERVER_SPAN_PLATFORM,
+				"storage_foreach_device_supported", begin);
+	if (ret) {
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		g_ptr_array_unref(devices);
+		return;
+	}
+
 	builder = json_builder_new();
 	json_builder_begin_object(builder);
 	json_builder_set_member_name(builder, "storageInfoList");
 	json_builder_begin_array(builder);
 
-
-	ret = storage_foreach_device_supported(storage_device_callback, builder);
-	if (ret) {
-		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
-		g_object_unref(builder);
-		return;
-	}
+	for (i = 0; i < devices->len; i++)
+		storage_device_add(msg, builder, g_ptr_array_index(devices, i));
+	g_ptr_array_unref(devices);
 
 	json_builder_end_array(builder);
 	json_builder_end_object(builder);
 
+	begin = http_server_message_span_begin(msg, "json");
 	response_msg = util_json_generate_str(builder, &resp_msg_size);
+	http_server_message_span_end(msg, HTTP_SERVER_SPAN_SERIALIZE, "json", begin);
 	g_clear_pointer(&builder, g_object_unref);
 
 	soup_message_body_append(msg->response_body, SOUP_MEMORY_COPY,
@@ -145,6 +195,12 @@ static void route_api_storage_callback(SoupMessage *msg,
 
 int hs_route_api_storage_init(void)
 {
-	return http_server_route_handler_add("/api/storage",
+	int ret = 0;
+
+	ret = http_server_route_handler_add("/api/storage",
 				route_api_storage_callback, NULL, NULL);
+	retv_if(ret, -1);
+
+	/* storaged may take its time, e.g. while a card is mounted */
+	return http_server_route_budget_set("/api/storage", STORAGE_BUDGET_MS);
 }
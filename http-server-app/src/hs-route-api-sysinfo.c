@@ -33,6 +33,25 @@
 #define SYSINFO_BUILD_DATE "http://tizen.org/system/build.date"
 #define SYSINFO_DISPLAY "http://tizen.org/feature/display"
 
+/* ten keys, each a call to system-info */
+#define SYSINFO_BUDGET_MS 50
+
+/* string keys and their members, the key names the span of its call */
+static const struct {
+	const char *key;
+	const char *member;
+} sysinfo_strings[] = {
+	{ SYSINFO_MANUFACTURER, "manufacturer" },
+	{ SYSINFO_PROFILE, "profile" },
+	{ SYSINFO_PLATFORM_VERSION, "platformVersion" },
+	{ SYSINFO_BUILD, "build" },
+	{ SYSINFO_RELEASE, "buildRelease" },
+	{ SYSINFO_BUILD_TYPE, "buildType" },
+	{ SYSINFO_BUILD_DATE, "buildDate" },
+	{ SYSINFO_MODEL_NAME, "modelName" },
+	{ SYSINFO_PROCESSOR, "processor" },
+};
+
 
 static void route_api_sysinfo_callback(SoupMessage *msg,
 					const char *path, GHashTable *query,
@@ -43,6 +62,8 @@ static void route_api_sysinfo_callback(SoupMessage *msg,
 	char *response_msg = NULL;
 	gsize resp_msg_size = 0;
 	JsonBuilder *builder = NULL;
+	gint64 begin = 0;
+	guint i = 0;
 
 	if (msg->method != SOUP_METHOD_GET) {
 		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
@@ -52,48 +73,28 @@ static void route_api_sysinfo_callback(SoupMessage *msg,
 	builder = json_builder_new();
 	json_builder_begin_object(builder);
 
-	system_info_get_platform_string(SYSINFO_MANUFACTURER, &str_val);
-	util_json_add_str(builder, "manufacturer", str_val ? str_val : " ");
-	g_clear_pointer(&str_val, g_free);
-
-	system_info_get_platform_string(SYSINFO_PROFILE, &str_val);
-	util_json_add_str(builder, "profile", str_val ? str_val : " ");
-	g_clear_pointer(&str_val, g_free);
-
-	system_info_get_platform_string(SYSINFO_PLATFORM_VERSION, &str_val);
-	util_json_add_str(builder, "platformVersion", str_val ? str_val : " ");
-	g_clear_pointer(&str_val, g_free);
-
-	system_info_get_platform_string(SYSINFO_BUILD, &str_val);
-	util_json_add_str(builder, "build", str_val ? str_val : " ");
-	g_clear_pointer(&str_val, g_free);
-
-	system_info_get_platform_string(SYSINFO_RELEASE, &str_val);
-	util_json_add_str(builder, "buildRelease", str_val ? str_val : " ");
-	g_clear_pointer(&str_val, g_free);
-
-	system_info_get_platform_string(SYSINFO_BUILD_TYPE, &str_val);
-	util_json_add_str(builder, "buildType", str_val ? str_val : " ");
-	g_clear_pointer(&str_val, g_free);
+	for (i = 0; i < G_N_ELEMENTS(sysinfo_strings); i++) {
+		begin = http_server_message_span_begin(msg, sysinfo_strings[i].key);
+		system_info_get_platform_string(sysinfo_strings[i].key, &str_val);
+		http_server_message_span_end(msg, HTTP_SERVER_SPAN_PLATFORM,
+					sysinfo_strings[i].key, begin);
 
-	system_info_get_platform_string(SYSINFO_BUILD_DATE, &str_val);
-	util_json_add_str(builder, "buildDate", str_val ? str_val : " ");
-	g_clear_pointer(&str_val, g_free);
-
-	system_info_get_platform_string(SYSINFO_MODEL_NAME, &str_val);
-	util_json_add_str(builder, "modelName", str_val ? str_val : " ");
-	g_clear_pointer(&str_val, g_free);
-
-	system_info_get_platform_string(SYSINFO_PROCESSOR, &str_val);
-	util_json_add_str(builder, "processor", str_val ? str_val : " ");
-	g_clear_pointer(&str_val, g_free);
+		util_json_add_str(builder, sysinfo_strings[i].member,
+					str_val ? str_val : " ");
+		g_clear_pointer(&str_val, g_free);
+	}
 
+	begin = http_server_message_span_begin(msg, SYSINFO_DISPLAY);
 	system_info_get_platform_bool(SYSINFO_DISPLAY, &bool_val);
+	http_server_message_span_end(msg, HTTP_SERVER_SPAN_PLATFORM,
+				SYSINFO_DISPLAY, begin);
 	util_json_add_str(builder, "display", bool_val ? "headed" : "headless");
 
 	json_builder_end_object(builder);
 
+	begin = http_server_message_span_begin(msg, "json");
 	response_msg = util_json_generate_str(builder, &resp_msg_size);
+	http_server_message_span_end(msg, HTTP_SERVER_SPAN_SERIALIZE, "json", begin);
 	g_clear_pointer(&builder, g_object_unref);
 
 	soup_message_body_append(msg->response_body, SOUP_MEMORY_COPY,
@@ -108,6 +109,11 @@ static void route_api_sysinfo_callback(SoupMessage *msg,
 
 int hs_route_api_sysinfo_init(void)
 {
-	return http_server_route_handler_add("/api/systemInfo",
+	int ret = 0;
+
+	ret = http_server_route_handler_add("/api/systemInfo",
 				route_api_sysinfo_callback, NULL, NULL);
+	retv_if(ret, -1);
+
+	return http_server_route_budget_set("/api/systemInfo", SYSINFO_BUDGET_MS);
 }
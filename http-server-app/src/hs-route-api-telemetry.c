@@ -0,0 +1,906 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <gio/gio.h>
+#include <string.h>
+#include <unistd.h>
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+#include "http-server-log-private.h"
+#include "http-server-route.h"
+#include "hs-util-json.h"
+#include "hs-util-event.h"
+#include "hs-util-memory.h"
+#include "hs-util-pressure.h"
+#include "hs-util-watchdog.h"
+
+#define API_TELEMETRY "/api/telemetry"
+
+#define WS_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+#define WS_OPCODE_CONTINUATION 0x0
+#define WS_OPCODE_TEXT 0x1
+#define WS_OPCODE_BINARY 0x2
+#define WS_OPCODE_CLOSE 0x8
+#define WS_OPCODE_PING 0x9
+#define WS_OPCODE_PONG 0xA
+
+#define WS_CLOSE_NORMAL 1000
+#define WS_CLOSE_PROTOCOL_ERROR 1002
+#define WS_CLOSE_UNSUPPORTED 1003
+#define WS_CLOSE_TOO_BIG 1009
+
+/* commands from clients are small, they must fit in a single frame */
+#define WS_MAX_INBUF (8 * 1024)
+/* updates are not queued past this, pending ones are downsampled instead */
+#define WS_MAX_OUTBUF (64 * 1024)
+/* a client which doesn't drain its buffer for this long is dropped */
+#define WS_STALL_TIMEOUT_SEC 10
+
+#define TELEMETRY_TICK_MS 100
+#define TELEMETRY_METRICS_MS 1000
+
+enum {
+	TOPIC_CONNECTION,
+	TOPIC_STORAGE,
+	TOPIC_APPS,
+	TOPIC_SYSTEM,
+	TOPIC_MAX,
+};
+
+static const struct {
+	const char *name;
+	const char *event_type;
+	gint64 min_interval_ms;
+} topics[TOPIC_MAX] = {
+	{ "connection", UTIL_EVENT_TYPE_CONNECTION, 250 },
+	{ "storage", UTIL_EVENT_TYPE_STORAGE, 500 },
+	{ "apps", UTIL_EVENT_TYPE_APP, 500 },
+	{ "system", NULL, TELEMETRY_METRICS_MS },
+};
+
+struct ws_topic_state {
+	gboolean subscribed;
+	gint64 last_sent;
+	char *pending;
+};
+
+struct telemetry_data;
+
+struct ws_client {
+	struct telemetry_data *td;
+	SoupMessage *msg;
+	GSocket *socket;
+	GSource *read_source;
+	GSource *write_source;
+	GByteArray *inbuf;
+	GByteArray *outbuf;
+	/* part of outbuf taken from the memory budget */
+	gsize charged;
+	gint64 stalled_since;
+	struct ws_topic_state topic[TOPIC_MAX];
+};
+
+struct telemetry_data {
+	GList *clients;
+	guint listener_id;
+	guint tick_source;
+	guint metrics_source;
+	guint64 cpu_total;
+	guint64 cpu_idle;
+};
+
+static void __ws_client_destroy(struct ws_client *c, gboolean finish_msg);
+static gboolean __telemetry_tick_cb(gpointer user_data);
+
+static void __ws_frame_append(GByteArray *out, guint8 opcode,
+				const guint8 *payload, gsize len)
+{
+	guint8 header[10];
+	gsize header_len = 2;
+	int i = 0;
+
+	header[0] = 0x80 | opcode;
+	if (len < 126) {
+		header[1] = len;
+	} else if (len <= 0xffff) {
+		header[1] = 126;
+		header[2] = (len >> 8) & 0xff;
+		header[3] = len & 0xff;
+		header_len = 4;
+	} else {
+		header[1] = 127;
+		for (i = 0; i < 8; i++)
+			header[2 + i] = ((guint64)len >> (56 - 8 * i)) & 0xff;
+		header_len = 10;
+	}
+
+	g_byte_array_append(out, header, header_len);
+	if (len)
+		g_byte_array_append(out, payload, len);
+}
+
+static gboolean __ws_writable_cb(GSocket *socket,
+				GIOCondition cond, gpointer user_data);
+
+static gboolean __ws_flush(struct ws_client *c)
+{
+	while (c->outbuf->len) {
+		GError *error = NULL;
+		gssize sent = g_socket_send(c->socket, (const gchar *)c->outbuf->data,
+						c->outbuf->len, NULL, &error);
+		if (sent < 0) {
+			if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+				g_error_free(error);
+				break;
+			}
+			_E("failed to send - %s", error->message);
+			g_error_free(error);
+			return FALSE;
+		}
+		g_byte_array_remove_range(c->outbuf, 0, sent);
+	}
+
+	/* frames are appended right before each flush */
+	if (c->outbuf->len > c->charged)
+		util_memory_charge_force(UTIL_MEMORY_STREAMS, c->outbuf->len - c->charged);
+	else
+		util_memory_uncharge(UTIL_MEMORY_STREAMS, c->charged - c->outbuf->len);
+	c->charged = c->outbuf->len;
+
+	if (c->outbuf->len && !c->write_source) {
+		c->write_source = g_socket_create_source(c->socket, G_IO_OUT, NULL);
+		g_source_set_callback(c->write_source,
+				(GSourceFunc)__ws_writable_cb, c, NULL);
+		g_source_attach(c->write_source, NULL);
+	} else if (!c->outbuf->len && c->write_source) {
+		g_source_destroy(c->write_source);
+		g_clear_pointer(&c->write_source, g_source_unref);
+	}
+
+	return TRUE;
+}
+
+static gboolean __ws_writable_cb(GSocket *socket,
+				GIOCondition cond, gpointer user_data)
+{
+	struct ws_client *c = user_data;
+
+	if (!__ws_flush(c)) {
+		__ws_client_destroy(c, TRUE);
+		return G_SOURCE_REMOVE;
+	}
+
+	if (c->outbuf->len < WS_MAX_OUTBUF)
+		c->stalled_since = 0;
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void __ws_client_close(struct ws_client *c, guint16 code)
+{
+	guint8 payload[2];
+
+	payload[0] = (code >> 8) & 0xff;
+	payload[1] = code & 0xff;
+	__ws_frame_append(c->outbuf, WS_OPCODE_CLOSE, payload, sizeof(payload));
+	__ws_flush(c);
+
+	__ws_client_destroy(c, TRUE);
+}
+
+static gboolean __ws_client_send(struct ws_client *c, const char *text)
+{
+	__ws_frame_append(c->outbuf, WS_OPCODE_TEXT,
+				(const guint8 *)text, strlen(text));
+
+	if (!__ws_flush(c)) {
+		__ws_client_destroy(c, TRUE);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+static gboolean __telemetry_has_subscriber(struct telemetry_data *td, int topic)
+{
+	GList *l = NULL;
+
+	for (l = td->clients; l; l = l->next) {
+		struct ws_client *c = l->data;
+		if (c->topic[topic].subscribed)
+			return TRUE;
+	}
+
+	return FALSE;
+}
+
+/* Returns FALSE if the client is gone */
+static gboolean __ws_topic_flush(struct ws_client *c, int topic,
+				gint64 now, gboolean *pending)
+{
+	struct ws_topic_state *ts = &c->topic[topic];
+	char *text = NULL;
+	gboolean alive = FALSE;
+
+	if (!ts->pending)
+		return TRUE;
+
+	if (now - ts->last_sent < topics[topic].min_interval_ms * 1000) {
+		*pending = TRUE;
+		return TRUE;
+	}
+
+	if (c->outbuf->len >= WS_MAX_OUTBUF
+		|| (c->outbuf->len && util_memory_is_over_budget())) {
+		/* slow consumer, keep only the latest value until it drains */
+		if (!c->stalled_since)
+			c->stalled_since = now;
+		*pending = TRUE;
+		return TRUE;
+	}
+
+	text = g_strdup_printf("{\"topic\":\"%s\",\"data\":%s}",
+				topics[topic].name, ts->pending);
+	g_clear_pointer(&ts->pending, g_free);
+	ts->last_sent = now;
+
+	alive = __ws_client_send(c, text);
+	g_free(text);
+
+	return alive;
+}
+
+static void __telemetry_post(struct telemetry_data *td, int topic, const char *data)
+{
+	GList *l = td->clients;
+	gint64 now = g_get_monotonic_time();
+	gboolean pending = FALSE;
+
+	while (l) {
+		struct ws_client *c = l->data;
+		l = l->next;
+
+		if (!c->topic[topic].subscribed)
+			continue;
+
+		g_free(c->topic[topic].pending);
+		c->topic[topic].pending = g_strdup(data);
+
+		__ws_topic_flush(c, topic, now, &pending);
+	}
+
+	if (pending && !td->tick_source)
+		td->tick_source = g_timeout_add(TELEMETRY_TICK_MS,
+						__telemetry_tick_cb, td);
+}
+
+static gboolean __telemetry_tick_cb(gpointer user_data)
+{
+	struct telemetry_data *td = user_data;
+	GList *l = td->clients;
+	gint64 now = g_get_monotonic_time();
+	gboolean pending = FALSE;
+
+	while (l) {
+		struct ws_client *c = l->data;
+		int topic = 0;
+		l = l->next;
+
+		if (c->stalled_since &&
+			now - c->stalled_since > WS_STALL_TIMEOUT_SEC * G_USEC_PER_SEC) {
+			_W("dropping stalled telemetry client");
+			__ws_client_destroy(c, TRUE);
+			continue;
+		}
+
+		for (topic = 0; topic < TOPIC_MAX; topic++) {
+			if (!__ws_topic_flush(c, topic, now, &pending))
+				break;
+		}
+	}
+
+	if (pending)
+		return G_SOURCE_CONTINUE;
+
+	td->tick_source = 0;
+	return G_SOURCE_REMOVE;
+}
+
+static void __telemetry_event_cb(const struct util_event *event, gpointer user_data)
+{
+	struct telemetry_data *td = user_data;
+	int topic = 0;
+
+	for (topic = 0; topic < TOPIC_MAX; topic++) {
+		if (0 == g_strcmp0(topics[topic].event_type, event->type)) {
+			__telemetry_post(td, topic, event->data);
+			return;
+		}
+	}
+}
+
+static void __metrics_add_cpu(struct telemetry_data *td, JsonBuilder *builder)
+{
+	char *contents = NULL;
+	guint64 user = 0, nice = 0, system = 0, idle = 0;
+	guint64 iowait = 0, irq = 0, softirq = 0;
+	guint64 total = 0;
+
+	if (!g_file_get_contents("/proc/stat", &contents, NULL, NULL))
+		return;
+
+	if (sscanf(contents, "cpu %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+			" %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT
+			" %" G_GUINT64_FORMAT " %" G_GUINT64_FORMAT,
+			&user, &nice, &system, &idle, &iowait, &irq, &softirq) == 7) {
+		total = user + nice + system + idle + iowait + irq + softirq;
+		idle += iowait;
+
+		if (td->cpu_total && total > td->cpu_total) {
+			guint64 d_total = total - td->cpu_total;
+			guint64 d_idle = idle - td->cpu_idle;
+			util_json_add_double(builder, "cpuUsage",
+				100.0 * (d_total - d_idle) / d_total);
+		}
+		td->cpu_total = total;
+		td->cpu_idle = idle;
+	}
+
+	g_free(contents);
+}
+
+static void __metrics_add_memory(JsonBuilder *builder)
+{
+	char *contents = NULL;
+	char *line = NULL;
+	gint64 value = 0;
+
+	if (!g_file_get_contents("/proc/meminfo", &contents, NULL, NULL))
+		return;
+
+	line = strstr(contents, "MemTotal:");
+	if (line && sscanf(line, "MemTotal: %" G_GINT64_FORMAT, &value) == 1)
+		util_json_add_int(builder, "memTotal", value);
+
+	line = strstr(contents, "MemAvailable:");
+	if (line && sscanf(line, "MemAvailable: %" G_GINT64_FORMAT, &value) == 1)
+		util_json_add_int(builder, "memAvailable", value);
+
+	g_free(contents);
+}
+
+static void __metrics_add_loadavg(JsonBuilder *builder)
+{
+	char *contents = NULL;
+	double load = 0.0;
+
+	if (!g_file_get_contents("/proc/loadavg", &contents, NULL, NULL))
+		return;
+
+	if (sscanf(contents, "%lf", &load) == 1)
+		util_json_add_double(builder, "loadAvg", load);
+
+	g_free(contents);
+}
+
+static void __metrics_add_route(const char *path, guint in_flight, guint queued,
+				guint64 rejected, gpointer user_data)
+{
+	JsonBuilder *builder = user_data;
+
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "path", path);
+	util_json_add_int(builder, "inFlight", in_flight);
+	util_json_add_int(builder, "queued", queued);
+	util_json_add_int(builder, "rejected", rejected);
+	json_builder_end_object(builder);
+}
+
+static void __metrics_add_pressure(JsonBuilder *builder)
+{
+	const struct util_pressure *pressure = util_pressure_get();
+
+	json_builder_set_member_name(builder, "pressure");
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "level", util_pressure_level_to_str(pressure->level));
+	if (pressure->psi) {
+		util_json_add_double(builder, "cpu", pressure->cpu_some);
+		util_json_add_double(builder, "memory", pressure->memory_some);
+		util_json_add_double(builder, "io", pressure->io_some);
+	}
+	util_json_add_int(builder, "shed", http_server_route_get_shed_count());
+	json_builder_end_object(builder);
+}
+
+static void __metrics_add_budget(const char *path, guint64 overruns,
+				gboolean offloaded, gpointer user_data)
+{
+	JsonBuilder *builder = user_data;
+
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "path", path);
+	util_json_add_int(builder, "overruns", overruns);
+	util_json_add_bool(builder, "offloaded", offloaded);
+	json_builder_end_object(builder);
+}
+
+static void __metrics_add_main_loop(JsonBuilder *builder)
+{
+	struct util_watchdog_stats stats;
+
+	util_watchdog_get_stats(&stats);
+
+	json_builder_set_member_name(builder, "mainLoop");
+	json_builder_begin_object(builder);
+	util_json_add_double(builder, "lagAvgMs", stats.lag_avg / 1000.0);
+	util_json_add_double(builder, "lagMaxMs", stats.lag_max / 1000.0);
+	util_json_add_int(builder, "stalls", stats.stalls);
+	json_builder_set_member_name(builder, "budgets");
+	json_builder_begin_array(builder);
+	http_server_route_foreach_budget(__metrics_add_budget, builder);
+	json_builder_end_array(builder);
+	json_builder_end_object(builder);
+}
+
+static void __metrics_add_routes(JsonBuilder *builder)
+{
+	json_builder_set_member_name(builder, "routes");
+	json_builder_begin_array(builder);
+	http_server_route_foreach_stats(__metrics_add_route, builder);
+	json_builder_end_array(builder);
+}
+
+static gboolean __telemetry_metrics_cb(gpointer user_data)
+{
+	struct telemetry_data *td = user_data;
+	JsonBuilder *builder = NULL;
+	char *data = NULL;
+
+	if (!__telemetry_has_subscriber(td, TOPIC_SYSTEM)) {
+		td->metrics_source = 0;
+		td->cpu_total = 0;
+		td->cpu_idle = 0;
+		return G_SOURCE_REMOVE;
+	}
+
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+	__metrics_add_cpu(td, builder);
+	__metrics_add_memory(builder);
+	__metrics_add_loadavg(builder);
+	__metrics_add_pressure(builder);
+	__metrics_add_main_loop(builder);
+	__metrics_add_routes(builder);
+	json_builder_end_object(builder);
+
+	data = util_json_generate_str(builder, NULL);
+	g_object_unref(builder);
+
+	if (data)
+		__telemetry_post(td, TOPIC_SYSTEM, data);
+	g_free(data);
+
+	return G_SOURCE_CONTINUE;
+}
+
+static int __topic_from_name(const char *name)
+{
+	int topic = 0;
+
+	for (topic = 0; topic < TOPIC_MAX; topic++) {
+		if (0 == g_strcmp0(topics[topic].name, name))
+			return topic;
+	}
+
+	return -1;
+}
+
+static void __ws_set_subscription(struct ws_client *c,
+				JsonObject *object, const char *member, gboolean subscribe)
+{
+	JsonArray *array = NULL;
+	guint i = 0;
+
+	if (!json_object_has_member(object, member))
+		return;
+
+	array = json_object_get_array_member(object, member);
+	if (!array)
+		return;
+
+	for (i = 0; i < json_array_get_length(array); i++) {
+		int topic = __topic_from_name(json_array_get_string_element(array, i));
+		if (topic < 0)
+			continue;
+
+		c->topic[topic].subscribed = subscribe;
+		if (!subscribe)
+			g_clear_pointer(&c->topic[topic].pending, g_free);
+	}
+}
+
+static gboolean __ws_handle_command(struct ws_client *c,
+				const guint8 *payload, gsize len)
+{
+	struct telemetry_data *td = c->td;
+	JsonParser *parser = NULL;
+	JsonNode *root = NULL;
+	JsonBuilder *builder = NULL;
+	char *reply = NULL;
+	gboolean alive = TRUE;
+	int topic = 0;
+
+	parser = json_parser_new();
+	if (!json_parser_load_from_data(parser, (const gchar *)payload, len, NULL)) {
+		g_object_unref(parser);
+		return __ws_client_send(c, "{\"error\":\"invalid json\"}");
+	}
+
+	root = json_parser_get_root(parser);
+	if (root && JSON_NODE_HOLDS_OBJECT(root)) {
+		JsonObject *object = json_node_get_object(root);
+		__ws_set_subscription(c, object, "subscribe", TRUE);
+		__ws_set_subscription(c, object, "unsubscribe", FALSE);
+	}
+	g_object_unref(parser);
+
+	if (c->topic[TOPIC_SYSTEM].subscribed && !td->metrics_source)
+		td->metrics_source = g_timeout_add(TELEMETRY_METRICS_MS,
+						__telemetry_metrics_cb, td);
+
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+	json_builder_set_member_name(builder, "subscribed");
+	json_builder_begin_array(builder);
+	for (topic = 0; topic < TOPIC_MAX; topic++) {
+		if (!c->topic[topic].subscribed)
+			continue;
+		json_builder_begin_object(builder);
+		util_json_add_str(builder, "topic", topics[topic].name);
+		util_json_add_int(builder, "minIntervalMs", topics[topic].min_interval_ms);
+		json_builder_end_object(builder);
+	}
+	json_builder_end_array(builder);
+	json_builder_end_object(builder);
+
+	reply = util_json_generate_str(builder, NULL);
+	g_object_unref(builder);
+
+	if (reply)
+		alive = __ws_client_send(c, reply);
+	g_free(reply);
+
+	return alive;
+}
+
+/* Returns FALSE if the client is gone */
+static gboolean __ws_parse_frames(struct ws_client *c)
+{
+	while (c->inbuf->len >= 2) {
+		guint8 *p = c->inbuf->data;
+		gboolean fin = p[0] & 0x80;
+		guint8 opcode = p[0] & 0x0f;
+		guint64 len = p[1] & 0x7f;
+		guint8 *mask = NULL;
+		guint8 *payload = NULL;
+		gsize pos = 2;
+		gsize i = 0;
+
+		if (!(p[1] & 0x80)) {
+			__ws_client_close(c, WS_CLOSE_PROTOCOL_ERROR);
+			return FALSE;
+		}
+
+		if (len == 126) {
+			if (c->inbuf->len < 4)
+				return TRUE;
+			len = (p[2] << 8) | p[3];
+			pos = 4;
+		} else if (len == 127) {
+			if (c->inbuf->len < 10)
+				return TRUE;
+			len = 0;
+			for (i = 0; i < 8; i++)
+				len = (len << 8) | p[2 + i];
+			pos = 10;
+		}
+
+		if (len > WS_MAX_INBUF) {
+			__ws_client_close(c, WS_CLOSE_TOO_BIG);
+			return FALSE;
+		}
+
+		if (c->inbuf->len < pos + 4 + len)
+			return TRUE;
+
+		mask = p + pos;
+		payload = p + pos + 4;
+		for (i = 0; i < len; i++)
+			payload[i] ^= mask[i % 4];
+
+		if (!fin || opcode == WS_OPCODE_CONTINUATION) {
+			__ws_client_close(c, WS_CLOSE_UNSUPPORTED);
+			return FALSE;
+		}
+
+		switch (opcode) {
+		case WS_OPCODE_TEXT:
+		case WS_OPCODE_BINARY:
+			if (!__ws_handle_command(c, payload, len))
+				return FALSE;
+			break;
+		case WS_OPCODE_CLOSE:
+			__ws_client_close(c, WS_CLOSE_NORMAL);
+			return FALSE;
+		case WS_OPCODE_PING:
+			__ws_frame_append(c->outbuf, WS_OPCODE_PONG, payload, len);
+			if (!__ws_flush(c)) {
+				__ws_client_destroy(c, TRUE);
+				return FALSE;
+			}
+			break;
+		case WS_OPCODE_PONG:
+			break;
+		default:
+			__ws_client_close(c, WS_CLOSE_PROTOCOL_ERROR);
+			return FALSE;
+		}
+
+		g_byte_array_remove_range(c->inbuf, 0, pos + 4 + len);
+	}
+
+	return TRUE;
+}
+
+static gboolean __ws_readable_cb(GSocket *socket,
+				GIOCondition cond, gpointer user_data)
+{
+	struct ws_client *c = user_data;
+	guint8 buf[1024];
+	GError *error = NULL;
+	gssize len = 0;
+
+	len = g_socket_receive(socket, (gchar *)buf, sizeof(buf), NULL, &error);
+	if (len < 0 && g_error_matches(error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK)) {
+		g_error_free(error);
+		return G_SOURCE_CONTINUE;
+	}
+
+	if (len <= 0) {
+		if (error) {
+			_E("failed to receive - %s", error->message);
+			g_error_free(error);
+		}
+		__ws_client_destroy(c, TRUE);
+		return G_SOURCE_REMOVE;
+	}
+
+	if (c->inbuf->len + len > WS_MAX_INBUF + 14) {
+		__ws_client_close(c, WS_CLOSE_TOO_BIG);
+		return G_SOURCE_REMOVE;
+	}
+
+	g_byte_array_append(c->inbuf, buf, len);
+
+	if (!__ws_parse_frames(c))
+		return G_SOURCE_REMOVE;
+
+	return G_SOURCE_CONTINUE;
+}
+
+static void __ws_msg_finished_cb(SoupMessage *msg, gpointer user_data)
+{
+	/* the server went down under us, the message can't be finished again */
+	__ws_client_destroy(user_data, FALSE);
+}
+
+static void __ws_client_destroy(struct ws_client *c, gboolean finish_msg)
+{
+	struct telemetry_data *td = c->td;
+	int topic = 0;
+
+	td->clients = g_list_remove(td->clients, c);
+
+	if (c->read_source) {
+		g_source_destroy(c->read_source);
+		g_clear_pointer(&c->read_source, g_source_unref);
+	}
+
+	if (c->write_source) {
+		g_source_destroy(c->write_source);
+		g_clear_pointer(&c->write_source, g_source_unref);
+	}
+
+	if (c->socket) {
+		g_socket_shutdown(c->socket, TRUE, TRUE, NULL);
+		g_clear_pointer(&c->socket, g_object_unref);
+	}
+
+	g_signal_handlers_disconnect_by_data(c->msg, c);
+	if (finish_msg) {
+		/* the connection is shut down, libsoup just cleans it up */
+		soup_message_set_status(c->msg, SOUP_STATUS_OK);
+		soup_message_headers_replace(c->msg->response_headers,
+						"Connection", "close");
+		http_server_unpause_message(c->msg);
+	}
+	g_object_unref(c->msg);
+
+	for (topic = 0; topic < TOPIC_MAX; topic++)
+		g_free(c->topic[topic].pending);
+
+	g_byte_array_free(c->inbuf, TRUE);
+	util_memory_uncharge(UTIL_MEMORY_STREAMS, c->charged);
+	g_byte_array_free(c->outbuf, TRUE);
+	g_free(c);
+
+	_D("telemetry client is gone, remains [%u]", g_list_length(td->clients));
+}
+
+static char *__ws_accept_key(const char *key)
+{
+	GChecksum *checksum = NULL;
+	guint8 digest[20];
+	gsize digest_len = sizeof(digest);
+	char *accept = NULL;
+
+	checksum = g_checksum_new(G_CHECKSUM_SHA1);
+	g_checksum_update(checksum, (const guchar *)key, strlen(key));
+	g_checksum_update(checksum, (const guchar *)WS_GUID, strlen(WS_GUID));
+	g_checksum_get_digest(checksum, digest, &digest_len);
+	g_checksum_free(checksum);
+
+	accept = g_base64_encode(digest, digest_len);
+
+	return accept;
+}
+
+static gboolean __ws_is_upgrade_request(SoupMessage *msg)
+{
+	const char *connection = NULL;
+	const char *upgrade = NULL;
+	const char *version = NULL;
+
+	connection = soup_message_headers_get_list(msg->request_headers, "Connection");
+	upgrade = soup_message_headers_get_one(msg->request_headers, "Upgrade");
+	version = soup_message_headers_get_one(msg->request_headers,
+						"Sec-WebSocket-Version");
+
+	if (!connection || !soup_header_contains(connection, "Upgrade"))
+		return FALSE;
+
+	if (!upgrade || g_ascii_strcasecmp(upgrade, "websocket"))
+		return FALSE;
+
+	return (0 == g_strcmp0(version, "13"));
+}
+
+static void route_api_telemetry_callback(SoupMessage *msg,
+					const char *path, GHashTable *query,
+					SoupClientContext *client, gpointer user_data)
+{
+	struct telemetry_data *td = user_data;
+	struct ws_client *c = NULL;
+	const char *key = NULL;
+	char *accept = NULL;
+	char *handshake = NULL;
+	GSocket *socket = NULL;
+	int fd = -1;
+
+	if (msg->method != SOUP_METHOD_GET) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	key = soup_message_headers_get_one(msg->request_headers, "Sec-WebSocket-Key");
+	if (!key || !__ws_is_upgrade_request(msg)) {
+		soup_message_headers_replace(msg->response_headers,
+						"Sec-WebSocket-Version", "13");
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	/*
+	 * libsoup 2.46 has no websocket support, so the connection is taken
+	 * over while the message stays paused; libsoup does not touch the
+	 * socket until the message is unpaused again.
+	 */
+	fd = dup(soup_socket_get_fd(soup_client_context_get_socket(client)));
+	if (fd < 0) {
+		_E("failed to dup client socket");
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		return;
+	}
+
+	socket = g_socket_new_from_fd(fd, NULL);
+	if (!socket) {
+		_E("failed to create socket");
+		close(fd);
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		return;
+	}
+	g_socket_set_blocking(socket, FALSE);
+
+	c = g_new0(struct ws_client, 1);
+	c->td = td;
+	c->msg = g_object_ref(msg);
+	c->socket = socket;
+	c->inbuf = g_byte_array_new();
+	c->outbuf = g_byte_array_sized_new(1024);
+
+	http_server_pause_message(msg);
+	g_signal_connect(msg, "finished", G_CALLBACK(__ws_msg_finished_cb), c);
+	td->clients = g_list_prepend(td->clients, c);
+
+	accept = __ws_accept_key(key);
+	handshake = g_strdup_printf("HTTP/1.1 101 Switching Protocols\r\n"
+				"Upgrade: websocket\r\n"
+				"Connection: Upgrade\r\n"
+				"Sec-WebSocket-Accept: %s\r\n\r\n", accept);
+	g_byte_array_append(c->outbuf, (const guint8 *)handshake, strlen(handshake));
+	g_free(handshake);
+	g_free(accept);
+
+	if (!__ws_flush(c)) {
+		__ws_client_destroy(c, TRUE);
+		return;
+	}
+
+	c->read_source = g_socket_create_source(socket, G_IO_IN, NULL);
+	g_source_set_callback(c->read_source, (GSourceFunc)__ws_readable_cb, c, NULL);
+	g_source_attach(c->read_source, NULL);
+}
+
+static void __telemetry_data_free(gpointer data)
+{
+	struct telemetry_data *td = data;
+
+	if (td->listener_id)
+		util_event_listener_remove(td->listener_id);
+
+	if (td->tick_source)
+		g_source_remove(td->tick_source);
+
+	if (td->metrics_source)
+		g_source_remove(td->metrics_source);
+
+	while (td->clients)
+		__ws_client_destroy(td->clients->data, FALSE);
+
+	g_free(td);
+}
+
+int hs_route_api_telemetry_init(void)
+{
+	struct telemetry_data *td = NULL;
+	int ret = 0;
+
+	td = g_try_new0(struct telemetry_data, 1);
+	retvm_if(!td, -1, "failed to alloc telemetry_data");
+
+	td->listener_id = util_event_listener_add(__telemetry_event_cb, td);
+	if (!td->listener_id)
+		_W("event hub is not running, only system metrics will be sent");
+
+	ret = http_server_route_handler_add(API_TELEMETRY,
+				route_api_telemetry_callback, td, __telemetry_data_free);
+	if (ret)
+		__telemetry_data_free(td);
+
+	return ret;
+}
@@ -0,0 +1,898 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <libsoup/soup.h>
+#include <json-glib/json-glib.h>
+#include <app_common.h>
+#include "http-server-log-private.h"
+#include "http-server-route.h"
+#include "hs-util-arena.h"
+#include "hs-util-json.h"
+#include "hs-util-image-store.h"
+#include "hs-util-thumbnail.h"
+#include "hs-util-upload-quota.h"
+
+/*
+ * Resumable uploads, in the manner of the tus protocol:
+ *   POST   /api/uploads       creates a session, Upload-Length is required
+ *   HEAD   /api/uploads/{id}  reports the stored Upload-Offset
+ *   PATCH  /api/uploads/{id}  appends the body at Upload-Offset
+ *   POST   /api/uploads/{id}  finalizes a complete upload into the store
+ *   DELETE /api/uploads/{id}  drops the session
+ * Sessions are files in the app data directory, so they survive server
+ * restarts, the partial data is kept next to the images.
+ */
+
+#define API_UPLOADS "/api/uploads"
+#define UPLOADS_SESSION_DIR_NAME "upload-sessions"
+#define UPLOADS_SESSION_GROUP "session"
+#define UPLOADS_SESSION_EXPIRY_US (G_GINT64_CONSTANT(24 * 60 * 60) * G_USEC_PER_SEC)
+#define UPLOADS_EXPIRE_INTERVAL_SEC (60 * 60)
+#define UPLOADS_PATCH_TYPE "application/offset+octet-stream"
+
+/* libsoup has no interned PATCH method */
+#define UPLOADS_METHOD_PATCH "PATCH"
+
+#define UPLOADS_MAX_LENGTH (32 * 1024 * 1024)
+
+/* open sessions hold their Upload-Length of storage, in all and per host */
+#define UPLOADS_MAX_SESSIONS 32
+#define UPLOADS_MAX_TOTAL_LENGTH (256 * 1024 * 1024)
+#define UPLOADS_HOST_MAX_SESSIONS 4
+#define UPLOADS_HOST_MAX_LENGTH (64 * 1024 * 1024)
+
+/* outlives the route when the server is destroyed with sessions busy */
+struct uploads_data {
+	gint ref;
+	char *sessions_dir;
+	GHashTable *busy;
+	guint expire_source;
+};
+
+struct uploads_usage {
+	guint sessions;
+	goffset length;
+	guint host_sessions;
+	goffset host_length;
+};
+
+struct upload_session {
+	struct uploads_data *uploads;
+	char *id;
+	char *info_path;
+	char *tmp_path;
+	goffset length;
+	int storage_id;
+	char *host;
+	char *filename;
+	char *type;
+
+	SoupMessage *msg;
+	struct util_image_store_file *file;
+	goffset offset;
+	guint error_status;
+	gboolean draining;
+	gboolean msg_finished;
+};
+
+static struct uploads_data *__uploads_data_ref(struct uploads_data *uploads)
+{
+	g_atomic_int_inc(&uploads->ref);
+
+	return uploads;
+}
+
+static void __uploads_data_unref(gpointer data)
+{
+	struct uploads_data *uploads = data;
+
+	if (!g_atomic_int_dec_and_test(&uploads->ref))
+		return;
+
+	if (uploads->expire_source)
+		g_source_remove(uploads->expire_source);
+	g_hash_table_destroy(uploads->busy);
+	g_free(uploads->sessions_dir);
+	g_free(uploads);
+}
+
+static guint __errno_to_status(int err)
+{
+	if (err == ENOSPC || err == EDQUOT)
+		return SOUP_STATUS_INSUFFICIENT_STORAGE;
+
+	return SOUP_STATUS_INTERNAL_SERVER_ERROR;
+}
+
+static gboolean __session_id_is_valid(const char *id)
+{
+	guint i = 0;
+
+	for (i = 0; id[i]; i++) {
+		if (!g_ascii_isxdigit(id[i]) || g_ascii_isupper(id[i]))
+			return FALSE;
+	}
+
+	return i == 32;
+}
+
+static char *__session_id_new(void)
+{
+	return g_strdup_printf("%08x%08x%08x%08x", g_random_int(),
+				g_random_int(), g_random_int(), g_random_int());
+}
+
+static char *__session_info_path(struct uploads_data *uploads, const char *id)
+{
+	char *name = g_strconcat(id, ".ini", NULL);
+	char *path = g_build_filename(uploads->sessions_dir, name, NULL);
+
+	g_free(name);
+
+	return path;
+}
+
+static void __session_free(struct upload_session *session)
+{
+	__uploads_data_unref(session->uploads);
+	g_free(session->id);
+	g_free(session->info_path);
+	g_free(session->tmp_path);
+	g_free(session->host);
+	g_free(session->filename);
+	g_free(session->type);
+	g_free(session);
+}
+
+static struct upload_session *__session_load(struct uploads_data *uploads,
+						const char *id)
+{
+	struct upload_session *session = NULL;
+	GKeyFile *key_file = NULL;
+	char *info_path = NULL;
+
+	if (!id || !__session_id_is_valid(id))
+		return NULL;
+
+	info_path = __session_info_path(uploads, id);
+	key_file = g_key_file_new();
+	if (!g_key_file_load_from_file(key_file, info_path, G_KEY_FILE_NONE, NULL)) {
+		g_key_file_unref(key_file);
+		g_free(info_path);
+		return NULL;
+	}
+
+	session = g_new0(struct upload_session, 1);
+	session->uploads = __uploads_data_ref(uploads);
+	session->id = g_strdup(id);
+	session->info_path = info_path;
+	session->tmp_path = g_key_file_get_string(key_file,
+					UPLOADS_SESSION_GROUP, "tmpPath", NULL);
+	session->length = g_key_file_get_int64(key_file,
+					UPLOADS_SESSION_GROUP, "length", NULL);
+	session->storage_id = g_key_file_get_integer(key_file,
+					UPLOADS_SESSION_GROUP, "storageId", NULL);
+	session->host = g_key_file_get_string(key_file,
+					UPLOADS_SESSION_GROUP, "host", NULL);
+	session->filename = g_key_file_get_string(key_file,
+					UPLOADS_SESSION_GROUP, "filename", NULL);
+	session->type = g_key_file_get_string(key_file,
+					UPLOADS_SESSION_GROUP, "type", NULL);
+	g_key_file_unref(key_file);
+
+	if (!session->tmp_path) {
+		_E("broken upload session [%s]", id);
+		__session_free(session);
+		return NULL;
+	}
+
+	return session;
+}
+
+static int __session_save(struct upload_session *session)
+{
+	GKeyFile *key_file = g_key_file_new();
+	GError *error = NULL;
+
+	g_key_file_set_string(key_file, UPLOADS_SESSION_GROUP,
+				"tmpPath", session->tmp_path);
+	g_key_file_set_int64(key_file, UPLOADS_SESSION_GROUP,
+				"length", session->length);
+	g_key_file_set_integer(key_file, UPLOADS_SESSION_GROUP,
+				"storageId", session->storage_id);
+	g_key_file_set_int64(key_file, UPLOADS_SESSION_GROUP,
+				"created", g_get_real_time());
+	if (session->host)
+		g_key_file_set_string(key_file, UPLOADS_SESSION_GROUP,
+					"host", session->host);
+	if (session->filename)
+		g_key_file_set_string(key_file, UPLOADS_SESSION_GROUP,
+					"filename", session->filename);
+	if (session->type)
+		g_key_file_set_string(key_file, UPLOADS_SESSION_GROUP,
+					"type", session->type);
+
+	if (!g_key_file_save_to_file(key_file, session->info_path, &error)) {
+		_E("failed to save upload session - %s", error->message);
+		g_error_free(error);
+		g_key_file_unref(key_file);
+		return -1;
+	}
+	g_key_file_unref(key_file);
+
+	return 0;
+}
+
+static void __session_remove(struct upload_session *session, gboolean keep_data)
+{
+	if (!keep_data)
+		g_unlink(session->tmp_path);
+	g_unlink(session->info_path);
+}
+
+/* what is written out so far, bytes still queued are not counted */
+static goffset __session_get_offset(struct upload_session *session)
+{
+	struct stat st;
+
+	if (stat(session->tmp_path, &st))
+		return -1;
+
+	return st.st_size;
+}
+
+static gboolean __session_is_busy(struct upload_session *session)
+{
+	return g_hash_table_contains(session->uploads->busy, session->id);
+}
+
+static void __session_set_busy(struct upload_session *session, gboolean busy)
+{
+	if (busy)
+		g_hash_table_add(session->uploads->busy, g_strdup(session->id));
+	else
+		g_hash_table_remove(session->uploads->busy, session->id);
+}
+
+static void __session_respond(SoupMessage *msg, struct upload_session *session,
+				goffset offset, guint status)
+{
+	struct util_arena *arena = http_server_message_get_arena(msg);
+	JsonBuilder *builder = NULL;
+	char *response_msg = NULL;
+	gsize resp_msg_size = 0;
+	char *value = NULL;
+
+	value = util_arena_strdup_printf(arena, "%" G_GOFFSET_FORMAT, offset);
+	if (value)
+		soup_message_headers_replace(msg->response_headers, "Upload-Offset", value);
+
+	value = util_arena_strdup_printf(arena, "%" G_GOFFSET_FORMAT, session->length);
+	if (value)
+		soup_message_headers_replace(msg->response_headers, "Upload-Length", value);
+
+	soup_message_headers_replace(msg->response_headers,
+					"Cache-Control", "no-store");
+
+	if (status == SOUP_STATUS_NO_CONTENT) {
+		soup_message_set_status(msg, status);
+		return;
+	}
+
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "id", session->id);
+	util_json_add_int(builder, "offset", offset);
+	util_json_add_int(builder, "length", session->length);
+	json_builder_end_object(builder);
+
+	response_msg = util_json_generate_str(builder, &resp_msg_size);
+	g_clear_pointer(&builder, g_object_unref);
+
+	soup_message_body_append(msg->response_body, SOUP_MEMORY_TAKE,
+					response_msg, resp_msg_size);
+
+	soup_message_headers_set_content_type(
+						msg->response_headers, "application/json", NULL);
+
+	soup_message_set_status(msg, status);
+}
+
+static void __session_reject(SoupMessage *msg, guint status)
+{
+	/* a body sent anyway is dropped as it comes */
+	soup_message_body_set_accumulate(msg->request_body, FALSE);
+	soup_message_headers_replace(msg->response_headers, "Connection", "close");
+	soup_message_set_status(msg, status);
+}
+
+static const char *__path_to_id(const char *path)
+{
+	if (!g_str_has_prefix(path, API_UPLOADS "/"))
+		return NULL;
+
+	return path + strlen(API_UPLOADS "/");
+}
+
+static gboolean __get_offset_header(SoupMessageHeaders *headers,
+					const char *name, goffset *offset)
+{
+	const char *value = soup_message_headers_get_one(headers, name);
+	char *end = NULL;
+	gint64 number = 0;
+
+	if (!value)
+		return FALSE;
+
+	errno = 0;
+	number = g_ascii_strtoll(value, &end, 10);
+	if (errno || end == value || *end || number < 0)
+		return FALSE;
+
+	*offset = number;
+
+	return TRUE;
+}
+
+static void __session_closed_cb(const char *id, const char *path,
+				gboolean duplicate, int error, gpointer user_data)
+{
+	struct upload_session *session = user_data;
+	SoupMessage *msg = session->msg;
+
+	if (msg) {
+		if (session->msg_finished) {
+			_D("PATCH of [%s] is gone before its response", session->id);
+		} else if (error) {
+			soup_message_set_status(msg, __errno_to_status(error));
+		} else if (session->error_status) {
+			soup_message_set_status(msg, session->error_status);
+		} else {
+			__session_respond(msg, session, session->offset,
+					SOUP_STATUS_NO_CONTENT);
+		}
+
+		if (!session->msg_finished)
+			http_server_unpause_message(msg);
+
+		g_signal_handlers_disconnect_by_data(msg, session);
+		g_object_unref(msg);
+	}
+
+	/* written out now, the next PATCH may check its offset */
+	__session_set_busy(session, FALSE);
+	__session_free(session);
+}
+
+static void __session_close(struct upload_session *session, gboolean respond)
+{
+	/* the drained callback goes with the file */
+	session->draining = FALSE;
+
+	if (respond) {
+		g_object_ref(session->msg);
+		http_server_pause_message(session->msg);
+	} else {
+		g_signal_handlers_disconnect_by_data(session->msg, session);
+		session->msg = NULL;
+	}
+
+	util_image_store_file_close(session->file, __session_closed_cb, session);
+	session->file = NULL;
+}
+
+static void __session_drained_cb(gpointer user_data)
+{
+	struct upload_session *session = user_data;
+
+	session->draining = FALSE;
+	if (!session->msg_finished)
+		http_server_unpause_message(session->msg);
+}
+
+static void __patch_got_chunk_cb(SoupMessage *msg, SoupBuffer *chunk,
+				gpointer user_data)
+{
+	struct upload_session *session = user_data;
+	int err = 0;
+
+	if (session->error_status)
+		return;
+
+	if (session->offset + (goffset)chunk->length > session->length) {
+		_E("PATCH of [%s] goes beyond its length", session->id);
+		session->error_status = SOUP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+		return;
+	}
+
+	err = util_image_store_file_write(session->file, chunk->data, chunk->length);
+	if (err) {
+		session->error_status = __errno_to_status(err);
+		return;
+	}
+	session->offset += chunk->length;
+
+	/* reading is paused while the I/O thread is behind */
+	if (!session->draining
+		&& util_image_store_file_wait_drained(session->file,
+						__session_drained_cb, session)) {
+		session->draining = TRUE;
+		http_server_pause_message(msg);
+	}
+}
+
+static void __patch_finished_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct upload_session *session = user_data;
+
+	session->msg_finished = TRUE;
+
+	/* the body was cut short, what arrived is kept for the retry */
+	if (session->file) {
+		_D("PATCH of [%s] is aborted at [%" G_GOFFSET_FORMAT "]",
+			session->id, session->offset);
+		__session_close(session, FALSE);
+	}
+}
+
+/*
+ * Checks a PATCH before its body is read, so it is rejected early. A
+ * client which sent "Expect: 100-continue" is at 100 Continue here, a
+ * status set instead is sent in its place and the chunk never comes.
+ */
+static void route_api_uploads_headers_callback(SoupMessage *msg,
+						const char *path, SoupClientContext *client,
+						gpointer user_data)
+{
+	struct uploads_data *uploads = user_data;
+	struct upload_session *session = NULL;
+	const char *content_type = NULL;
+	goffset offset = 0;
+	goffset current = 0;
+	guint status = SOUP_STATUS_OK;
+
+	if (g_strcmp0(msg->method, UPLOADS_METHOD_PATCH))
+		return;
+
+	/* anything else is a final answer already */
+	if (msg->status_code != SOUP_STATUS_NONE
+		&& msg->status_code != SOUP_STATUS_CONTINUE)
+		return;
+
+	session = __session_load(uploads, __path_to_id(path));
+	if (!session) {
+		__session_reject(msg, SOUP_STATUS_NOT_FOUND);
+		return;
+	}
+
+	content_type = soup_message_headers_get_content_type(msg->request_headers, NULL);
+	current = __session_get_offset(session);
+
+	if (g_strcmp0(content_type, UPLOADS_PATCH_TYPE))
+		status = SOUP_STATUS_UNSUPPORTED_MEDIA_TYPE;
+	else if (!__get_offset_header(msg->request_headers, "Upload-Offset", &offset))
+		status = SOUP_STATUS_BAD_REQUEST;
+	else if (__session_is_busy(session) || current != offset)
+		status = SOUP_STATUS_CONFLICT;
+	else if (soup_message_headers_get_encoding(msg->request_headers)
+			== SOUP_ENCODING_CONTENT_LENGTH
+		&& offset + soup_message_headers_get_content_length(msg->request_headers)
+			> session->length)
+		status = SOUP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+
+	if (status == SOUP_STATUS_OK) {
+		session->file = util_image_store_file_resume(session->tmp_path);
+		if (!session->file)
+			status = SOUP_STATUS_INTERNAL_SERVER_ERROR;
+	}
+
+	if (status != SOUP_STATUS_OK) {
+		if (status == SOUP_STATUS_CONFLICT && current >= 0)
+			__session_respond(msg, session, current, status);
+		__session_reject(msg, status);
+		__session_free(session);
+		return;
+	}
+
+	session->msg = msg;
+	session->offset = offset;
+	__session_set_busy(session, TRUE);
+
+	soup_message_body_set_accumulate(msg->request_body, FALSE);
+
+	g_object_set_data(G_OBJECT(msg), API_UPLOADS, session);
+	g_signal_connect(msg, "got-chunk", G_CALLBACK(__patch_got_chunk_cb), session);
+	g_signal_connect(msg, "finished", G_CALLBACK(__patch_finished_cb), session);
+}
+
+/*
+ * Expires stale sessions and sums up the others, with those of host
+ * apart. Busy sessions are not expired, their data is being written.
+ */
+static void __uploads_scan(struct uploads_data *uploads, const char *host,
+				struct uploads_usage *usage)
+{
+	GDir *dir = NULL;
+	const char *name = NULL;
+	gint64 now = g_get_real_time();
+
+	dir = g_dir_open(uploads->sessions_dir, 0, NULL);
+	ret_if(!dir);
+
+	while ((name = g_dir_read_name(dir))) {
+		GKeyFile *key_file = NULL;
+		char *info_path = NULL;
+		char *id = NULL;
+		char *session_host = NULL;
+		gint64 created = 0;
+		goffset length = 0;
+
+		if (!g_str_has_suffix(name, ".ini"))
+			continue;
+
+		id = g_strndup(name, strlen(name) - strlen(".ini"));
+		if (g_hash_table_contains(uploads->busy, id)) {
+			g_free(id);
+			continue;
+		}
+		g_free(id);
+
+		key_file = g_key_file_new();
+		info_path = g_build_filename(uploads->sessions_dir, name, NULL);
+		if (g_key_file_load_from_file(key_file, info_path, G_KEY_FILE_NONE, NULL))
+			created = g_key_file_get_int64(key_file,
+						UPLOADS_SESSION_GROUP, "created", NULL);
+
+		if (now - created > UPLOADS_SESSION_EXPIRY_US) {
+			char *tmp_path = g_key_file_get_string(key_file,
+						UPLOADS_SESSION_GROUP, "tmpPath", NULL);
+
+			_D("upload session [%s] is expired", name);
+			if (tmp_path)
+				g_unlink(tmp_path);
+			g_unlink(info_path);
+			g_free(tmp_path);
+		} else if (usage) {
+			length = g_key_file_get_int64(key_file,
+						UPLOADS_SESSION_GROUP, "length", NULL);
+			session_host = g_key_file_get_string(key_file,
+						UPLOADS_SESSION_GROUP, "host", NULL);
+
+			usage->sessions++;
+			usage->length += length;
+			if (host && !g_strcmp0(host, session_host)) {
+				usage->host_sessions++;
+				usage->host_length += length;
+			}
+			g_free(session_host);
+		}
+
+		g_key_file_unref(key_file);
+		g_free(info_path);
+	}
+
+	g_dir_close(dir);
+}
+
+static gboolean __uploads_expire_cb(gpointer user_data)
+{
+	__uploads_scan(user_data, NULL, NULL);
+
+	return G_SOURCE_CONTINUE;
+}
+
+/* abandoned sessions hold storage too, so they count until they expire */
+static guint __uploads_check_usage(struct uploads_data *uploads,
+				const char *host, goffset length)
+{
+	struct uploads_usage usage = { 0, };
+
+	__uploads_scan(uploads, host, &usage);
+
+	if (usage.sessions >= UPLOADS_MAX_SESSIONS
+		|| usage.length + length > UPLOADS_MAX_TOTAL_LENGTH) {
+		_E("too many upload sessions - %u, %" G_GOFFSET_FORMAT " bytes",
+			usage.sessions, usage.length);
+		return SOUP_STATUS_INSUFFICIENT_STORAGE;
+	}
+
+	if (usage.host_sessions >= UPLOADS_HOST_MAX_SESSIONS
+		|| usage.host_length + length > UPLOADS_HOST_MAX_LENGTH) {
+		_E("[%s] has too many upload sessions - %u, %" G_GOFFSET_FORMAT
+			" bytes", host, usage.host_sessions, usage.host_length);
+		return SOUP_STATUS_INSUFFICIENT_STORAGE;
+	}
+
+	/* reserved in full, as the multipart route charges what it stores */
+	if (!util_upload_quota_check(host, length))
+		return SOUP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+
+	return SOUP_STATUS_OK;
+}
+
+static void __uploads_create(SoupMessage *msg, struct uploads_data *uploads,
+				GHashTable *query, const char *host)
+{
+	struct upload_session *session = NULL;
+	struct util_image_store_file *file = NULL;
+	const char *storage_str = NULL;
+	char *location = NULL;
+	char *dir = NULL;
+	goffset length = 0;
+	int storage_id = UTIL_IMAGE_STORE_DEFAULT_STORAGE;
+	guint status = SOUP_STATUS_OK;
+
+	if (!__get_offset_header(msg->request_headers, "Upload-Length", &length)) {
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	if (length > UPLOADS_MAX_LENGTH) {
+		soup_message_set_status(msg, SOUP_STATUS_REQUEST_ENTITY_TOO_LARGE);
+		return;
+	}
+
+	if (query)
+		storage_str = g_hash_table_lookup(query, "storageId");
+	if (!util_image_store_parse_storage_id(storage_str, &storage_id)) {
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	status = __uploads_check_usage(uploads, host, length);
+	if (status != SOUP_STATUS_OK) {
+		soup_message_set_status(msg, status);
+		return;
+	}
+
+	dir = util_image_store_get_dir(storage_id);
+	if (!dir) {
+		soup_message_set_status(msg, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	/* partial data is next to the images, finalizing is a rename */
+	file = util_image_store_file_new(dir);
+	g_free(dir);
+	if (!file) {
+		soup_message_set_status(msg, SOUP_STATUS_INSUFFICIENT_STORAGE);
+		return;
+	}
+
+	session = g_new0(struct upload_session, 1);
+	session->uploads = __uploads_data_ref(uploads);
+	session->id = __session_id_new();
+	session->info_path = __session_info_path(uploads, session->id);
+	session->tmp_path = g_strdup(util_image_store_file_get_temp_path(file));
+	session->length = length;
+	session->storage_id = storage_id;
+	session->host = g_strdup(host);
+	if (query) {
+		session->filename = g_strdup(g_hash_table_lookup(query, "filename"));
+		session->type = g_strdup(g_hash_table_lookup(query, "type"));
+	}
+	util_image_store_file_close(file, NULL, NULL);
+
+	if (__session_save(session)) {
+		__session_remove(session, FALSE);
+		__session_free(session);
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		return;
+	}
+
+	util_upload_quota_charge(host, length);
+
+	_D("upload session [%s] for [%" G_GOFFSET_FORMAT "] bytes",
+		session->id, length);
+
+	location = util_arena_strconcat(http_server_message_get_arena(msg),
+				API_UPLOADS "/", session->id, NULL);
+	if (location)
+		soup_message_headers_replace(msg->response_headers, "Location", location);
+
+	__session_respond(msg, session, 0, SOUP_STATUS_CREATED);
+	__session_free(session);
+}
+
+static void __session_committed_cb(const char *id, const char *path,
+				gboolean duplicate, int error, gpointer user_data)
+{
+	struct upload_session *session = user_data;
+	SoupMessage *msg = session->msg;
+	JsonBuilder *builder = NULL;
+	char *response_msg = NULL;
+	gsize resp_msg_size = 0;
+
+	if (!error) {
+		__session_remove(session, TRUE);
+		if (!duplicate)
+			util_thumbnail_generate(path, id, 0, NULL, NULL);
+	}
+
+	if (session->msg_finished)
+		goto OUT;
+
+	if (error) {
+		_E("failed to finalize [%s] - %s", session->id, g_strerror(error));
+		soup_message_set_status(msg, __errno_to_status(error));
+		http_server_unpause_message(msg);
+		goto OUT;
+	}
+
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "id", id);
+	util_json_add_str(builder, "filename", session->filename);
+	util_json_add_str(builder, "type", session->type);
+	util_json_add_int(builder, "size", session->length);
+	util_json_add_int(builder, "storageId", session->storage_id);
+	util_json_add_bool(builder, "duplicate", duplicate);
+	json_builder_end_object(builder);
+
+	response_msg = util_json_generate_str(builder, &resp_msg_size);
+	g_clear_pointer(&builder, g_object_unref);
+
+	soup_message_body_append(msg->response_body, SOUP_MEMORY_TAKE,
+					response_msg, resp_msg_size);
+
+	soup_message_headers_set_content_type(
+						msg->response_headers, "application/json", NULL);
+
+	soup_message_set_status(msg, SOUP_STATUS_OK);
+	http_server_unpause_message(msg);
+
+OUT:
+	g_signal_handlers_disconnect_by_data(msg, session);
+	g_object_unref(msg);
+	__session_set_busy(session, FALSE);
+	__session_free(session);
+}
+
+static void __finalize_finished_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct upload_session *session = user_data;
+
+	session->msg_finished = TRUE;
+}
+
+static void __uploads_finalize(SoupMessage *msg, struct upload_session *session)
+{
+	struct util_image_store_file *file = NULL;
+	goffset offset = __session_get_offset(session);
+
+	if (__session_is_busy(session) || offset != session->length) {
+		__session_respond(msg, session, MAX(offset, 0), SOUP_STATUS_CONFLICT);
+		__session_free(session);
+		return;
+	}
+
+	file = util_image_store_file_resume(session->tmp_path);
+	if (!file) {
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		__session_free(session);
+		return;
+	}
+
+	session->msg = g_object_ref(msg);
+	__session_set_busy(session, TRUE);
+	g_signal_connect(msg, "finished", G_CALLBACK(__finalize_finished_cb), session);
+
+	http_server_pause_message(msg);
+	util_image_store_file_commit(file, session->type,
+				__session_committed_cb, session);
+}
+
+static void route_api_uploads_callback(SoupMessage *msg,
+					const char *path, GHashTable *query,
+					SoupClientContext *client, gpointer user_data)
+{
+	struct uploads_data *uploads = user_data;
+	struct upload_session *session = NULL;
+	const char *id = __path_to_id(path);
+
+	if (!g_strcmp0(msg->method, UPLOADS_METHOD_PATCH)) {
+		session = g_object_get_data(G_OBJECT(msg), API_UPLOADS);
+		if (!session || !session->file) {
+			soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+			return;
+		}
+		__session_close(session, TRUE);
+		return;
+	}
+
+	if (!id) {
+		if (msg->method == SOUP_METHOD_POST)
+			__uploads_create(msg, uploads, query,
+					soup_client_context_get_host(client));
+		else
+			soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+		return;
+	}
+
+	session = __session_load(uploads, id);
+	if (!session) {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+		return;
+	}
+
+	if (msg->method == SOUP_METHOD_GET || msg->method == SOUP_METHOD_HEAD) {
+		__session_respond(msg, session, MAX(__session_get_offset(session), 0),
+				SOUP_STATUS_OK);
+	} else if (msg->method == SOUP_METHOD_POST) {
+		__uploads_finalize(msg, session);
+		return;
+	} else if (msg->method == SOUP_METHOD_DELETE) {
+		if (__session_is_busy(session)) {
+			soup_message_set_status(msg, SOUP_STATUS_CONFLICT);
+		} else {
+			__session_remove(session, FALSE);
+			soup_message_set_status(msg, SOUP_STATUS_NO_CONTENT);
+		}
+	} else {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
+	}
+
+	__session_free(session);
+}
+
+int hs_route_api_uploads_init(void)
+{
+	struct uploads_data *uploads = NULL;
+	char *data_path = NULL;
+	int ret = 0;
+
+	data_path = app_get_data_path();
+	retvm_if(!data_path, -1, "failed to get data path");
+
+	uploads = g_new0(struct uploads_data, 1);
+	uploads->ref = 1;
+	uploads->sessions_dir = g_build_filename(data_path,
+					UPLOADS_SESSION_DIR_NAME, NULL);
+	uploads->busy = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	g_free(data_path);
+
+	if (g_mkdir_with_parents(uploads->sessions_dir, 0700)) {
+		_E("failed to create [%s] - %s", uploads->sessions_dir, g_strerror(errno));
+		__uploads_data_unref(uploads);
+		return -1;
+	}
+
+	/* the server lives as long as the app, sessions are swept as it runs */
+	__uploads_scan(uploads, NULL, NULL);
+	uploads->expire_source = g_timeout_add_seconds(UPLOADS_EXPIRE_INTERVAL_SEC,
+						__uploads_expire_cb, uploads);
+
+	/* the headers handler owns the route reference */
+	ret = http_server_route_headers_handler_add(API_UPLOADS,
+				route_api_uploads_headers_callback,
+				uploads, __uploads_data_unref);
+	if (ret) {
+		__uploads_data_unref(uploads);
+		return -1;
+	}
+
+	ret = http_server_route_handler_add(API_UPLOADS,
+				route_api_uploads_callback, uploads, NULL);
+	retv_if(ret, -1);
+
+	/* refused sessions are simply resumed later */
+	return http_server_route_cost_set(API_UPLOADS, HTTP_SERVER_ROUTE_COST_HIGH);
+}
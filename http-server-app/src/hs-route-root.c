@@ -25,6 +25,9 @@
 #include <app_common.h>
 #include "http-server-log-private.h"
 #include "http-server-route.h"
+#include "hs-util-arena.h"
+
+static char *res_path;
 
 static int serve_file(const char *file, SoupMessage *msg, guint *status_code)
 {
@@ -75,9 +78,12 @@ get_static_contents(SoupMessage *msg, const char *path)
 	if (S_ISDIR(st.st_mode)) {
 		if (!soup_message_get_uri(msg)->path
 			|| (0 == strncmp("/", soup_message_get_uri(msg)->path, 2))) {
-			char *index_path = g_strdup_printf("%sindex.html", path);
-			serve_file(index_path, msg, &status_code);
-			g_free(index_path);
+			char *index_path = util_arena_strconcat(
+					http_server_message_get_arena(msg), path, "index.html", NULL);
+			if (index_path)
+				serve_file(index_path, msg, &status_code);
+			else
+				status_code = SOUP_STATUS_INTERNAL_SERVER_ERROR;
 		} else {
 			// DO NOT use code 403
 			_E("dir[%s] is not for serve", path);
@@ -94,23 +100,32 @@ static void route_root_callback(SoupMessage *msg,
 					SoupClientContext *client, gpointer user_data)
 {
 	char *file_path = NULL;
-	char *res_path = NULL;
 
 	if (msg->method != SOUP_METHOD_GET) {
 		soup_message_set_status(msg, SOUP_STATUS_NOT_IMPLEMENTED);
 		return;
 	}
-	res_path = app_get_resource_path();
-	file_path = g_strdup_printf("%spublic%s", res_path, path ? path : "/");
-	g_clear_pointer(&res_path, g_free);
+
+	file_path = util_arena_strconcat(http_server_message_get_arena(msg),
+				res_path, "public", path ? path : "/", NULL);
+	if (!file_path) {
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+		return;
+	}
 
 	get_static_contents(msg, file_path);
-	g_free(file_path);
 }
 
 int hs_route_root_init(void)
 {
-	int ret = http_server_auth_default_realm_path_add("/");
+	int ret = 0;
+
+	/* the same for the lifetime of the app */
+	if (!res_path)
+		res_path = app_get_resource_path();
+	retvm_if(!res_path, -1, "failed to app_get_resource_path()");
+
+	ret = http_server_auth_default_realm_path_add("/");
 	retv_if(ret, ret);
 
 	return http_server_route_handler_add(NULL, route_root_callback, NULL, NULL);
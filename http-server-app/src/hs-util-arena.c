@@ -0,0 +1,220 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <stdarg.h>
+#include <string.h>
+#include "http-server-log-private.h"
+#include "hs-util-arena.h"
+
+/* the first chunk comes with the arena, most requests need no other */
+#define ARENA_FIRST_CHUNK_SIZE 2048
+#define ARENA_MAX_CHUNK_SIZE (32 * 1024)
+#define ARENA_ALIGN (2 * sizeof(void *))
+
+struct arena_chunk {
+	struct arena_chunk *next;
+	gsize size;
+	gsize used;
+	char data[] __attribute__((aligned(2 * sizeof(void *))));
+};
+
+struct util_arena {
+	struct arena_chunk *chunks;
+	gsize used;
+	gsize size;
+	struct arena_chunk first;
+};
+
+#define ARENA_ALIGN_UP(n) (((n) + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1))
+
+struct util_arena *util_arena_new(void)
+{
+	struct util_arena *arena = NULL;
+
+	arena = g_try_malloc(sizeof(*arena) + ARENA_FIRST_CHUNK_SIZE);
+	retvm_if(!arena, NULL, "failed to alloc arena");
+
+	arena->first.next = NULL;
+	arena->first.size = ARENA_FIRST_CHUNK_SIZE;
+	arena->first.used = 0;
+	arena->chunks = &arena->first;
+	arena->used = 0;
+	arena->size = sizeof(*arena) + ARENA_FIRST_CHUNK_SIZE;
+
+	return arena;
+}
+
+void util_arena_free(struct util_arena *arena)
+{
+	struct arena_chunk *chunk = NULL;
+	struct arena_chunk *next = NULL;
+
+	ret_if(!arena);
+
+	for (chunk = arena->chunks; chunk; chunk = next) {
+		next = chunk->next;
+		if (chunk != &arena->first)
+			g_free(chunk);
+	}
+	g_free(arena);
+}
+
+static struct arena_chunk *__arena_chunk_add(struct util_arena *arena, gsize size)
+{
+	struct arena_chunk *chunk = NULL;
+	gsize chunk_size = MIN(arena->chunks->size * 2, ARENA_MAX_CHUNK_SIZE);
+
+	/* a big one gets a chunk of its own */
+	chunk_size = MAX(chunk_size, ARENA_ALIGN_UP(size));
+
+	chunk = g_try_malloc(sizeof(*chunk) + chunk_size);
+	retvm_if(!chunk, NULL, "failed to alloc arena chunk of [%zu]", chunk_size);
+
+	chunk->size = chunk_size;
+	chunk->used = 0;
+	arena->size += sizeof(*chunk) + chunk_size;
+
+	/* keeps filling the current chunk if the big one fills the new */
+	if (chunk_size > ARENA_MAX_CHUNK_SIZE) {
+		chunk->next = arena->chunks->next;
+		arena->chunks->next = chunk;
+	} else {
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+
+	return chunk;
+}
+
+gpointer util_arena_alloc(struct util_arena *arena, gsize size)
+{
+	struct arena_chunk *chunk = NULL;
+	gpointer ptr = NULL;
+
+	retv_if(!arena, NULL);
+
+	size = ARENA_ALIGN_UP(MAX(size, 1));
+	chunk = arena->chunks;
+	if (chunk->size - chunk->used < size) {
+		chunk = __arena_chunk_add(arena, size);
+		if (!chunk)
+			return NULL;
+	}
+
+	ptr = chunk->data + chunk->used;
+	chunk->used += size;
+	arena->used += size;
+
+	return ptr;
+}
+
+char *util_arena_strdup(struct util_arena *arena, const char *str)
+{
+	gsize len = 0;
+	char *dup = NULL;
+
+	retv_if(!str, NULL);
+
+	len = strlen(str);
+	dup = util_arena_alloc(arena, len + 1);
+	if (dup)
+		memcpy(dup, str, len + 1);
+
+	return dup;
+}
+
+char *util_arena_strconcat(struct util_arena *arena, const char *str, ...)
+{
+	const char *s = NULL;
+	char *result = NULL;
+	char *p = NULL;
+	gsize len = 0;
+	va_list args;
+
+	retv_if(!str, NULL);
+
+	va_start(args, str);
+	for (s = str; s; s = va_arg(args, const char *))
+		len += strlen(s);
+	va_end(args);
+
+	result = util_arena_alloc(arena, len + 1);
+	retv_if(!result, NULL);
+
+	p = result;
+	va_start(args, str);
+	for (s = str; s; s = va_arg(args, const char *))
+		p = g_stpcpy(p, s);
+	va_end(args);
+
+	return result;
+}
+
+char *util_arena_strdup_vprintf(struct util_arena *arena,
+				const char *fmt, va_list args)
+{
+	struct arena_chunk *chunk = NULL;
+	char *str = NULL;
+	va_list copy;
+	int len = 0;
+
+	retv_if(!arena, NULL);
+	retv_if(!fmt, NULL);
+
+	/* formats right into the free end of the chunk, once if it fits */
+	chunk = arena->chunks;
+	va_copy(copy, args);
+	len = g_vsnprintf(chunk->data + chunk->used, chunk->size - chunk->used,
+				fmt, copy);
+	va_end(copy);
+	retv_if(len < 0, NULL);
+
+	if ((gsize)len < chunk->size - chunk->used)
+		return util_arena_alloc(arena, len + 1);
+
+	str = util_arena_alloc(arena, len + 1);
+	if (str)
+		g_vsnprintf(str, len + 1, fmt, args);
+
+	return str;
+}
+
+char *util_arena_strdup_printf(struct util_arena *arena, const char *fmt, ...)
+{
+	char *str = NULL;
+	va_list args;
+
+	va_start(args, fmt);
+	str = util_arena_strdup_vprintf(arena, fmt, args);
+	va_end(args);
+
+	return str;
+}
+
+gsize util_arena_get_used(struct util_arena *arena)
+{
+	retv_if(!arena, 0);
+
+	return arena->used;
+}
+
+gsize util_arena_get_size(struct util_arena *arena)
+{
+	retv_if(!arena, 0);
+
+	return arena->size;
+}
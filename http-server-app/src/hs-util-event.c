@@ -0,0 +1,399 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <json-glib/json-glib.h>
+#include <net_connection.h>
+#include <storage.h>
+#include <app_manager.h>
+#include "http-server-log-private.h"
+#include "hs-util-json.h"
+#include "hs-util-event.h"
+
+#define EVENT_COALESCE_MS 200
+#define EVENT_HISTORY_SIZE 128
+
+struct event_pending {
+	char *type;
+	char *key;
+	char *data;
+};
+
+struct event_item {
+	guint64 id;
+	char *type;
+	char *data;
+};
+
+struct event_listener {
+	guint id;
+	util_event_listener_cb callback;
+	gpointer user_data;
+};
+
+struct event_hub {
+	gboolean initialized;
+	guint64 last_id;
+	struct event_item history[EVENT_HISTORY_SIZE];
+	GHashTable *pending_table;
+	GQueue pending_queue;
+	guint flush_source;
+	GList *listeners;
+	guint last_listener_id;
+
+	connection_h conn_h;
+	GList *storage_ids;
+};
+
+static struct event_hub hub;
+
+static void __event_pending_free(struct event_pending *pending)
+{
+	g_free(pending->type);
+	g_free(pending->key);
+	g_free(pending->data);
+	g_free(pending);
+}
+
+static void __event_item_clear(struct event_item *item)
+{
+	g_clear_pointer(&item->type, g_free);
+	g_clear_pointer(&item->data, g_free);
+	item->id = 0;
+}
+
+static void __event_dispatch(const struct util_event *event)
+{
+	GList *l = hub.listeners;
+
+	while (l) {
+		struct event_listener *listener = l->data;
+		l = l->next;
+		listener->callback(event, listener->user_data);
+	}
+}
+
+static gboolean __event_flush(gpointer data)
+{
+	struct event_pending *pending = NULL;
+
+	hub.flush_source = 0;
+
+	while ((pending = g_queue_pop_head(&hub.pending_queue))) {
+		struct event_item *item = NULL;
+		struct util_event event;
+		char *pending_key = g_strconcat(pending->type, "/", pending->key, NULL);
+
+		g_hash_table_remove(hub.pending_table, pending_key);
+		g_free(pending_key);
+
+		hub.last_id++;
+		item = &hub.history[hub.last_id % EVENT_HISTORY_SIZE];
+		__event_item_clear(item);
+
+		item->id = hub.last_id;
+		item->type = pending->type;
+		item->data = pending->data;
+		pending->type = NULL;
+		pending->data = NULL;
+		__event_pending_free(pending);
+
+		event.id = item->id;
+		event.type = item->type;
+		event.data = item->data;
+		__event_dispatch(&event);
+	}
+
+	return G_SOURCE_REMOVE;
+}
+
+void util_event_publish(const char *type, const char *key, char *data)
+{
+	struct event_pending *pending = NULL;
+	char *pending_key = NULL;
+
+	if (!hub.initialized || !type || !data) {
+		g_free(data);
+		return;
+	}
+
+	pending_key = g_strconcat(type, "/", key ? key : "", NULL);
+	pending = g_hash_table_lookup(hub.pending_table, pending_key);
+	if (pending) {
+		/* keep the queue position, only the latest state matters */
+		g_free(pending->data);
+		pending->data = data;
+		g_free(pending_key);
+		return;
+	}
+
+	pending = g_new0(struct event_pending, 1);
+	pending->type = g_strdup(type);
+	pending->key = g_strdup(key ? key : "");
+	pending->data = data;
+
+	g_hash_table_insert(hub.pending_table, pending_key, pending);
+	g_queue_push_tail(&hub.pending_queue, pending);
+
+	if (!hub.flush_source)
+		hub.flush_source = g_timeout_add(EVENT_COALESCE_MS, __event_flush, NULL);
+}
+
+guint util_event_listener_add(util_event_listener_cb callback, gpointer user_data)
+{
+	struct event_listener *listener = NULL;
+
+	retv_if(!hub.initialized, 0);
+	retv_if(!callback, 0);
+
+	listener = g_try_new0(struct event_listener, 1);
+	retvm_if(!listener, 0, "failed to alloc event_listener");
+
+	listener->id = ++hub.last_listener_id;
+	listener->callback = callback;
+	listener->user_data = user_data;
+	hub.listeners = g_list_append(hub.listeners, listener);
+
+	return listener->id;
+}
+
+void util_event_listener_remove(guint listener_id)
+{
+	GList *l = NULL;
+
+	for (l = hub.listeners; l; l = l->next) {
+		struct event_listener *listener = l->data;
+		if (listener->id == listener_id) {
+			hub.listeners = g_list_delete_link(hub.listeners, l);
+			g_free(listener);
+			return;
+		}
+	}
+}
+
+guint64 util_event_get_last_id(void)
+{
+	return hub.last_id;
+}
+
+gboolean util_event_foreach_since(guint64 last_id,
+				util_event_listener_cb callback, gpointer user_data)
+{
+	guint64 first_id = 0;
+	guint64 id = 0;
+	gboolean complete = TRUE;
+
+	retv_if(!callback, FALSE);
+
+	if (last_id > hub.last_id)
+		return FALSE;
+
+	if (hub.last_id > EVENT_HISTORY_SIZE)
+		first_id = hub.last_id - EVENT_HISTORY_SIZE + 1;
+	else
+		first_id = 1;
+
+	if (last_id + 1 < first_id)
+		complete = FALSE;
+
+	for (id = MAX(last_id + 1, first_id); id <= hub.last_id; id++) {
+		struct event_item *item = &hub.history[id % EVENT_HISTORY_SIZE];
+		struct util_event event;
+
+		event.id = item->id;
+		event.type = item->type;
+		event.data = item->data;
+		callback(&event, user_data);
+	}
+
+	return complete;
+}
+
+static const char *__conn_type_to_str(connection_type_e type)
+{
+	switch (type) {
+	case CONNECTION_TYPE_DISCONNECTED:
+		return "disconnected";
+	case CONNECTION_TYPE_WIFI:
+		return "wifi";
+	case CONNECTION_TYPE_CELLULAR:
+		return "cellular";
+	case CONNECTION_TYPE_ETHERNET:
+		return "ethernet";
+	case CONNECTION_TYPE_BT:
+		return "bluetooth";
+	case CONNECTION_TYPE_NET_PROXY:
+		return "net proxy";
+	default:
+		return "unknown";
+	}
+}
+
+static const char *__storage_state_to_str(storage_state_e state)
+{
+	switch (state) {
+	case STORAGE_STATE_UNMOUNTABLE:
+		return "Unmountable";
+	case STORAGE_STATE_REMOVED:
+		return "Removed";
+	case STORAGE_STATE_MOUNTED:
+		return "Mounted";
+	case STORAGE_STATE_MOUNTED_READ_ONLY:
+		return "Mounted RO";
+	default:
+		return "Unknown";
+	}
+}
+
+static void __conn_type_changed_cb(connection_type_e type, void *user_data)
+{
+	JsonBuilder *builder = json_builder_new();
+
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "connection_type", __conn_type_to_str(type));
+	json_builder_end_object(builder);
+
+	util_event_publish(UTIL_EVENT_TYPE_CONNECTION, NULL,
+			util_json_generate_str(builder, NULL));
+	g_object_unref(builder);
+}
+
+static void __storage_state_changed_cb(int storage_id,
+				storage_state_e state, void *user_data)
+{
+	JsonBuilder *builder = json_builder_new();
+	char key[16];
+
+	json_builder_begin_object(builder);
+	util_json_add_int(builder, "id", storage_id);
+	util_json_add_str(builder, "state", __storage_state_to_str(state));
+	json_builder_end_object(builder);
+
+	g_snprintf(key, sizeof(key), "%d", storage_id);
+	util_event_publish(UTIL_EVENT_TYPE_STORAGE, key,
+			util_json_generate_str(builder, NULL));
+	g_object_unref(builder);
+}
+
+static bool __storage_device_cb(int storage_id, storage_type_e type,
+			storage_state_e state, const char *path, void *user_data)
+{
+	int ret = storage_set_state_changed_cb(storage_id,
+					__storage_state_changed_cb, NULL);
+	if (ret == STORAGE_ERROR_NONE)
+		hub.storage_ids = g_list_prepend(hub.storage_ids,
+						GINT_TO_POINTER(storage_id));
+	else
+		_W("failed to watch storage[%d] - %d", storage_id, ret);
+
+	return true;
+}
+
+static void __app_context_event_cb(app_context_h app_context,
+				app_context_event_e event, void *user_data)
+{
+	JsonBuilder *builder = NULL;
+	char *app_id = NULL;
+	int pid = 0;
+
+	app_context_get_app_id(app_context, &app_id);
+	ret_if(!app_id);
+	app_context_get_pid(app_context, &pid);
+
+	builder = json_builder_new();
+	json_builder_begin_object(builder);
+	util_json_add_str(builder, "appId", app_id);
+	util_json_add_str(builder, "event",
+		event == APP_CONTEXT_EVENT_LAUNCHED ? "launched" : "terminated");
+	if (pid > 0)
+		util_json_add_int(builder, "appPid", pid);
+	json_builder_end_object(builder);
+
+	util_event_publish(UTIL_EVENT_TYPE_APP, app_id,
+			util_json_generate_str(builder, NULL));
+	g_object_unref(builder);
+	g_free(app_id);
+}
+
+int util_event_init(void)
+{
+	int ret = 0;
+
+	if (hub.initialized)
+		return 0;
+
+	hub.pending_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, NULL);
+	g_queue_init(&hub.pending_queue);
+	hub.initialized = TRUE;
+
+	ret = connection_create(&hub.conn_h);
+	if (ret == CONNECTION_ERROR_NONE)
+		connection_set_type_changed_cb(hub.conn_h,
+					__conn_type_changed_cb, NULL);
+	else
+		_W("failed to watch connection type - %d", ret);
+
+	ret = storage_foreach_device_supported(__storage_device_cb, NULL);
+	if (ret != STORAGE_ERROR_NONE)
+		_W("failed to watch storages - %d", ret);
+
+	ret = app_manager_set_app_context_event_cb(__app_context_event_cb, NULL);
+	if (ret != APP_MANAGER_ERROR_NONE)
+		_W("failed to watch app context events - %d", ret);
+
+	return 0;
+}
+
+void util_event_fini(void)
+{
+	struct event_pending *pending = NULL;
+	GList *l = NULL;
+	int i = 0;
+
+	if (!hub.initialized)
+		return;
+
+	app_manager_unset_app_context_event_cb();
+
+	for (l = hub.storage_ids; l; l = l->next)
+		storage_unset_state_changed_cb(GPOINTER_TO_INT(l->data),
+						__storage_state_changed_cb);
+	g_clear_pointer(&hub.storage_ids, g_list_free);
+
+	if (hub.conn_h) {
+		connection_unset_type_changed_cb(hub.conn_h);
+		connection_destroy(hub.conn_h);
+		hub.conn_h = NULL;
+	}
+
+	if (hub.flush_source) {
+		g_source_remove(hub.flush_source);
+		hub.flush_source = 0;
+	}
+
+	while ((pending = g_queue_pop_head(&hub.pending_queue)))
+		__event_pending_free(pending);
+	g_clear_pointer(&hub.pending_table, g_hash_table_destroy);
+
+	g_list_free_full(hub.listeners, g_free);
+	hub.listeners = NULL;
+
+	for (i = 0; i < EVENT_HISTORY_SIZE; i++)
+		__event_item_clear(&hub.history[i]);
+
+	hub.initialized = FALSE;
+}
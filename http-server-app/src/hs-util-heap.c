@@ -0,0 +1,499 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <glib.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "http-server-log-private.h"
+#include "hs-util-heap.h"
+
+#define HEAP_MAX_SITES 1024
+#define HEAP_SITES_HASH_SIZE 2048
+#define HEAP_MAX_LIVE 12288
+#define HEAP_LIVE_HASH_SIZE 16384
+#define HEAP_FILTER_SIZE (1 << 17)
+#define HEAP_MAX_SNAPSHOTS 4
+
+/* malloc, and what it is called through, e.g. g_malloc */
+#define HEAP_EXTRA_FRAMES 4
+
+struct heap_counters {
+	gint64 live_bytes;
+	gint64 live_count;
+	gint64 total_bytes;
+	gint64 total_count;
+};
+
+struct heap_site {
+	void *frames[UTIL_HEAP_MAX_DEPTH];
+	int depth;
+	guint hash;
+	char route[UTIL_HEAP_ROUTE_MAX];
+	struct heap_counters counters;
+};
+
+struct heap_live {
+	void *ptr;
+	guint32 size;
+	guint32 site;
+};
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+/*
+ * Read by every malloc without a barrier, a few allocations more or
+ * less while it flips do not matter.
+ */
+static int heap_on;
+static guint heap_epoch;
+static unsigned int sample_bytes;
+
+/* a GMutex may allocate on first use, which ends up in here again */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Tables are zero until profiling is enabled, so they take no memory
+ * before. All of them are protected by heap_lock.
+ */
+static struct heap_site sites[HEAP_MAX_SITES];
+static guint n_sites;
+static guint16 sites_hash[HEAP_SITES_HASH_SIZE];
+static struct heap_live live[HEAP_LIVE_HASH_SIZE];
+static guint n_live;
+static guint64 dropped;
+
+/* counts live samples by hash of address, so most frees skip the lock */
+static guint8 filter[HEAP_FILTER_SIZE];
+
+static struct heap_counters snapshots[HEAP_MAX_SNAPSHOTS][HEAP_MAX_SITES];
+static guint snapshot_sites[HEAP_MAX_SNAPSHOTS];
+static guint snapshot_ids[HEAP_MAX_SNAPSHOTS];
+static guint snapshot_last;
+
+/* GPrivate may allocate as well */
+static __thread gboolean in_hook;
+static __thread const char *thread_route;
+static __thread guint thread_epoch;
+static __thread guint32 thread_rand;
+static __thread gint64 thread_countdown;
+
+static inline guint __heap_ptr_hash(const void *ptr)
+{
+	return (guint)(((guint64)(guintptr)ptr >> 4) * 0x9E3779B97F4A7C15ULL >> 32);
+}
+
+static gint64 __heap_next_sample(void)
+{
+	/* xorshift, jitter so regular allocation patterns are not missed */
+	thread_rand ^= thread_rand << 13;
+	thread_rand ^= thread_rand >> 17;
+	thread_rand ^= thread_rand << 5;
+
+	return sample_bytes / 2 + thread_rand % (sample_bytes ? sample_bytes : 1);
+}
+
+/* each sample stands for the allocations skipped before it */
+static void __heap_estimate(guint32 size, struct heap_counters *c, int sign)
+{
+	gint64 bytes = MAX(size, 1);
+	gint64 count = 1;
+
+	if (bytes < sample_bytes) {
+		count = (sample_bytes + bytes / 2) / bytes;
+		bytes = sample_bytes;
+	}
+
+	c->live_bytes += sign * bytes;
+	c->live_count += sign * count;
+	if (sign > 0) {
+		c->total_bytes += bytes;
+		c->total_count += count;
+	}
+}
+
+static guint __heap_site_hash(void *const *frames, int depth, const char *route)
+{
+	guint hash = route ? g_str_hash(route) : 0;
+	int i = 0;
+
+	for (i = 0; i < depth; i++)
+		hash = hash * 31 + __heap_ptr_hash(frames[i]);
+
+	return hash;
+}
+
+static struct heap_site *__heap_site_get(void *const *frames, int depth,
+				const char *route)
+{
+	struct heap_site *site = NULL;
+	guint hash = __heap_site_hash(frames, depth, route);
+	guint i = hash & (HEAP_SITES_HASH_SIZE - 1);
+
+	for (; sites_hash[i]; i = (i + 1) & (HEAP_SITES_HASH_SIZE - 1)) {
+		site = &sites[sites_hash[i] - 1];
+		if (site->hash == hash && site->depth == depth
+			&& !memcmp(site->frames, frames, depth * sizeof(void *))
+			&& !strncmp(site->route, route ? route : "", sizeof(site->route) - 1))
+			return site;
+	}
+
+	if (n_sites >= HEAP_MAX_SITES)
+		return NULL;
+
+	site = &sites[n_sites++];
+	memcpy(site->frames, frames, depth * sizeof(void *));
+	site->depth = depth;
+	site->hash = hash;
+	g_strlcpy(site->route, route ? route : "", sizeof(site->route));
+	sites_hash[i] = n_sites;
+
+	return site;
+}
+
+static gboolean __heap_live_add(void *ptr, size_t size, struct heap_site *site)
+{
+	guint i = __heap_ptr_hash(ptr) & (HEAP_LIVE_HASH_SIZE - 1);
+	guint8 *f = &filter[__heap_ptr_hash(ptr) >> 15 & (HEAP_FILTER_SIZE - 1)];
+
+	if (n_live >= HEAP_MAX_LIVE)
+		return FALSE;
+
+	while (live[i].ptr)
+		i = (i + 1) & (HEAP_LIVE_HASH_SIZE - 1);
+
+	live[i].ptr = ptr;
+	live[i].size = (guint32)MIN(size, G_MAXUINT32);
+	live[i].site = site - sites;
+	n_live++;
+
+	/* saturated counters stay, they only cost a lookup */
+	if (*f < G_MAXUINT8)
+		(*f)++;
+
+	return TRUE;
+}
+
+static void __heap_live_remove(guint i)
+{
+	guint8 *f = &filter[__heap_ptr_hash(live[i].ptr) >> 15 & (HEAP_FILTER_SIZE - 1)];
+	guint j = i;
+	guint k = 0;
+
+	if (*f < G_MAXUINT8)
+		(*f)--;
+	n_live--;
+
+	/* moves back the entries probing past the hole, no tombstones */
+	for (;;) {
+		live[i].ptr = NULL;
+		do {
+			j = (j + 1) & (HEAP_LIVE_HASH_SIZE - 1);
+			if (!live[j].ptr)
+				return;
+			k = __heap_ptr_hash(live[j].ptr) & (HEAP_LIVE_HASH_SIZE - 1);
+		} while (i <= j ? (i < k && k <= j) : (i < k || k <= j));
+		live[i] = live[j];
+		i = j;
+	}
+}
+
+static void G_GNUC_NO_INLINE __heap_sample(void *ptr, size_t size, void *caller)
+{
+	void *frames[UTIL_HEAP_MAX_DEPTH + HEAP_EXTRA_FRAMES];
+	struct heap_site *site = NULL;
+	int depth = 0;
+	int first = 0;
+
+	in_hook = TRUE;
+
+	depth = backtrace(frames, G_N_ELEMENTS(frames));
+	while (first < depth && frames[first] != caller)
+		first++;
+	if (first == depth)
+		first = 0;
+	depth = MIN(depth - first, UTIL_HEAP_MAX_DEPTH);
+
+	pthread_mutex_lock(&heap_lock);
+	if (heap_on) {
+		site = __heap_site_get(frames + first, depth, thread_route);
+		if (site && __heap_live_add(ptr, size, site))
+			__heap_estimate((guint32)MIN(size, G_MAXUINT32), &site->counters, 1);
+		else
+			dropped++;
+	}
+	pthread_mutex_unlock(&heap_lock);
+
+	in_hook = FALSE;
+}
+
+static inline void __heap_alloc(void *ptr, size_t size, void *caller)
+{
+	if (in_hook)
+		return;
+
+	if (thread_epoch != heap_epoch) {
+		thread_epoch = heap_epoch;
+		thread_rand = __heap_ptr_hash(&thread_rand) | 1;
+		thread_countdown = __heap_next_sample();
+	}
+
+	thread_countdown -= size;
+	if (thread_countdown > 0)
+		return;
+	thread_countdown = __heap_next_sample();
+
+	__heap_sample(ptr, size, caller);
+}
+
+static void __heap_free(void *ptr)
+{
+	struct heap_site *site = NULL;
+	guint i = 0;
+
+	if (in_hook || !filter[__heap_ptr_hash(ptr) >> 15 & (HEAP_FILTER_SIZE - 1)])
+		return;
+
+	in_hook = TRUE;
+	pthread_mutex_lock(&heap_lock);
+
+	i = __heap_ptr_hash(ptr) & (HEAP_LIVE_HASH_SIZE - 1);
+	for (; live[i].ptr; i = (i + 1) & (HEAP_LIVE_HASH_SIZE - 1)) {
+		if (live[i].ptr != ptr)
+			continue;
+
+		site = &sites[live[i].site];
+		__heap_estimate(live[i].size, &site->counters, -1);
+		__heap_live_remove(i);
+		break;
+	}
+
+	pthread_mutex_unlock(&heap_lock);
+	in_hook = FALSE;
+}
+
+/*
+ * These take the place of malloc of libc in the whole process, as long
+ * as this is the executable. They cost a load and a branch while the
+ * profiler is off.
+ */
+void *malloc(size_t size)
+{
+	void *ptr = __libc_malloc(size);
+
+	if (G_UNLIKELY(heap_on) && ptr)
+		__heap_alloc(ptr, size, __builtin_return_address(0));
+
+	return ptr;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	void *ptr = __libc_calloc(nmemb, size);
+
+	if (G_UNLIKELY(heap_on) && ptr)
+		__heap_alloc(ptr, nmemb * size, __builtin_return_address(0));
+
+	return ptr;
+}
+
+void *realloc(void *old, size_t size)
+{
+	void *ptr = NULL;
+
+	/* the block may move, a failure leaves it alive but not counted */
+	if (G_UNLIKELY(heap_on) && old)
+		__heap_free(old);
+
+	ptr = __libc_realloc(old, size);
+	if (G_UNLIKELY(heap_on) && ptr)
+		__heap_alloc(ptr, size, __builtin_return_address(0));
+
+	return ptr;
+}
+
+void free(void *ptr)
+{
+	if (G_UNLIKELY(heap_on) && ptr)
+		__heap_free(ptr);
+
+	__libc_free(ptr);
+}
+
+int util_heap_set_enabled(gboolean enabled, unsigned int bytes)
+{
+	void *frame = NULL;
+
+	if (!enabled) {
+		pthread_mutex_lock(&heap_lock);
+		heap_on = 0;
+		pthread_mutex_unlock(&heap_lock);
+		return 0;
+	}
+
+	retvm_if(!bytes, -1, "invalid sample_bytes");
+	retvm_if(dlsym(RTLD_DEFAULT, "malloc") != (void *)malloc, -1,
+				"malloc is not interposed, the profiler would see nothing");
+
+	/* loads libgcc, once it is off the hook */
+	backtrace(&frame, 1);
+
+	pthread_mutex_lock(&heap_lock);
+	memset(sites, 0, sizeof(sites));
+	memset(sites_hash, 0, sizeof(sites_hash));
+	memset(live, 0, sizeof(live));
+	memset(filter, 0, sizeof(filter));
+	memset(snapshot_ids, 0, sizeof(snapshot_ids));
+	n_sites = 0;
+	n_live = 0;
+	dropped = 0;
+	sample_bytes = bytes;
+	heap_epoch++;
+	heap_on = 1;
+	pthread_mutex_unlock(&heap_lock);
+
+	_I("heap profiling, a sample each %u bytes", bytes);
+
+	return 0;
+}
+
+gboolean util_heap_is_enabled(void)
+{
+	return heap_on;
+}
+
+unsigned int util_heap_get_sample_bytes(void)
+{
+	return sample_bytes;
+}
+
+guint64 util_heap_get_dropped(void)
+{
+	guint64 value = 0;
+
+	pthread_mutex_lock(&heap_lock);
+	value = dropped;
+	pthread_mutex_unlock(&heap_lock);
+
+	return value;
+}
+
+const char *util_heap_route_set(const char *route)
+{
+	const char *old = thread_route;
+
+	thread_route = route;
+
+	return old;
+}
+
+guint util_heap_snapshot(void)
+{
+	guint slot = 0;
+	guint id = 0;
+	guint i = 0;
+
+	pthread_mutex_lock(&heap_lock);
+	if (heap_epoch) {
+		id = ++snapshot_last;
+		slot = (id - 1) % HEAP_MAX_SNAPSHOTS;
+		for (i = 0; i < n_sites; i++)
+			snapshots[slot][i] = sites[i].counters;
+		snapshot_sites[slot] = n_sites;
+		snapshot_ids[slot] = id;
+	}
+	pthread_mutex_unlock(&heap_lock);
+
+	return id;
+}
+
+static int __heap_snapshot_slot(guint id)
+{
+	guint slot = (id - 1) % HEAP_MAX_SNAPSHOTS;
+
+	if (!id || snapshot_ids[slot] != id)
+		return -1;
+
+	return (int)slot;
+}
+
+int util_heap_foreach(guint snapshot, guint base,
+				util_heap_foreach_cb callback, gpointer user_data)
+{
+	struct util_heap_site *result = NULL;
+	const struct heap_counters *c = NULL;
+	const struct heap_counters *b = NULL;
+	int snapshot_slot = -1;
+	int base_slot = -1;
+	guint count = 0;
+	guint i = 0;
+
+	retv_if(!callback, -1);
+
+	/* the copy would be sampled, and wait for the lock it holds */
+	in_hook = TRUE;
+	pthread_mutex_lock(&heap_lock);
+
+	snapshot_slot = __heap_snapshot_slot(snapshot);
+	base_slot = __heap_snapshot_slot(base);
+	if ((snapshot && snapshot_slot < 0) || (base && base_slot < 0)) {
+		pthread_mutex_unlock(&heap_lock);
+		in_hook = FALSE;
+		return -1;
+	}
+
+	count = snapshot ? snapshot_sites[snapshot_slot] : n_sites;
+	if (count)
+		result = g_try_new0(struct util_heap_site, count);
+	if (!result)
+		count = 0;
+
+	for (i = 0; i < count; i++) {
+		c = snapshot ? &snapshots[snapshot_slot][i] : &sites[i].counters;
+		result[i].route = sites[i].route[0] ? sites[i].route : NULL;
+		result[i].frames = sites[i].frames;
+		result[i].depth = sites[i].depth;
+		result[i].live_bytes = c->live_bytes;
+		result[i].live_count = c->live_count;
+		result[i].total_bytes = c->total_bytes;
+		result[i].total_count = c->total_count;
+
+		if (base && i < snapshot_sites[base_slot]) {
+			b = &snapshots[base_slot][i];
+			result[i].live_bytes -= b->live_bytes;
+			result[i].live_count -= b->live_count;
+			result[i].total_bytes -= b->total_bytes;
+			result[i].total_count -= b->total_count;
+		}
+	}
+
+	pthread_mutex_unlock(&heap_lock);
+	in_hook = FALSE;
+
+	for (i = 0; i < count; i++)
+		callback(&result[i], user_data);
+	g_free(result);
+
+	return 0;
+}
@@ -0,0 +1,673 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <storage.h>
+#include <app_common.h>
+#include "http-server-log-private.h"
+#include "hs-util-image-store.h"
+
+#define STORE_DEFAULT_DIR_NAME "uploads"
+#define STORE_STORAGE_DIR_NAME "httpserver"
+#define STORE_TEMP_TEMPLATE ".upload-XXXXXX"
+
+/* commits are synced together, at most this late */
+#define STORE_SYNC_DELAY_US (10 * 1000)
+#define STORE_SYNC_BATCH_MAX 32
+#define STORE_HASH_BUF_SIZE (64 * 1024)
+
+/* writers wait while this much is queued, until it is down to the low mark */
+#define STORE_QUEUE_HIGH (4 * 1024 * 1024)
+#define STORE_QUEUE_LOW (1024 * 1024)
+
+enum store_job_type {
+	STORE_JOB_WRITE,
+	STORE_JOB_COMMIT,
+	STORE_JOB_ABORT,
+	STORE_JOB_CLOSE,
+	STORE_JOB_QUIT,
+};
+
+struct store_job {
+	enum store_job_type type;
+	struct util_image_store_file *file;
+	GBytes *bytes;
+};
+
+/* referenced by the I/O thread and by a pending drained callback */
+struct util_image_store_file {
+	gint ref;
+	char *dir;
+	char *tmp_path;
+	char *path;
+	char *id;
+	const char *ext;
+	int fd;
+	GChecksum *checksum;
+	gint queued;
+	gint error;
+	gint drain_armed;
+	util_image_store_drained_cb drained_cb;
+	gpointer drained_data;
+	gboolean duplicate;
+	util_image_store_commit_cb callback;
+	gpointer user_data;
+};
+
+static const struct {
+	const char *type;
+	const char *ext;
+} image_types[] = {
+	{ "image/jpeg", "jpg" },
+	{ "image/png", "png" },
+	{ "image/gif", "gif" },
+	{ "image/webp", "webp" },
+	{ "image/bmp", "bmp" },
+};
+
+static struct {
+	GThread *thread;
+	GAsyncQueue *queue;
+} store;
+
+static const char *__type_to_ext(const char *content_type)
+{
+	guint i = 0;
+
+	for (i = 0; i < G_N_ELEMENTS(image_types); i++) {
+		if (!g_strcmp0(image_types[i].type, content_type))
+			return image_types[i].ext;
+	}
+
+	return "bin";
+}
+
+static void __store_push(enum store_job_type type,
+			struct util_image_store_file *file, GBytes *bytes)
+{
+	struct store_job *job = g_new0(struct store_job, 1);
+
+	job->type = type;
+	job->file = file;
+	job->bytes = bytes;
+	g_async_queue_push(store.queue, job);
+}
+
+static void __store_file_free(struct util_image_store_file *file)
+{
+	if (file->fd >= 0)
+		close(file->fd);
+
+	if (file->checksum)
+		g_checksum_free(file->checksum);
+
+	g_free(file->dir);
+	g_free(file->tmp_path);
+	g_free(file->path);
+	g_free(file->id);
+	g_free(file);
+}
+
+static void __store_file_unref(struct util_image_store_file *file)
+{
+	if (g_atomic_int_dec_and_test(&file->ref))
+		__store_file_free(file);
+}
+
+static void __store_file_set_error(struct util_image_store_file *file, int err)
+{
+	g_atomic_int_compare_and_exchange(&file->error, 0, err);
+}
+
+static gboolean __store_commit_done(gpointer data)
+{
+	struct util_image_store_file *file = data;
+
+	if (file->callback)
+		file->callback(file->id, file->path, file->duplicate,
+				g_atomic_int_get(&file->error), file->user_data);
+
+	__store_file_unref(file);
+
+	return G_SOURCE_REMOVE;
+}
+
+static gboolean __store_drained(gpointer data)
+{
+	struct util_image_store_file *file = data;
+	util_image_store_drained_cb callback = file->drained_cb;
+
+	/* NULL if the file was handed over meanwhile */
+	file->drained_cb = NULL;
+	if (callback)
+		callback(file->drained_data);
+
+	__store_file_unref(file);
+
+	return G_SOURCE_REMOVE;
+}
+
+/* I/O thread */
+static void __store_write(struct util_image_store_file *file, GBytes *bytes)
+{
+	gsize len = 0;
+	const char *data = g_bytes_get_data(bytes, &len);
+	gsize total = len;
+	ssize_t written = 0;
+	int err = 0;
+
+	while (len && !g_atomic_int_get(&file->error)) {
+		written = write(file->fd, data, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+
+			err = errno;
+			_E("failed to write [%s] - %s", file->tmp_path, g_strerror(err));
+			__store_file_set_error(file, err);
+			break;
+		}
+		data += written;
+		len -= written;
+	}
+
+	g_atomic_int_add(&file->queued, -(gint)total);
+
+	if (g_atomic_int_get(&file->queued) <= STORE_QUEUE_LOW
+		&& g_atomic_int_compare_and_exchange(&file->drain_armed, 1, 0)) {
+		g_atomic_int_inc(&file->ref);
+		g_idle_add(__store_drained, file);
+	}
+}
+
+/* I/O thread */
+static void __store_sync_dir(const char *dir)
+{
+	int fd = open(dir, O_RDONLY | O_DIRECTORY);
+
+	if (fd < 0)
+		return;
+
+	if (fsync(fd))
+		_W("failed to sync [%s] - %s", dir, g_strerror(errno));
+	close(fd);
+}
+
+static void __store_file_set_path(struct util_image_store_file *file)
+{
+	char *name = g_strdup_printf("%s.%s", file->id, file->ext);
+
+	file->path = g_build_filename(file->dir, name, NULL);
+	g_free(name);
+}
+
+/* I/O thread, for resumed files whose content was not seen as a whole */
+static void __store_hash(struct util_image_store_file *file)
+{
+	GChecksum *checksum = NULL;
+	guchar *buf = NULL;
+	ssize_t len = 0;
+	int fd = -1;
+
+	fd = open(file->tmp_path, O_RDONLY);
+	if (fd < 0) {
+		__store_file_set_error(file, errno);
+		return;
+	}
+
+	checksum = g_checksum_new(G_CHECKSUM_SHA256);
+	buf = g_malloc(STORE_HASH_BUF_SIZE);
+
+	while ((len = read(fd, buf, STORE_HASH_BUF_SIZE)) != 0) {
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			__store_file_set_error(file, errno);
+			break;
+		}
+		g_checksum_update(checksum, buf, len);
+	}
+	close(fd);
+
+	file->id = g_strdup(g_checksum_get_string(checksum));
+	__store_file_set_path(file);
+
+	g_checksum_free(checksum);
+	g_free(buf);
+}
+
+/*
+ * I/O thread, files are synced first and renamed after, so that the
+ * directories are synced once for the whole batch.
+ */
+static void __store_sync(GPtrArray *commits)
+{
+	GHashTable *dirs = g_hash_table_new(g_str_hash, g_str_equal);
+	GHashTableIter iter;
+	gpointer dir = NULL;
+	guint i = 0;
+	int err = 0;
+
+	for (i = 0; i < commits->len; i++) {
+		struct util_image_store_file *file = g_ptr_array_index(commits, i);
+
+		if (!file->id)
+			__store_hash(file);
+
+		if (g_atomic_int_get(&file->error))
+			continue;
+
+		/* the same content is stored already, skip the flush */
+		if (g_file_test(file->path, G_FILE_TEST_EXISTS))
+			file->duplicate = TRUE;
+		else if (fsync(file->fd))
+			__store_file_set_error(file, errno);
+	}
+
+	for (i = 0; i < commits->len; i++) {
+		struct util_image_store_file *file = g_ptr_array_index(commits, i);
+
+		close(file->fd);
+		file->fd = -1;
+
+		if (g_atomic_int_get(&file->error) || file->duplicate) {
+			g_unlink(file->tmp_path);
+		} else if (g_rename(file->tmp_path, file->path)) {
+			err = errno;
+			_E("failed to rename to [%s] - %s", file->path, g_strerror(err));
+			__store_file_set_error(file, err);
+			g_unlink(file->tmp_path);
+		} else {
+			g_hash_table_add(dirs, file->dir);
+		}
+	}
+
+	g_hash_table_iter_init(&iter, dirs);
+	while (g_hash_table_iter_next(&iter, &dir, NULL))
+		__store_sync_dir(dir);
+	g_hash_table_destroy(dirs);
+
+	_D("[%u] files are committed", commits->len);
+
+	for (i = 0; i < commits->len; i++)
+		g_idle_add(__store_commit_done, g_ptr_array_index(commits, i));
+	g_ptr_array_set_size(commits, 0);
+}
+
+static gpointer __store_thread(gpointer data)
+{
+	GPtrArray *commits = g_ptr_array_new();
+	gint64 batch_start = 0;
+	gboolean quit = FALSE;
+
+	while (!quit) {
+		struct store_job *job = NULL;
+		gboolean timed_out = FALSE;
+
+		if (commits->len) {
+			gint64 wait = batch_start + STORE_SYNC_DELAY_US
+					- g_get_monotonic_time();
+			if (wait > 0)
+				job = g_async_queue_timeout_pop(store.queue, wait);
+		} else {
+			job = g_async_queue_pop(store.queue);
+		}
+
+		if (job) {
+			switch (job->type) {
+			case STORE_JOB_WRITE:
+				__store_write(job->file, job->bytes);
+				g_bytes_unref(job->bytes);
+				break;
+			case STORE_JOB_COMMIT:
+				if (!commits->len)
+					batch_start = g_get_monotonic_time();
+				g_ptr_array_add(commits, job->file);
+				break;
+			case STORE_JOB_ABORT:
+				g_unlink(job->file->tmp_path);
+				__store_file_unref(job->file);
+				break;
+			case STORE_JOB_CLOSE:
+				if (fsync(job->file->fd))
+					__store_file_set_error(job->file, errno);
+				g_idle_add(__store_commit_done, job->file);
+				break;
+			case STORE_JOB_QUIT:
+				quit = TRUE;
+				break;
+			}
+			g_clear_pointer(&job, g_free);
+		} else {
+			timed_out = TRUE;
+		}
+
+		if (commits->len
+			&& (timed_out || quit || commits->len >= STORE_SYNC_BATCH_MAX))
+			__store_sync(commits);
+	}
+
+	g_ptr_array_free(commits, TRUE);
+
+	return NULL;
+}
+
+struct util_image_store_file *util_image_store_file_new(const char *dir)
+{
+	struct util_image_store_file *file = NULL;
+
+	retv_if(!dir, NULL);
+	retvm_if(!store.thread, NULL, "image store is NOT initialized");
+
+	file = g_try_new0(struct util_image_store_file, 1);
+	retvm_if(!file, NULL, "failed to alloc image store file");
+
+	file->ref = 1;
+	file->dir = g_strdup(dir);
+	file->tmp_path = g_build_filename(dir, STORE_TEMP_TEMPLATE, NULL);
+	file->fd = g_mkstemp(file->tmp_path);
+	if (file->fd < 0) {
+		_E("failed to create temp file in [%s] - %s", dir, g_strerror(errno));
+		g_clear_pointer(&file->tmp_path, g_free);
+		__store_file_free(file);
+		return NULL;
+	}
+
+	file->checksum = g_checksum_new(G_CHECKSUM_SHA256);
+
+	return file;
+}
+
+int util_image_store_file_write(struct util_image_store_file *file,
+				const char *data, gsize len)
+{
+	int err = 0;
+
+	retv_if(!file, EINVAL);
+
+	err = g_atomic_int_get(&file->error);
+	if (err || !len)
+		return err;
+
+	/* hashed here while the data is at hand, written out in the thread */
+	if (file->checksum)
+		g_checksum_update(file->checksum, (const guchar *)data, len);
+
+	g_atomic_int_add(&file->queued, len);
+	__store_push(STORE_JOB_WRITE, file, g_bytes_new(data, len));
+
+	return 0;
+}
+
+gboolean util_image_store_file_wait_drained(struct util_image_store_file *file,
+				util_image_store_drained_cb callback, gpointer user_data)
+{
+	retv_if(!file || !callback, FALSE);
+
+	if (g_atomic_int_get(&file->queued) <= STORE_QUEUE_HIGH)
+		return FALSE;
+
+	file->drained_cb = callback;
+	file->drained_data = user_data;
+	g_atomic_int_set(&file->drain_armed, 1);
+
+	/* the thread may have caught up before it saw the flag */
+	if (g_atomic_int_get(&file->queued) <= STORE_QUEUE_LOW
+		&& g_atomic_int_compare_and_exchange(&file->drain_armed, 1, 0)) {
+		file->drained_cb = NULL;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+struct util_image_store_file *util_image_store_file_resume(const char *tmp_path)
+{
+	struct util_image_store_file *file = NULL;
+
+	retv_if(!tmp_path, NULL);
+	retvm_if(!store.thread, NULL, "image store is NOT initialized");
+
+	file = g_try_new0(struct util_image_store_file, 1);
+	retvm_if(!file, NULL, "failed to alloc image store file");
+
+	file->ref = 1;
+	file->fd = open(tmp_path, O_WRONLY | O_APPEND);
+	if (file->fd < 0) {
+		_E("failed to open [%s] - %s", tmp_path, g_strerror(errno));
+		g_free(file);
+		return NULL;
+	}
+
+	/* hashed by the I/O thread on commit */
+	file->dir = g_path_get_dirname(tmp_path);
+	file->tmp_path = g_strdup(tmp_path);
+
+	return file;
+}
+
+const char *util_image_store_file_get_temp_path(struct util_image_store_file *file)
+{
+	retv_if(!file, NULL);
+
+	return file->tmp_path;
+}
+
+void util_image_store_file_commit(struct util_image_store_file *file,
+				const char *content_type,
+				util_image_store_commit_cb callback, gpointer user_data)
+{
+	ret_if(!file);
+
+	file->ext = __type_to_ext(content_type);
+	if (file->checksum) {
+		file->id = g_strdup(g_checksum_get_string(file->checksum));
+		__store_file_set_path(file);
+	}
+
+	file->callback = callback;
+	file->user_data = user_data;
+	file->drained_cb = NULL;
+
+	__store_push(STORE_JOB_COMMIT, file, NULL);
+}
+
+void util_image_store_file_abort(struct util_image_store_file *file)
+{
+	ret_if(!file);
+
+	file->drained_cb = NULL;
+	__store_push(STORE_JOB_ABORT, file, NULL);
+}
+
+void util_image_store_file_close(struct util_image_store_file *file,
+				util_image_store_commit_cb callback, gpointer user_data)
+{
+	ret_if(!file);
+
+	file->callback = callback;
+	file->user_data = user_data;
+	file->drained_cb = NULL;
+
+	__store_push(STORE_JOB_CLOSE, file, NULL);
+}
+
+static char *__store_dir_path(int storage_id, gboolean writable)
+{
+	char *base = NULL;
+	char *dir = NULL;
+	storage_state_e state = STORAGE_STATE_REMOVED;
+	int ret = 0;
+
+	if (storage_id == UTIL_IMAGE_STORE_DEFAULT_STORAGE) {
+		base = app_get_data_path();
+		retvm_if(!base, NULL, "failed to get data path");
+		dir = g_build_filename(base, STORE_DEFAULT_DIR_NAME, NULL);
+	} else {
+		ret = storage_get_state(storage_id, &state);
+		retvm_if(ret != STORAGE_ERROR_NONE, NULL,
+			"failed to get state of storage [%d] - %d", storage_id, ret);
+		retvm_if(state != STORAGE_STATE_MOUNTED
+			&& (writable || state != STORAGE_STATE_MOUNTED_READ_ONLY), NULL,
+			"storage [%d] is not usable - %d", storage_id, state);
+
+		ret = storage_get_directory(storage_id, STORAGE_DIRECTORY_IMAGES, &base);
+		retvm_if(ret != STORAGE_ERROR_NONE, NULL,
+			"failed to get images directory of [%d] - %d", storage_id, ret);
+		dir = g_build_filename(base, STORE_STORAGE_DIR_NAME, NULL);
+	}
+	g_free(base);
+
+	return dir;
+}
+
+gboolean util_image_store_parse_storage_id(const char *str, int *storage_id)
+{
+	char *end = NULL;
+	long id = 0;
+
+	retv_if(!storage_id, FALSE);
+
+	if (!str) {
+		*storage_id = UTIL_IMAGE_STORE_DEFAULT_STORAGE;
+		return TRUE;
+	}
+
+	/* ids listed by /api/storage, the default has no name of its own */
+	errno = 0;
+	id = strtol(str, &end, 10);
+	if (errno || end == str || *end || id < 0 || id > G_MAXINT) {
+		_E("invalid storage id [%s]", str);
+		return FALSE;
+	}
+
+	*storage_id = id;
+
+	return TRUE;
+}
+
+char *util_image_store_get_dir(int storage_id)
+{
+	char *dir = __store_dir_path(storage_id, TRUE);
+
+	if (!dir)
+		return NULL;
+
+	if (g_mkdir_with_parents(dir, 0700)) {
+		_E("failed to create [%s] - %s", dir, g_strerror(errno));
+		g_free(dir);
+		return NULL;
+	}
+
+	return dir;
+}
+
+static bool __store_storage_cb(int storage_id, storage_type_e type,
+			storage_state_e state, const char *path, void *user_data)
+{
+	GArray *ids = user_data;
+
+	g_array_append_val(ids, storage_id);
+
+	return true;
+}
+
+static gboolean __store_id_is_valid(const char *id)
+{
+	guint i = 0;
+
+	for (i = 0; id[i]; i++) {
+		if (!g_ascii_isxdigit(id[i]) || g_ascii_isupper(id[i]))
+			return FALSE;
+	}
+
+	return i == g_checksum_type_get_length(G_CHECKSUM_SHA256) * 2;
+}
+
+char *util_image_store_lookup(const char *id, const char **content_type)
+{
+	GArray *ids = NULL;
+	char *path = NULL;
+	int storage_id = UTIL_IMAGE_STORE_DEFAULT_STORAGE;
+	guint i = 0;
+	guint j = 0;
+
+	retv_if(!id, NULL);
+
+	/* the id becomes a part of the path */
+	retvm_if(!__store_id_is_valid(id), NULL, "invalid image id");
+
+	ids = g_array_new(FALSE, FALSE, sizeof(int));
+	g_array_append_val(ids, storage_id);
+	storage_foreach_device_supported(__store_storage_cb, ids);
+
+	for (i = 0; i < ids->len && !path; i++) {
+		char *dir = __store_dir_path(g_array_index(ids, int, i), FALSE);
+
+		for (j = 0; dir && j <= G_N_ELEMENTS(image_types) && !path; j++) {
+			const char *type = j < G_N_ELEMENTS(image_types) ?
+						image_types[j].type : NULL;
+			char *name = g_strdup_printf("%s.%s", id, __type_to_ext(type));
+
+			path = g_build_filename(dir, name, NULL);
+			if (!g_file_test(path, G_FILE_TEST_IS_REGULAR)) {
+				g_clear_pointer(&path, g_free);
+			} else if (content_type) {
+				*content_type = type ? type : "application/octet-stream";
+			}
+			g_free(name);
+		}
+		g_free(dir);
+	}
+	g_array_free(ids, TRUE);
+
+	return path;
+}
+
+int util_image_store_init(void)
+{
+	if (store.thread)
+		return 0;
+
+	store.queue = g_async_queue_new();
+	store.thread = g_thread_try_new("image-store", __store_thread, NULL, NULL);
+	if (!store.thread) {
+		_E("failed to create image store thread");
+		g_clear_pointer(&store.queue, g_async_queue_unref);
+		return -1;
+	}
+
+	return 0;
+}
+
+void util_image_store_fini(void)
+{
+	if (!store.thread)
+		return;
+
+	/* pending jobs are done first, the queue is in order */
+	__store_push(STORE_JOB_QUIT, NULL, NULL);
+	g_thread_join(store.thread);
+	store.thread = NULL;
+
+	g_clear_pointer(&store.queue, g_async_queue_unref);
+}
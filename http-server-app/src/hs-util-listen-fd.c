@@ -0,0 +1,324 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <glib-unix.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include "http-server-log-private.h"
+#include "hs-util-listen-fd.h"
+
+/* as sd_listen_fds() */
+#define LISTEN_FDS_START 3
+#define HANDOFF_NAME_FMT "http-server-app.%u.handoff"
+#define HANDOFF_TIMEOUT_SEC 1
+
+struct listen_fd_handoff {
+	int sock;
+	guint source;
+	int listen_fd;
+	util_listen_fd_handoff_cb callback;
+	gpointer user_data;
+};
+
+static struct listen_fd_handoff handoff = { .sock = -1, .listen_fd = -1 };
+
+static socklen_t __handoff_addr(unsigned int port, struct sockaddr_un *addr)
+{
+	int len = 0;
+
+	memset(addr, 0, sizeof(*addr));
+	addr->sun_family = AF_UNIX;
+
+	/* abstract namespace, nothing is left behind on the file system */
+	len = snprintf(addr->sun_path + 1, sizeof(addr->sun_path) - 1,
+			HANDOFF_NAME_FMT, port);
+
+	return offsetof(struct sockaddr_un, sun_path) + 1 + len;
+}
+
+static gboolean __fd_is_listener(int fd, unsigned int port)
+{
+	struct sockaddr_storage ss;
+	socklen_t len = sizeof(int);
+	int type = 0;
+	int listening = 0;
+	unsigned int bound = 0;
+
+	if (getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &len) || type != SOCK_STREAM)
+		return FALSE;
+
+	len = sizeof(int);
+	if (getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &len) || !listening)
+		return FALSE;
+
+	len = sizeof(ss);
+	if (getsockname(fd, (struct sockaddr *)&ss, &len))
+		return FALSE;
+
+	if (ss.ss_family == AF_INET)
+		bound = ntohs(((struct sockaddr_in *)&ss)->sin_port);
+	else if (ss.ss_family == AF_INET6)
+		bound = ntohs(((struct sockaddr_in6 *)&ss)->sin6_port);
+
+	return bound == port;
+}
+
+static int __listen_fd_from_env(unsigned int port)
+{
+	const char *pid_str = g_getenv("LISTEN_PID");
+	const char *fds_str = g_getenv("LISTEN_FDS");
+	int fds = 0;
+	int fd = 0;
+
+	if (!pid_str || !fds_str)
+		return -1;
+
+	if (strtoul(pid_str, NULL, 10) != (unsigned long)getpid())
+		return -1;
+
+	fds = atoi(fds_str);
+
+	/* meant for this process only, not for anything it spawns */
+	g_unsetenv("LISTEN_PID");
+	g_unsetenv("LISTEN_FDS");
+	g_unsetenv("LISTEN_FDNAMES");
+
+	for (fd = LISTEN_FDS_START; fd < LISTEN_FDS_START + fds; fd++) {
+		if (__fd_is_listener(fd, port)) {
+			_D("listener of [%u] is passed as fd [%d]", port, fd);
+			return fd;
+		}
+	}
+
+	_E("no listener of [%u] in [%d] passed fds", port, fds);
+	return -1;
+}
+
+static int __listen_fd_from_instance(unsigned int port)
+{
+	struct sockaddr_un addr;
+	struct timeval timeout = { .tv_sec = HANDOFF_TIMEOUT_SEC };
+	struct msghdr mh;
+	struct cmsghdr *cmsg = NULL;
+	struct iovec iov;
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	char byte = 0;
+	socklen_t addr_len = __handoff_addr(port, &addr);
+	int sock = -1;
+	int fd = -1;
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	retvm_if(sock < 0, -1, "failed to create socket - %d", errno);
+
+	setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	/* nobody is serving it, which is the usual start */
+	if (connect(sock, (struct sockaddr *)&addr, addr_len)) {
+		close(sock);
+		return -1;
+	}
+
+	memset(&mh, 0, sizeof(mh));
+	iov.iov_base = &byte;
+	iov.iov_len = sizeof(byte);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cbuf;
+	mh.msg_controllen = sizeof(cbuf);
+
+	if (recvmsg(sock, &mh, MSG_CMSG_CLOEXEC) <= 0) {
+		_E("failed to receive listener - %d", errno);
+		close(sock);
+		return -1;
+	}
+	close(sock);
+
+	cmsg = CMSG_FIRSTHDR(&mh);
+	if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) {
+		_E("no listener is received");
+		return -1;
+	}
+	memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+
+	if (!__fd_is_listener(fd, port)) {
+		_E("received fd [%d] is not a listener of [%u]", fd, port);
+		close(fd);
+		return -1;
+	}
+
+	_D("listener of [%u] is handed over as fd [%d]", port, fd);
+
+	return fd;
+}
+
+int util_listen_fd_take(unsigned int port)
+{
+	int fd = -1;
+
+	fd = __listen_fd_from_env(port);
+	if (fd < 0)
+		fd = __listen_fd_from_instance(port);
+	if (fd < 0)
+		return -1;
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+	return fd;
+}
+
+static gboolean __handoff_incoming_cb(gint fd, GIOCondition condition,
+				gpointer user_data)
+{
+	util_listen_fd_handoff_cb callback = NULL;
+	struct ucred cred = { 0, };
+	struct msghdr mh;
+	struct cmsghdr *cmsg = NULL;
+	struct iovec iov;
+	char cbuf[CMSG_SPACE(sizeof(int))];
+	char byte = 0;
+	socklen_t len = sizeof(cred);
+	gpointer callback_data = NULL;
+	int conn = -1;
+
+	conn = accept4(fd, NULL, NULL, SOCK_CLOEXEC);
+	if (conn < 0)
+		return G_SOURCE_CONTINUE;
+
+	/* the listener is the whole server, it goes to the same user only */
+	if (getsockopt(conn, SOL_SOCKET, SO_PEERCRED, &cred, &len)
+		|| cred.uid != getuid()) {
+		_E("refused listener handoff to uid [%d]", (int)cred.uid);
+		close(conn);
+		return G_SOURCE_CONTINUE;
+	}
+
+	memset(&mh, 0, sizeof(mh));
+	memset(cbuf, 0, sizeof(cbuf));
+	iov.iov_base = &byte;
+	iov.iov_len = sizeof(byte);
+	mh.msg_iov = &iov;
+	mh.msg_iovlen = 1;
+	mh.msg_control = cbuf;
+	mh.msg_controllen = sizeof(cbuf);
+
+	cmsg = CMSG_FIRSTHDR(&mh);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &handoff.listen_fd, sizeof(int));
+
+	callback = handoff.callback;
+	callback_data = handoff.user_data;
+
+	/* the name is free before the successor gets the fd to serve it */
+	handoff.source = 0;
+	util_listen_fd_handoff_stop();
+
+	if (sendmsg(conn, &mh, MSG_NOSIGNAL) < 0) {
+		_E("failed to hand listener over - %d", errno);
+		close(conn);
+		return G_SOURCE_REMOVE;
+	}
+	close(conn);
+
+	_D("listener is handed over to [%d]", (int)cred.pid);
+	if (callback)
+		callback(callback_data);
+
+	return G_SOURCE_REMOVE;
+}
+
+int util_listen_fd_handoff_start(unsigned int port, int listen_fd,
+				util_listen_fd_handoff_cb callback, gpointer user_data)
+{
+	struct sockaddr_un addr;
+	socklen_t addr_len = __handoff_addr(port, &addr);
+	int sock = -1;
+
+	retv_if(listen_fd < 0, -1);
+	retvm_if(handoff.sock >= 0, -1, "handoff is already started");
+
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	retvm_if(sock < 0, -1, "failed to create socket - %d", errno);
+
+	if (bind(sock, (struct sockaddr *)&addr, addr_len) || listen(sock, 1)) {
+		_E("failed to serve listener handoff - %d", errno);
+		close(sock);
+		return -1;
+	}
+
+	handoff.sock = sock;
+	handoff.listen_fd = listen_fd;
+	handoff.callback = callback;
+	handoff.user_data = user_data;
+	handoff.source = g_unix_fd_add(sock, G_IO_IN, __handoff_incoming_cb, NULL);
+
+	return 0;
+}
+
+void util_listen_fd_handoff_stop(void)
+{
+	if (handoff.source)
+		g_source_remove(handoff.source);
+
+	if (handoff.sock >= 0)
+		close(handoff.sock);
+
+	handoff.source = 0;
+	handoff.sock = -1;
+	handoff.listen_fd = -1;
+	handoff.callback = NULL;
+	handoff.user_data = NULL;
+}
+
+int util_listen_fd_make_dormant(int fd)
+{
+	struct sockaddr_in addr;
+	int sock = -1;
+
+	sock = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	retvm_if(sock < 0, -1, "failed to create socket - %d", errno);
+
+	/*
+	 * A listener on an unused loopback port keeps the accept watch of
+	 * fd quiet, a socket which is not listening would wake it forever.
+	 */
+	memset(&addr, 0, sizeof(addr));
+	addr.sin_family = AF_INET;
+	addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) || listen(sock, 1)
+		|| dup2(sock, fd) < 0) {
+		_E("failed to replace listener - %d", errno);
+		close(sock);
+		return -1;
+	}
+	close(sock);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	return 0;
+}
@@ -0,0 +1,314 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <dlog.h>
+#include "http-server-log-private.h"
+#include "hs-util-log.h"
+
+/* power of two, so the counters may wrap */
+#define LOG_RING_SIZE 128
+#define LOG_HISTORY_SIZE 512
+#define LOG_DRAIN_INTERVAL_US (200 * G_TIME_SPAN_MILLISECOND)
+#define LOG_LEVEL_ENV "HTTP_SERVER_LOG_LEVEL"
+
+/*
+ * Written by its thread only and read by the drainer only, so neither
+ * side takes a lock: the owner moves head, the drainer moves tail.
+ */
+struct log_ring {
+	struct util_log_record records[LOG_RING_SIZE];
+	gint head;
+	gint tail;
+	gint dead;
+	int tid;
+};
+
+int util_log_level = DLOG_INFO;
+
+static void __log_ring_release(gpointer data);
+
+static GPrivate log_ring_key = G_PRIVATE_INIT(__log_ring_release);
+static GMutex rings_lock;
+static GCond drain_cond;
+static GSList *rings;
+static GThread *drain_thread;
+static gboolean drain_stop;
+static gint draining;
+static gint dropped;
+
+static GMutex history_lock;
+static struct util_log_record history[LOG_HISTORY_SIZE];
+static guint64 history_seq;
+
+static void __log_ring_release(gpointer data)
+{
+	struct log_ring *ring = data;
+
+	g_mutex_lock(&rings_lock);
+	if (drain_thread) {
+		/* freed by the drainer once it is empty */
+		g_atomic_int_set(&ring->dead, 1);
+	} else {
+		rings = g_slist_remove(rings, ring);
+		g_free(ring);
+	}
+	g_mutex_unlock(&rings_lock);
+}
+
+static struct log_ring *__log_ring_get(void)
+{
+	struct log_ring *ring = g_private_get(&log_ring_key);
+
+	if (ring)
+		return ring;
+
+	ring = g_try_new0(struct log_ring, 1);
+	if (!ring)
+		return NULL;
+	ring->tid = (int)syscall(SYS_gettid);
+
+	g_mutex_lock(&rings_lock);
+	rings = g_slist_prepend(rings, ring);
+	g_mutex_unlock(&rings_lock);
+
+	g_private_set(&log_ring_key, ring);
+
+	return ring;
+}
+
+/* Backs a message cut at len bytes off to the start of a split character */
+static void __log_msg_truncate(char *msg, gsize len)
+{
+	char *last = NULL;
+
+	if (len < UTIL_LOG_MSG_MAX)
+		return;
+
+	last = g_utf8_find_prev_char(msg, msg + UTIL_LOG_MSG_MAX - 1);
+	if (last && g_utf8_get_char_validated(last,
+			msg + UTIL_LOG_MSG_MAX - 1 - last) == (gunichar)-2)
+		*last = '\0';
+}
+
+static void __log_record_write(const struct util_log_record *record)
+{
+	struct util_log_record *slot = NULL;
+
+	/* errors are written at once, they are what is left after a crash */
+	if (record->prio < DLOG_ERROR)
+		dlog_print(record->prio, LOG_TAG, "[%s:%d] %s\n",
+			record->func, record->line, record->msg);
+
+	g_mutex_lock(&history_lock);
+	slot = &history[history_seq % LOG_HISTORY_SIZE];
+	*slot = *record;
+	slot->seq = ++history_seq;
+	g_mutex_unlock(&history_lock);
+}
+
+/* rings_lock is held */
+static void __log_drain(void)
+{
+	struct log_ring *ring = NULL;
+	GSList *l = NULL;
+	GSList *next = NULL;
+	guint head = 0;
+	guint tail = 0;
+
+	for (l = rings; l; l = next) {
+		next = l->next;
+		ring = l->data;
+
+		tail = (guint)ring->tail;
+		head = (guint)g_atomic_int_get(&ring->head);
+		for (; tail != head; tail++)
+			__log_record_write(&ring->records[tail & (LOG_RING_SIZE - 1)]);
+		g_atomic_int_set(&ring->tail, (gint)tail);
+
+		if (g_atomic_int_get(&ring->dead)
+			&& (guint)g_atomic_int_get(&ring->head) == tail) {
+			rings = g_slist_delete_link(rings, l);
+			g_free(ring);
+		}
+	}
+}
+
+static gpointer __log_drain_thread(gpointer data)
+{
+	gint64 end_time = 0;
+
+	g_mutex_lock(&rings_lock);
+	while (!drain_stop) {
+		end_time = g_get_monotonic_time() + LOG_DRAIN_INTERVAL_US;
+		g_cond_wait_until(&drain_cond, &rings_lock, end_time);
+		__log_drain();
+	}
+	__log_drain();
+	g_mutex_unlock(&rings_lock);
+
+	return NULL;
+}
+
+int util_log_level_from_str(const char *str)
+{
+	if (!g_strcmp0(str, "verbose"))
+		return DLOG_VERBOSE;
+	if (!g_strcmp0(str, "debug"))
+		return DLOG_DEBUG;
+	if (!g_strcmp0(str, "info"))
+		return DLOG_INFO;
+	if (!g_strcmp0(str, "warn"))
+		return DLOG_WARN;
+	if (!g_strcmp0(str, "error"))
+		return DLOG_ERROR;
+
+	return -1;
+}
+
+const char *util_log_level_to_str(int prio)
+{
+	switch (prio) {
+	case DLOG_VERBOSE:
+		return "verbose";
+	case DLOG_DEBUG:
+		return "debug";
+	case DLOG_INFO:
+		return "info";
+	case DLOG_WARN:
+		return "warn";
+	case DLOG_ERROR:
+		return "error";
+	default:
+		return "fatal";
+	}
+}
+
+int util_log_init(void)
+{
+	int level = util_log_level_from_str(g_getenv(LOG_LEVEL_ENV));
+
+	if (level >= 0)
+		util_log_level = level;
+
+	retvm_if(drain_thread, -1, "log is already initialized");
+
+	drain_stop = FALSE;
+	drain_thread = g_thread_try_new("hs-log", __log_drain_thread, NULL, NULL);
+	retvm_if(!drain_thread, -1, "failed to create log thread");
+
+	g_atomic_int_set(&draining, 1);
+
+	return 0;
+}
+
+void util_log_fini(void)
+{
+	GThread *thread = NULL;
+
+	ret_if(!drain_thread);
+
+	g_atomic_int_set(&draining, 0);
+
+	g_mutex_lock(&rings_lock);
+	drain_stop = TRUE;
+	g_cond_signal(&drain_cond);
+	thread = drain_thread;
+	g_mutex_unlock(&rings_lock);
+
+	g_thread_join(thread);
+
+	g_mutex_lock(&rings_lock);
+	drain_thread = NULL;
+	g_mutex_unlock(&rings_lock);
+}
+
+void util_log_set_level(int prio)
+{
+	util_log_level = prio;
+}
+
+void util_log_print(int prio, const char *func, int line, const char *fmt, ...)
+{
+	struct util_log_record *record = NULL;
+	struct log_ring *ring = NULL;
+	char *str = NULL;
+	guint head = 0;
+	gsize len = 0;
+	va_list ap;
+
+	va_start(ap, fmt);
+	if (prio >= DLOG_ERROR || !g_atomic_int_get(&draining)) {
+		str = g_strdup_vprintf(fmt, ap);
+		dlog_print(prio, LOG_TAG, "[%s:%d] %s\n", func, line, str);
+	}
+
+	ring = g_atomic_int_get(&draining) ? __log_ring_get() : NULL;
+	if (!ring)
+		goto out;
+
+	head = (guint)ring->head;
+	if (head - (guint)g_atomic_int_get(&ring->tail) >= LOG_RING_SIZE) {
+		g_atomic_int_inc(&dropped);
+		goto out;
+	}
+
+	record = &ring->records[head & (LOG_RING_SIZE - 1)];
+	record->time = g_get_real_time();
+	record->func = func;
+	record->line = line;
+	record->tid = ring->tid;
+	record->prio = prio;
+	if (str)
+		len = g_strlcpy(record->msg, str, sizeof(record->msg));
+	else
+		len = g_vsnprintf(record->msg, sizeof(record->msg), fmt, ap);
+	__log_msg_truncate(record->msg, len);
+
+	/* publishes the record to the drainer */
+	g_atomic_int_set(&ring->head, (gint)(head + 1));
+
+out:
+	va_end(ap);
+	g_free(str);
+}
+
+void util_log_foreach(guint64 since, util_log_foreach_cb callback,
+				gpointer user_data)
+{
+	guint64 seq = 1;
+
+	ret_if(!callback);
+
+	g_mutex_lock(&history_lock);
+	if (history_seq > LOG_HISTORY_SIZE)
+		seq = history_seq - LOG_HISTORY_SIZE + 1;
+	if (seq <= since)
+		seq = since + 1;
+
+	for (; seq <= history_seq; seq++)
+		callback(&history[(seq - 1) % LOG_HISTORY_SIZE], user_data);
+	g_mutex_unlock(&history_lock);
+}
+
+guint64 util_log_get_dropped(void)
+{
+	return (guint)g_atomic_int_get(&dropped);
+}
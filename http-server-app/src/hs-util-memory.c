@@ -0,0 +1,292 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <glib.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "http-server-log-private.h"
+#include "hs-util-memory.h"
+#include "hs-util-pressure.h"
+
+#define MEMORY_PROFILE_ENV "HTTP_SERVER_MEMORY_PROFILE"
+
+/* devices up to this much memory get the low profile on their own */
+#define MEMORY_LOW_TOTAL_KB (512 * 1024)
+
+#define MEMORY_DEFAULT_BUDGET (64 * 1024 * 1024)
+#define MEMORY_LOW_BUDGET (8 * 1024 * 1024)
+
+/* instead of 8 MiB, which is mostly untouched but counts to the commit */
+#define MEMORY_LOW_STACK_SIZE (256 * 1024)
+
+/* instead of 8 per core, each of which keeps its own free memory */
+#define MEMORY_LOW_ARENA_MAX 2
+
+/* big buffers go to mmap, so they are returned as soon as they are freed */
+#define MEMORY_LOW_MMAP_THRESHOLD (128 * 1024)
+#define MEMORY_LOW_TRIM_THRESHOLD (128 * 1024)
+
+/* free heap above this after a burst is given back */
+#define MEMORY_TRIM_INTERVAL_SEC 5
+#define MEMORY_TRIM_MIN_FREE (512 * 1024)
+#define MEMORY_TRIM_PAD (64 * 1024)
+
+struct memory_account {
+	const char *name;
+	gsize used;
+	gsize peak;
+	guint64 refused;
+};
+
+static GMutex memory_lock;
+static enum util_memory_profile profile;
+static gsize budget = MEMORY_DEFAULT_BUDGET;
+static gsize used;
+static guint trim_source;
+static struct memory_account accounts[UTIL_MEMORY_ACCOUNT_MAX] = {
+	[UTIL_MEMORY_REQUEST_BODIES] = { .name = "requestBodies" },
+	[UTIL_MEMORY_RESPONSE_CACHE] = { .name = "responseCache" },
+	[UTIL_MEMORY_STREAMS] = { .name = "streams" },
+	[UTIL_MEMORY_THUMBNAILS] = { .name = "thumbnails" },
+};
+
+#ifndef HS_LOW_MEMORY
+static gboolean __memory_is_small(void)
+{
+	guint64 total_kb = util_pressure_get()->mem_total_kb;
+
+	return total_kb && total_kb <= MEMORY_LOW_TOTAL_KB;
+}
+#endif
+
+static enum util_memory_profile __memory_profile_pick(void)
+{
+	const char *env = g_getenv(MEMORY_PROFILE_ENV);
+
+	if (!g_strcmp0(env, "low"))
+		return UTIL_MEMORY_PROFILE_LOW;
+	if (!g_strcmp0(env, "default"))
+		return UTIL_MEMORY_PROFILE_DEFAULT;
+
+#ifdef HS_LOW_MEMORY
+	return UTIL_MEMORY_PROFILE_LOW;
+#else
+	return __memory_is_small() ?
+		UTIL_MEMORY_PROFILE_LOW : UTIL_MEMORY_PROFILE_DEFAULT;
+#endif
+}
+
+static int __memory_stack_size_set(gsize size)
+{
+	pthread_attr_t attr;
+	int ret = 0;
+
+	ret = pthread_attr_init(&attr);
+	retv_if(ret, -1);
+
+	ret = pthread_attr_setstacksize(&attr, size);
+	if (!ret)
+		ret = pthread_setattr_default_np(&attr);
+	pthread_attr_destroy(&attr);
+
+	retvm_if(ret, -1, "failed to set the default stack size - %d", ret);
+
+	return 0;
+}
+
+static gboolean __memory_trim_cb(gpointer user_data)
+{
+	gsize in_use = 0;
+	gsize free_bytes = 0;
+
+	util_memory_get_heap(&in_use, &free_bytes);
+	if (free_bytes < MEMORY_TRIM_MIN_FREE)
+		return G_SOURCE_CONTINUE;
+
+	malloc_trim(MEMORY_TRIM_PAD);
+	_D("heap trimmed, [%zu] bytes were free", free_bytes);
+
+	return G_SOURCE_CONTINUE;
+}
+
+int util_memory_init(void)
+{
+	profile = __memory_profile_pick();
+	if (profile != UTIL_MEMORY_PROFILE_LOW) {
+		budget = MEMORY_DEFAULT_BUDGET;
+		return 0;
+	}
+
+	budget = MEMORY_LOW_BUDGET;
+
+	/* best effort, each of them saves what it can on its own */
+	__memory_stack_size_set(MEMORY_LOW_STACK_SIZE);
+	if (!mallopt(M_ARENA_MAX, MEMORY_LOW_ARENA_MAX))
+		_W("failed to limit malloc arenas");
+	if (!mallopt(M_MMAP_THRESHOLD, MEMORY_LOW_MMAP_THRESHOLD)
+		|| !mallopt(M_TRIM_THRESHOLD, MEMORY_LOW_TRIM_THRESHOLD))
+		_W("failed to set malloc thresholds");
+
+	trim_source = g_timeout_add_seconds(MEMORY_TRIM_INTERVAL_SEC,
+				__memory_trim_cb, NULL);
+
+	_I("low memory profile, budget of [%zu] bytes", budget);
+
+	return 0;
+}
+
+void util_memory_fini(void)
+{
+	if (trim_source)
+		g_source_remove(trim_source);
+	trim_source = 0;
+}
+
+enum util_memory_profile util_memory_get_profile(void)
+{
+	return profile;
+}
+
+const char *util_memory_profile_to_str(enum util_memory_profile p)
+{
+	return p == UTIL_MEMORY_PROFILE_LOW ? "low" : "default";
+}
+
+static void __memory_account_add(struct memory_account *account, gsize bytes)
+{
+	used += bytes;
+	account->used += bytes;
+	if (account->used > account->peak)
+		account->peak = account->used;
+}
+
+gboolean util_memory_charge(enum util_memory_account account, gsize bytes)
+{
+	gboolean fits = FALSE;
+
+	retv_if(account >= UTIL_MEMORY_ACCOUNT_MAX, FALSE);
+
+	g_mutex_lock(&memory_lock);
+	fits = bytes <= budget && used <= budget - bytes;
+	if (fits)
+		__memory_account_add(&accounts[account], bytes);
+	else
+		accounts[account].refused++;
+	g_mutex_unlock(&memory_lock);
+
+	return fits;
+}
+
+void util_memory_charge_force(enum util_memory_account account, gsize bytes)
+{
+	ret_if(account >= UTIL_MEMORY_ACCOUNT_MAX);
+
+	g_mutex_lock(&memory_lock);
+	__memory_account_add(&accounts[account], bytes);
+	g_mutex_unlock(&memory_lock);
+}
+
+void util_memory_uncharge(enum util_memory_account account, gsize bytes)
+{
+	ret_if(account >= UTIL_MEMORY_ACCOUNT_MAX);
+
+	g_mutex_lock(&memory_lock);
+	bytes = MIN(bytes, accounts[account].used);
+	accounts[account].used -= bytes;
+	used -= bytes;
+	g_mutex_unlock(&memory_lock);
+}
+
+gboolean util_memory_is_over_budget(void)
+{
+	gboolean over = FALSE;
+
+	g_mutex_lock(&memory_lock);
+	over = used >= budget;
+	g_mutex_unlock(&memory_lock);
+
+	return over;
+}
+
+gsize util_memory_get_budget(void)
+{
+	return budget;
+}
+
+gsize util_memory_get_used(void)
+{
+	gsize value = 0;
+
+	g_mutex_lock(&memory_lock);
+	value = used;
+	g_mutex_unlock(&memory_lock);
+
+	return value;
+}
+
+void util_memory_foreach_account(util_memory_account_cb callback,
+				gpointer user_data)
+{
+	struct memory_account copy[UTIL_MEMORY_ACCOUNT_MAX];
+	int i = 0;
+
+	ret_if(!callback);
+
+	g_mutex_lock(&memory_lock);
+	memcpy(copy, accounts, sizeof(copy));
+	g_mutex_unlock(&memory_lock);
+
+	for (i = 0; i < UTIL_MEMORY_ACCOUNT_MAX; i++)
+		callback(copy[i].name, copy[i].used, copy[i].peak, copy[i].refused,
+			user_data);
+}
+
+void util_memory_get_heap(gsize *in_use, gsize *free_bytes)
+{
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+	struct mallinfo2 info = mallinfo2();
+#else
+	struct mallinfo info = mallinfo();
+#endif
+
+	/* both main arena and mmapped blocks count as in use */
+	if (in_use)
+		*in_use = (gsize)info.uordblks + (gsize)info.hblkhd;
+	if (free_bytes)
+		*free_bytes = (gsize)info.fordblks;
+}
+
+gsize util_memory_get_rss(void)
+{
+	unsigned long size = 0;
+	unsigned long pages = 0;
+	char *contents = NULL;
+
+	if (!g_file_get_contents("/proc/self/statm", &contents, NULL, NULL))
+		return 0;
+
+	if (sscanf(contents, "%lu %lu", &size, &pages) != 2)
+		pages = 0;
+	g_free(contents);
+
+	return (gsize)pages * sysconf(_SC_PAGESIZE);
+}
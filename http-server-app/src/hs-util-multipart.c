@@ -0,0 +1,283 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include <libsoup/soup.h>
+#include "http-server-log-private.h"
+#include "hs-util-multipart.h"
+
+#define MULTIPART_MAX_BOUNDARY 70
+#define MULTIPART_MAX_HEADERS (8 * 1024)
+
+enum multipart_state {
+	MULTIPART_STATE_PREAMBLE,
+	MULTIPART_STATE_BOUNDARY_END,
+	MULTIPART_STATE_HEADERS,
+	MULTIPART_STATE_BODY,
+	MULTIPART_STATE_DONE,
+	MULTIPART_STATE_ERROR,
+};
+
+struct util_multipart_parser {
+	enum multipart_state state;
+	char *delimiter;
+	gsize delimiter_len;
+	GByteArray *buf;
+	const struct util_multipart_callbacks *callbacks;
+	gpointer user_data;
+};
+
+static gssize __find(const guint8 *data, gsize len, const char *needle, gsize needle_len)
+{
+	gsize i = 0;
+
+	while (i + needle_len <= len) {
+		const guint8 *p = memchr(data + i, needle[0], len - needle_len - i + 1);
+		if (!p)
+			return -1;
+
+		i = p - data;
+		if (0 == memcmp(p, needle, needle_len))
+			return i;
+		i++;
+	}
+
+	return -1;
+}
+
+static gboolean __emit_data(struct util_multipart_parser *parser, gsize len)
+{
+	gboolean ret = TRUE;
+
+	if (!len)
+		return TRUE;
+
+	if (parser->state == MULTIPART_STATE_BODY && parser->callbacks->part_data)
+		ret = parser->callbacks->part_data((const char *)parser->buf->data,
+						len, parser->user_data);
+
+	g_byte_array_remove_range(parser->buf, 0, len);
+
+	return ret;
+}
+
+/* Returns FALSE when more data is needed */
+static gboolean __parse_delimited(struct util_multipart_parser *parser)
+{
+	gssize pos = __find(parser->buf->data, parser->buf->len,
+				parser->delimiter, parser->delimiter_len);
+
+	if (pos < 0) {
+		/* the tail may be the beginning of a delimiter */
+		gsize keep = parser->delimiter_len - 1;
+		if (parser->buf->len > keep
+			&& !__emit_data(parser, parser->buf->len - keep))
+			parser->state = MULTIPART_STATE_ERROR;
+		return FALSE;
+	}
+
+	if (!__emit_data(parser, pos)) {
+		parser->state = MULTIPART_STATE_ERROR;
+		return TRUE;
+	}
+
+	if (parser->state == MULTIPART_STATE_BODY && parser->callbacks->part_end
+		&& !parser->callbacks->part_end(parser->user_data)) {
+		parser->state = MULTIPART_STATE_ERROR;
+		return TRUE;
+	}
+
+	g_byte_array_remove_range(parser->buf, 0, parser->delimiter_len);
+	parser->state = MULTIPART_STATE_BOUNDARY_END;
+
+	return TRUE;
+}
+
+static gboolean __parse_boundary_end(struct util_multipart_parser *parser)
+{
+	guint8 *data = parser->buf->data;
+
+	/* transport padding */
+	while (parser->buf->len && (data[0] == ' ' || data[0] == '\t'))
+		g_byte_array_remove_range(parser->buf, 0, 1);
+
+	if (parser->buf->len < 2)
+		return FALSE;
+
+	if (data[0] == '-' && data[1] == '-') {
+		parser->state = MULTIPART_STATE_DONE;
+		g_byte_array_set_size(parser->buf, 0);
+	} else if (data[0] == '\r' && data[1] == '\n') {
+		parser->state = MULTIPART_STATE_HEADERS;
+		g_byte_array_remove_range(parser->buf, 0, 2);
+	} else {
+		_E("malformed multipart boundary");
+		parser->state = MULTIPART_STATE_ERROR;
+	}
+
+	return TRUE;
+}
+
+static gboolean __parse_headers(struct util_multipart_parser *parser)
+{
+	SoupMessageHeaders *headers = NULL;
+	char *block = NULL;
+	gssize end = 0;
+	gsize block_len = 0;
+	gboolean ret = TRUE;
+
+	if (parser->buf->len >= 2 && 0 == memcmp(parser->buf->data, "\r\n", 2)) {
+		end = 0;
+		block_len = 2;
+	} else {
+		end = __find(parser->buf->data, parser->buf->len, "\r\n\r\n", 4);
+		if (end < 0) {
+			if (parser->buf->len > MULTIPART_MAX_HEADERS) {
+				_E("multipart headers are too big");
+				parser->state = MULTIPART_STATE_ERROR;
+				return TRUE;
+			}
+			return FALSE;
+		}
+		block_len = end + 4;
+	}
+
+	/* soup_headers_parse() skips the first line, as for the boundary line */
+	block = g_strdup_printf("--\r\n%.*s", (int)block_len, parser->buf->data);
+	headers = soup_message_headers_new(SOUP_MESSAGE_HEADERS_MULTIPART);
+
+	if (!soup_headers_parse(block, strlen(block), headers)) {
+		_E("malformed multipart headers");
+		parser->state = MULTIPART_STATE_ERROR;
+		goto OUT;
+	}
+
+	g_byte_array_remove_range(parser->buf, 0, block_len);
+	parser->state = MULTIPART_STATE_BODY;
+
+	if (parser->callbacks->part_begin)
+		ret = parser->callbacks->part_begin(headers, parser->user_data);
+	if (!ret)
+		parser->state = MULTIPART_STATE_ERROR;
+
+OUT:
+	soup_message_headers_free(headers);
+	g_free(block);
+
+	return TRUE;
+}
+
+gboolean util_multipart_parser_feed(struct util_multipart_parser *parser,
+				const char *data, gsize len)
+{
+	gboolean progress = TRUE;
+
+	retv_if(!parser, FALSE);
+
+	if (parser->state == MULTIPART_STATE_ERROR)
+		return FALSE;
+
+	if (parser->state == MULTIPART_STATE_DONE)
+		return TRUE;
+
+	g_byte_array_append(parser->buf, (const guint8 *)data, len);
+
+	while (progress) {
+		switch (parser->state) {
+		case MULTIPART_STATE_PREAMBLE:
+		case MULTIPART_STATE_BODY:
+			progress = __parse_delimited(parser);
+			break;
+		case MULTIPART_STATE_BOUNDARY_END:
+			progress = __parse_boundary_end(parser);
+			break;
+		case MULTIPART_STATE_HEADERS:
+			progress = __parse_headers(parser);
+			break;
+		case MULTIPART_STATE_DONE:
+			return TRUE;
+		case MULTIPART_STATE_ERROR:
+			return FALSE;
+		}
+	}
+
+	return parser->state != MULTIPART_STATE_ERROR;
+}
+
+gboolean util_multipart_parser_is_done(struct util_multipart_parser *parser)
+{
+	retv_if(!parser, FALSE);
+
+	return parser->state == MULTIPART_STATE_DONE;
+}
+
+struct util_multipart_parser *
+util_multipart_parser_new(const char *boundary,
+				const struct util_multipart_callbacks *callbacks,
+				gpointer user_data)
+{
+	struct util_multipart_parser *parser = NULL;
+
+	retv_if(!boundary, NULL);
+	retv_if(!callbacks, NULL);
+	retvm_if(strlen(boundary) > MULTIPART_MAX_BOUNDARY, NULL,
+		"boundary is too long");
+
+	parser = g_try_new0(struct util_multipart_parser, 1);
+	retvm_if(!parser, NULL, "failed to alloc multipart parser");
+
+	parser->state = MULTIPART_STATE_PREAMBLE;
+	parser->delimiter = g_strconcat("\r\n--", boundary, NULL);
+	parser->delimiter_len = strlen(parser->delimiter);
+	parser->callbacks = callbacks;
+	parser->user_data = user_data;
+
+	/* lets the first boundary match the delimiter as well */
+	parser->buf = g_byte_array_new();
+	g_byte_array_append(parser->buf, (const guint8 *)"\r\n", 2);
+
+	return parser;
+}
+
+void util_multipart_parser_free(struct util_multipart_parser *parser)
+{
+	if (!parser)
+		return;
+
+	g_byte_array_free(parser->buf, TRUE);
+	g_free(parser->delimiter);
+	g_free(parser);
+}
+
+char *util_multipart_get_boundary(SoupMessage *msg)
+{
+	GHashTable *params = NULL;
+	const char *content_type = NULL;
+	char *boundary = NULL;
+
+	retv_if(!msg, NULL);
+
+	content_type = soup_message_headers_get_content_type(msg->request_headers,
+								&params);
+	if (content_type && !g_ascii_strcasecmp(content_type, "multipart/form-data"))
+		boundary = g_strdup(g_hash_table_lookup(params, "boundary"));
+
+	if (params)
+		g_hash_table_destroy(params);
+
+	return boundary;
+}
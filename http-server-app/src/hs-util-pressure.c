@@ -0,0 +1,162 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include "http-server-log-private.h"
+#include "hs-util-pressure.h"
+
+#define PRESSURE_SAMPLE_INTERVAL_US G_USEC_PER_SEC
+
+/* avg10 stall percentages */
+#define PRESSURE_HIGH_CPU 60.0
+#define PRESSURE_HIGH_MEMORY 10.0
+#define PRESSURE_HIGH_IO 30.0
+#define PRESSURE_CRITICAL_MEMORY 40.0
+#define PRESSURE_CRITICAL_MEMORY_FULL 10.0
+#define PRESSURE_CRITICAL_IO 60.0
+
+/* available memory in percent of the total */
+#define PRESSURE_HIGH_MEM_AVAILABLE 15
+#define PRESSURE_CRITICAL_MEM_AVAILABLE 5
+
+static struct util_pressure pressure;
+static gint64 last_sampled;
+static gboolean psi_unsupported;
+
+static gboolean __psi_read(const char *resource, double *some, double *full)
+{
+	char path[64];
+	char *contents = NULL;
+	char *line = NULL;
+
+	snprintf(path, sizeof(path), "/proc/pressure/%s", resource);
+	if (!g_file_get_contents(path, &contents, NULL, NULL))
+		return FALSE;
+
+	if (sscanf(contents, "some avg10=%lf", some) != 1)
+		*some = 0.0;
+
+	/* the cpu line of full is there since 5.13, and always zero */
+	if (full) {
+		line = strstr(contents, "full avg10=");
+		if (!line || sscanf(line, "full avg10=%lf", full) != 1)
+			*full = 0.0;
+	}
+
+	g_free(contents);
+
+	return TRUE;
+}
+
+static void __meminfo_read(struct util_pressure *p)
+{
+	char *contents = NULL;
+	char *line = NULL;
+	unsigned long long value = 0;
+
+	if (!g_file_get_contents("/proc/meminfo", &contents, NULL, NULL))
+		return;
+
+	line = strstr(contents, "MemTotal:");
+	if (line && sscanf(line, "MemTotal: %llu", &value) == 1)
+		p->mem_total_kb = value;
+
+	line = strstr(contents, "MemAvailable:");
+	if (line && sscanf(line, "MemAvailable: %llu", &value) == 1)
+		p->mem_available_kb = value;
+
+	g_free(contents);
+}
+
+static enum util_pressure_level __pressure_level(const struct util_pressure *p)
+{
+	guint64 available = 100;
+
+	if (p->mem_total_kb)
+		available = p->mem_available_kb * 100 / p->mem_total_kb;
+
+	if (p->memory_some >= PRESSURE_CRITICAL_MEMORY
+		|| p->memory_full >= PRESSURE_CRITICAL_MEMORY_FULL
+		|| p->io_some >= PRESSURE_CRITICAL_IO
+		|| available < PRESSURE_CRITICAL_MEM_AVAILABLE)
+		return UTIL_PRESSURE_CRITICAL;
+
+	/* cpu alone only slows things down, it never gets critical */
+	if (p->cpu_some >= PRESSURE_HIGH_CPU
+		|| p->memory_some >= PRESSURE_HIGH_MEMORY
+		|| p->io_some >= PRESSURE_HIGH_IO
+		|| available < PRESSURE_HIGH_MEM_AVAILABLE)
+		return UTIL_PRESSURE_HIGH;
+
+	return UTIL_PRESSURE_NONE;
+}
+
+static void __pressure_sample(void)
+{
+	struct util_pressure p;
+	enum util_pressure_level old_level = pressure.level;
+
+	memset(&p, 0, sizeof(p));
+
+	/* kernels before 4.20, or without CONFIG_PSI */
+	if (!psi_unsupported) {
+		p.psi = __psi_read("cpu", &p.cpu_some, NULL)
+			&& __psi_read("memory", &p.memory_some, &p.memory_full)
+			&& __psi_read("io", &p.io_some, NULL);
+		if (!p.psi) {
+			_W("PSI is not supported, only memory headroom is used");
+			psi_unsupported = TRUE;
+			p.cpu_some = p.memory_some = p.memory_full = p.io_some = 0.0;
+		}
+	}
+
+	__meminfo_read(&p);
+	p.level = __pressure_level(&p);
+
+	if (p.level != old_level)
+		_W("system pressure is [%s] - cpu %.1f, memory %.1f, io %.1f, "
+			"available %llu kB", util_pressure_level_to_str(p.level),
+			p.cpu_some, p.memory_some, p.io_some,
+			(unsigned long long)p.mem_available_kb);
+
+	pressure = p;
+}
+
+const struct util_pressure *util_pressure_get(void)
+{
+	gint64 now = g_get_monotonic_time();
+
+	if (!last_sampled || now - last_sampled >= PRESSURE_SAMPLE_INTERVAL_US) {
+		__pressure_sample();
+		last_sampled = now;
+	}
+
+	return &pressure;
+}
+
+const char *util_pressure_level_to_str(enum util_pressure_level level)
+{
+	switch (level) {
+	case UTIL_PRESSURE_HIGH:
+		return "high";
+	case UTIL_PRESSURE_CRITICAL:
+		return "critical";
+	default:
+		return "none";
+	}
+}
@@ -0,0 +1,277 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <glib.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/time.h>
+#include "http-server-log-private.h"
+#include "hs-util-profile.h"
+
+#define PROFILE_MAX_DEPTH 32
+
+/* the signal handler and the signal trampoline */
+#define PROFILE_SKIP_FRAMES 2
+
+struct profile_sample {
+	int tid;
+	int depth;
+	void *frames[PROFILE_MAX_DEPTH];
+};
+
+static struct profile_sample *samples;
+static guint samples_max;
+static gint samples_count;
+static gint handlers_running;
+static gint sampling;
+static gboolean running;
+static gboolean handler_installed;
+
+/*
+ * Runs on whichever thread was using the cpu. It only claims a slot and
+ * unwinds into it, backtrace() was called once before so it does not
+ * need to load libgcc here. It stays installed once profiling stopped,
+ * a SIGPROF still pending then is simply dropped.
+ */
+static void __profile_signal_handler(int signo)
+{
+	struct profile_sample *sample = NULL;
+	int saved_errno = errno;
+	guint i = 0;
+
+	g_atomic_int_inc(&handlers_running);
+	if (!g_atomic_int_get(&sampling))
+		goto out;
+
+	i = (guint)g_atomic_int_add(&samples_count, 1);
+	if (i < samples_max) {
+		sample = &samples[i];
+		sample->tid = (int)syscall(SYS_gettid);
+		sample->depth = backtrace(sample->frames, PROFILE_MAX_DEPTH);
+	}
+
+out:
+	g_atomic_int_add(&handlers_running, -1);
+	errno = saved_errno;
+}
+
+static int __profile_timer_set(unsigned int hz)
+{
+	struct itimerval timer;
+
+	memset(&timer, 0, sizeof(timer));
+	if (hz) {
+		timer.it_interval.tv_usec = G_USEC_PER_SEC / hz;
+		timer.it_value = timer.it_interval;
+	}
+
+	return setitimer(ITIMER_PROF, &timer, NULL);
+}
+
+int util_profile_start(unsigned int hz, unsigned int max_samples)
+{
+	struct sigaction action;
+	void *frame = NULL;
+
+	retvm_if(running, -1, "profile is already running");
+	retvm_if(!hz || hz > UTIL_PROFILE_MAX_HZ, -1, "invalid rate [%u]", hz);
+	retvm_if(!max_samples, -1, "invalid max_samples");
+
+	g_free(samples);
+	samples = g_try_new(struct profile_sample, max_samples);
+	retvm_if(!samples, -1, "failed to alloc %u samples", max_samples);
+	samples_max = max_samples;
+	g_atomic_int_set(&samples_count, 0);
+
+	backtrace(&frame, 1);
+
+	if (!handler_installed) {
+		memset(&action, 0, sizeof(action));
+		action.sa_handler = __profile_signal_handler;
+		action.sa_flags = SA_RESTART;
+		sigemptyset(&action.sa_mask);
+		if (sigaction(SIGPROF, &action, NULL)) {
+			_E("failed to sigaction - %d", errno);
+			return -1;
+		}
+		handler_installed = TRUE;
+	}
+
+	g_atomic_int_set(&sampling, 1);
+	if (__profile_timer_set(hz)) {
+		_E("failed to setitimer - %d", errno);
+		g_atomic_int_set(&sampling, 0);
+		return -1;
+	}
+	running = TRUE;
+
+	_I("profiling at %u Hz", hz);
+
+	return 0;
+}
+
+void util_profile_stop(void)
+{
+	ret_if(!running);
+
+	/* the default action of SIGPROF is to terminate, the handler stays */
+	__profile_timer_set(0);
+	g_atomic_int_set(&sampling, 0);
+
+	/* a signal which was already on its way may still be unwinding */
+	while (g_atomic_int_get(&handlers_running))
+		g_usleep(1000);
+
+	running = FALSE;
+
+	_I("profile done, %u samples", util_profile_get_samples());
+}
+
+gboolean util_profile_is_running(void)
+{
+	return running;
+}
+
+guint util_profile_get_samples(void)
+{
+	return MIN((guint)g_atomic_int_get(&samples_count), samples_max);
+}
+
+guint util_profile_get_dropped(void)
+{
+	guint count = (guint)g_atomic_int_get(&samples_count);
+
+	return count > samples_max ? count - samples_max : 0;
+}
+
+void util_profile_clear(void)
+{
+	ret_if(running);
+
+	g_free(samples);
+	samples = NULL;
+	samples_max = 0;
+	g_atomic_int_set(&samples_count, 0);
+}
+
+char *util_profile_symbol_name(const void *addr)
+{
+	Dl_info info;
+
+	memset(&info, 0, sizeof(info));
+	if (dladdr(addr, &info) && info.dli_sname)
+		return g_strdup(info.dli_sname);
+
+	if (info.dli_fname)
+		return g_strdup_printf("%s+0x%lx", strrchr(info.dli_fname, '/')
+					? strrchr(info.dli_fname, '/') + 1 : info.dli_fname,
+					(unsigned long)((const char *)addr - (const char *)info.dli_fbase));
+
+	return g_strdup_printf("0x%lx", (unsigned long)addr);
+}
+
+static const char *__profile_symbol(GHashTable *symbols, void *addr)
+{
+	char *name = g_hash_table_lookup(symbols, addr);
+
+	if (name)
+		return name;
+
+	name = util_profile_symbol_name(addr);
+	g_hash_table_insert(symbols, addr, name);
+
+	return name;
+}
+
+static const char *__profile_thread_name(GHashTable *threads, int tid)
+{
+	char path[64];
+	char *name = g_hash_table_lookup(threads, GINT_TO_POINTER(tid));
+
+	if (name)
+		return name;
+
+	snprintf(path, sizeof(path), "/proc/self/task/%d/comm", tid);
+	if (g_file_get_contents(path, &name, NULL, NULL))
+		g_strchomp(name);
+	else
+		name = g_strdup_printf("thread-%d", tid);
+
+	g_hash_table_insert(threads, GINT_TO_POINTER(tid), name);
+
+	return name;
+}
+
+void util_profile_foreach(util_profile_foreach_cb callback, gpointer user_data)
+{
+	struct profile_sample *sample = NULL;
+	GHashTable *symbols = NULL;
+	GHashTable *threads = NULL;
+	GHashTable *stacks = NULL;
+	GHashTableIter iter;
+	gpointer key = NULL;
+	gpointer value = NULL;
+	GString *stack = NULL;
+	char *addr = NULL;
+	guint count = 0;
+	guint i = 0;
+	int j = 0;
+
+	ret_if(!callback);
+	ret_if(running || !samples);
+
+	symbols = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	threads = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+	stacks = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	stack = g_string_sized_new(256);
+
+	count = util_profile_get_samples();
+	for (i = 0; i < count; i++) {
+		sample = &samples[i];
+
+		g_string_assign(stack, __profile_thread_name(threads, sample->tid));
+		for (j = sample->depth - 1; j >= PROFILE_SKIP_FRAMES; j--) {
+			/* a return address may already belong to the next line */
+			addr = sample->frames[j];
+			if (j > PROFILE_SKIP_FRAMES)
+				addr--;
+			g_string_append_c(stack, ';');
+			g_string_append(stack, __profile_symbol(symbols, addr));
+		}
+
+		value = g_hash_table_lookup(stacks, stack->str);
+		g_hash_table_replace(stacks, g_strdup(stack->str),
+					GUINT_TO_POINTER(GPOINTER_TO_UINT(value) + 1));
+	}
+
+	g_hash_table_iter_init(&iter, stacks);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+		callback(key, GPOINTER_TO_UINT(value), user_data);
+
+	g_string_free(stack, TRUE);
+	g_hash_table_destroy(stacks);
+	g_hash_table_destroy(threads);
+	g_hash_table_destroy(symbols);
+}
@@ -0,0 +1,582 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <image_util.h>
+#include "http-server-log-private.h"
+#include "hs-util-memory.h"
+#include "hs-util-thumbnail.h"
+
+#define THUMBNAIL_DIR_NAME ".thumbs"
+#define THUMBNAIL_WORKERS 2
+#define THUMBNAIL_QUALITY 85
+
+/* images this big are refused before anything is decoded */
+#define THUMBNAIL_MAX_PIXELS (64 * 1024 * 1024)
+/* RGBA pixels decoded at once, after the JPEG downscale */
+#define THUMBNAIL_MAX_DECODED_PIXELS (8 * 1024 * 1024)
+#define THUMBNAIL_LOW_MAX_DECODED_PIXELS (4 * 1024 * 1024)
+
+#define THUMBNAIL_JPEG_MAX_SEGMENTS 256
+
+static const guint thumbnail_widths[] = { 160, 320, 640 };
+
+struct thumbnail_waiter {
+	util_thumbnail_cb callback;
+	gpointer user_data;
+};
+
+struct thumbnail_variant {
+	guint width;
+	char *path;
+	int error;
+};
+
+struct thumbnail_job {
+	char *image_path;
+	struct thumbnail_variant variants[G_N_ELEMENTS(thumbnail_widths)];
+	guint n_variants;
+};
+
+static struct {
+	GThreadPool *pool;
+	GHashTable *inflight;
+} thumbnail;
+
+static void __thumbnail_job_free(struct thumbnail_job *job)
+{
+	guint i = 0;
+
+	for (i = 0; i < job->n_variants; i++)
+		g_free(job->variants[i].path);
+
+	g_free(job->image_path);
+	g_free(job);
+}
+
+/* worker thread, walks the segments up to the frame header */
+static gboolean __thumbnail_probe_jpeg(FILE *fp, guint *width, guint *height)
+{
+	guint8 seg[5];
+	int marker = 0;
+	int i = 0;
+
+	if (fseek(fp, 2, SEEK_SET))
+		return FALSE;
+
+	for (i = 0; i < THUMBNAIL_JPEG_MAX_SEGMENTS; i++) {
+		if (fgetc(fp) != 0xff)
+			return FALSE;
+		do {
+			marker = fgetc(fp);
+		} while (marker == 0xff);
+
+		if (marker == EOF || marker == 0xd9 || marker == 0xda)
+			return FALSE;
+		if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd8))
+			continue;
+
+		if (fread(seg, 1, 2, fp) != 2 || (seg[0] << 8 | seg[1]) < 2)
+			return FALSE;
+
+		/* SOF0 to SOF15, but DHT, JPG and DAC */
+		if (marker >= 0xc0 && marker <= 0xcf
+			&& marker != 0xc4 && marker != 0xc8 && marker != 0xcc) {
+			if (fread(seg, 1, 5, fp) != 5)
+				return FALSE;
+			*height = seg[1] << 8 | seg[2];
+			*width = seg[3] << 8 | seg[4];
+			return TRUE;
+		}
+
+		if (fseek(fp, (seg[0] << 8 | seg[1]) - 2, SEEK_CUR))
+			return FALSE;
+	}
+
+	return FALSE;
+}
+
+/* worker thread, reads the size from the header of the formats decoded */
+static gboolean __thumbnail_probe(const char *path, gboolean *jpeg,
+				guint *width, guint *height)
+{
+	guint8 h[26];
+	gboolean found = FALSE;
+	gsize len = 0;
+	FILE *fp = NULL;
+
+	fp = fopen(path, "rb");
+	retvm_if(!fp, FALSE, "failed to open [%s] - %s", path, g_strerror(errno));
+
+	len = fread(h, 1, sizeof(h), fp);
+	*jpeg = len >= 2 && h[0] == 0xff && h[1] == 0xd8;
+
+	if (*jpeg) {
+		found = __thumbnail_probe_jpeg(fp, width, height);
+	} else if (len >= 24 && !memcmp(h, "\x89PNG\r\n\x1a\n", 8)) {
+		*width = (guint)h[16] << 24 | h[17] << 16 | h[18] << 8 | h[19];
+		*height = (guint)h[20] << 24 | h[21] << 16 | h[22] << 8 | h[23];
+		found = TRUE;
+	} else if (len >= 10
+		&& (!memcmp(h, "GIF87a", 6) || !memcmp(h, "GIF89a", 6))) {
+		*width = h[6] | h[7] << 8;
+		*height = h[8] | h[9] << 8;
+		found = TRUE;
+	} else if (len >= 26 && h[0] == 'B' && h[1] == 'M') {
+		/* negative for top-down bitmaps */
+		*width = ABS((gint32)((guint32)h[21] << 24 | h[20] << 16
+					| h[19] << 8 | h[18]));
+		*height = ABS((gint32)((guint32)h[25] << 24 | h[24] << 16
+					| h[23] << 8 | h[22]));
+		found = TRUE;
+	}
+
+	fclose(fp);
+
+	return found && *width && *height;
+}
+
+/*
+ * worker thread, the smallest JPEG scale which still covers the widest
+ * variant. Other formats are decoded as they are.
+ */
+static guint __thumbnail_downscale(gboolean jpeg, guint width)
+{
+	guint max_width = thumbnail_widths[G_N_ELEMENTS(thumbnail_widths) - 1];
+	guint scale = 8;
+
+	if (!jpeg)
+		return 1;
+
+	while (scale > 1 && (width + scale - 1) / scale < max_width)
+		scale /= 2;
+
+	return scale;
+}
+
+static image_util_scale_e __thumbnail_scale_to_util(guint scale)
+{
+	switch (scale) {
+	case 8:
+		return IMAGE_UTIL_DOWNSCALE_1_8;
+	case 4:
+		return IMAGE_UTIL_DOWNSCALE_1_4;
+	case 2:
+		return IMAGE_UTIL_DOWNSCALE_1_2;
+	default:
+		return IMAGE_UTIL_DOWNSCALE_1_1;
+	}
+}
+
+/*
+ * worker thread, the decoded pixels are RGBA and charged to the memory
+ * budget until they are freed by the caller
+ */
+static int __thumbnail_decode(const char *path, unsigned char **pixels,
+				unsigned long *width, unsigned long *height,
+				gsize *charged)
+{
+	image_util_decode_h decoder = NULL;
+	unsigned long long size = 0;
+	gboolean jpeg = FALSE;
+	guint64 pixel_count = 0;
+	guint src_w = 0;
+	guint src_h = 0;
+	guint scale = 1;
+	int ret = 0;
+
+	if (!__thumbnail_probe(path, &jpeg, &src_w, &src_h)) {
+		_E("unknown image size of [%s]", path);
+		return ENOTSUP;
+	}
+
+	scale = __thumbnail_downscale(jpeg, src_w);
+	pixel_count = (guint64)((src_w + scale - 1) / scale)
+			* ((src_h + scale - 1) / scale);
+	if ((guint64)src_w * src_h > THUMBNAIL_MAX_PIXELS
+		|| pixel_count > (util_memory_is_low() ? THUMBNAIL_LOW_MAX_DECODED_PIXELS
+						: THUMBNAIL_MAX_DECODED_PIXELS)) {
+		_E("[%s] is too large to decode - %ux%u", path, src_w, src_h);
+		return EFBIG;
+	}
+
+	if (!util_memory_charge(UTIL_MEMORY_THUMBNAILS, pixel_count * 4)) {
+		_W("no memory budget left to decode [%s]", path);
+		return ENOMEM;
+	}
+	*charged = pixel_count * 4;
+
+	ret = image_util_decode_create(&decoder);
+	retvm_if(ret != IMAGE_UTIL_ERROR_NONE, ENOMEM,
+		"failed to create decoder - %d", ret);
+
+	ret = image_util_decode_set_input_path(decoder, path);
+	if (ret == IMAGE_UTIL_ERROR_NONE)
+		ret = image_util_decode_set_colorspace(decoder,
+						IMAGE_UTIL_COLORSPACE_RGBA8888);
+	if (ret == IMAGE_UTIL_ERROR_NONE && scale > 1)
+		ret = image_util_decode_set_jpeg_downscale(decoder,
+						__thumbnail_scale_to_util(scale));
+	if (ret == IMAGE_UTIL_ERROR_NONE)
+		ret = image_util_decode_set_output_buffer(decoder, pixels);
+	if (ret == IMAGE_UTIL_ERROR_NONE)
+		ret = image_util_decode_run(decoder, width, height, &size);
+
+	image_util_decode_destroy(decoder);
+
+	if (ret != IMAGE_UTIL_ERROR_NONE) {
+		_E("failed to decode [%s] - %d", path, ret);
+		g_clear_pointer(pixels, free);
+		return ret == IMAGE_UTIL_ERROR_NOT_SUPPORTED_FORMAT ? ENOTSUP : EIO;
+	}
+
+	return 0;
+}
+
+static void __thumbnail_row_add(guint32 *restrict acc,
+				const guint8 *restrict row, gsize len)
+{
+	gsize i = 0;
+
+	/* plain loop over bytes, vectorized by the compiler */
+	for (i = 0; i < len; i++)
+		acc[i] += row[i];
+}
+
+/*
+ * Area averaging downscale of RGBA pixels. Source rows of an output row
+ * are summed into acc first, which is where most of the time goes, then
+ * each output pixel averages its columns.
+ */
+static guint8 *__thumbnail_scale(const guint8 *src, guint src_w, guint src_h,
+				guint dst_w, guint dst_h)
+{
+	guint32 *acc = NULL;
+	guint8 *dst = NULL;
+	guint x = 0;
+	guint y = 0;
+
+	acc = g_try_new(guint32, (gsize)src_w * 4);
+	dst = g_try_malloc((gsize)dst_w * dst_h * 4);
+	if (!acc || !dst) {
+		g_free(acc);
+		g_free(dst);
+		return NULL;
+	}
+
+	for (y = 0; y < dst_h; y++) {
+		guint y0 = (guint64)y * src_h / dst_h;
+		guint y1 = MAX((guint64)(y + 1) * src_h / dst_h, y0 + 1);
+		guint sy = 0;
+
+		memset(acc, 0, (gsize)src_w * 4 * sizeof(guint32));
+		for (sy = y0; sy < y1; sy++)
+			__thumbnail_row_add(acc, src + (gsize)sy * src_w * 4,
+						(gsize)src_w * 4);
+
+		for (x = 0; x < dst_w; x++) {
+			guint x0 = (guint64)x * src_w / dst_w;
+			guint x1 = MAX((guint64)(x + 1) * src_w / dst_w, x0 + 1);
+			guint32 n = (x1 - x0) * (y1 - y0);
+			guint32 sum[4] = { 0, };
+			guint8 *out = dst + ((gsize)y * dst_w + x) * 4;
+			guint sx = 0;
+			guint c = 0;
+
+			for (sx = x0; sx < x1; sx++)
+				for (c = 0; c < 4; c++)
+					sum[c] += acc[sx * 4 + c];
+
+			for (c = 0; c < 4; c++)
+				out[c] = (sum[c] + n / 2) / n;
+		}
+	}
+
+	g_free(acc);
+
+	return dst;
+}
+
+/* worker thread */
+static int __thumbnail_encode(const guint8 *pixels, guint width, guint height,
+				const char *path)
+{
+	image_util_encode_h encoder = NULL;
+	unsigned long long size = 0;
+	int ret = 0;
+
+	ret = image_util_encode_create(IMAGE_UTIL_JPEG, &encoder);
+	retvm_if(ret != IMAGE_UTIL_ERROR_NONE, ENOMEM,
+		"failed to create encoder - %d", ret);
+
+	ret = image_util_encode_set_resolution(encoder, width, height);
+	if (ret == IMAGE_UTIL_ERROR_NONE)
+		ret = image_util_encode_set_colorspace(encoder,
+						IMAGE_UTIL_COLORSPACE_RGBA8888);
+	if (ret == IMAGE_UTIL_ERROR_NONE)
+		ret = image_util_encode_set_quality(encoder, THUMBNAIL_QUALITY);
+	if (ret == IMAGE_UTIL_ERROR_NONE)
+		ret = image_util_encode_set_input_buffer(encoder, pixels);
+	if (ret == IMAGE_UTIL_ERROR_NONE)
+		ret = image_util_encode_set_output_path(encoder, path);
+	if (ret == IMAGE_UTIL_ERROR_NONE)
+		ret = image_util_encode_run(encoder, &size);
+
+	image_util_encode_destroy(encoder);
+
+	retvm_if(ret != IMAGE_UTIL_ERROR_NONE, EIO,
+		"failed to encode [%s] - %d", path, ret);
+
+	return 0;
+}
+
+/* worker thread */
+static int __thumbnail_write(const guint8 *pixels, guint width, guint height,
+				struct thumbnail_variant *variant)
+{
+	guint8 *scaled = NULL;
+	char *dir = NULL;
+	char *tmp_path = NULL;
+	guint dst_w = MIN(variant->width, width);
+	guint dst_h = MAX(((guint64)height * dst_w + width / 2) / width, 1);
+	int err = 0;
+
+	dir = g_path_get_dirname(variant->path);
+	if (g_mkdir_with_parents(dir, 0700))
+		err = errno;
+	g_free(dir);
+	retvm_if(err, err, "failed to create thumbnail dir - %s", g_strerror(err));
+
+	if (dst_w != width) {
+		scaled = __thumbnail_scale(pixels, width, height, dst_w, dst_h);
+		retvm_if(!scaled, ENOMEM, "failed to scale image");
+	}
+
+	/* no reader may see a partially written thumbnail */
+	tmp_path = g_strconcat(variant->path, ".tmp", NULL);
+	err = __thumbnail_encode(scaled ? scaled : pixels, dst_w, dst_h, tmp_path);
+	if (!err && g_rename(tmp_path, variant->path))
+		err = errno;
+	if (err)
+		g_unlink(tmp_path);
+
+	g_free(tmp_path);
+	g_free(scaled);
+
+	return err;
+}
+
+static gboolean __thumbnail_job_done(gpointer data)
+{
+	struct thumbnail_job *job = data;
+	guint i = 0;
+
+	for (i = 0; i < job->n_variants && thumbnail.inflight; i++) {
+		struct thumbnail_variant *variant = &job->variants[i];
+		GSList *waiters = g_hash_table_lookup(thumbnail.inflight, variant->path);
+		GSList *l = NULL;
+
+		g_hash_table_remove(thumbnail.inflight, variant->path);
+
+		for (l = waiters; l; l = l->next) {
+			struct thumbnail_waiter *waiter = l->data;
+			waiter->callback(variant->error ? NULL : variant->path,
+					variant->error, waiter->user_data);
+		}
+		g_slist_free_full(waiters, g_free);
+	}
+
+	__thumbnail_job_free(job);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void __thumbnail_worker(gpointer data, gpointer user_data)
+{
+	struct thumbnail_job *job = data;
+	unsigned char *pixels = NULL;
+	unsigned long width = 0;
+	unsigned long height = 0;
+	gsize charged = 0;
+	guint i = 0;
+	int err = 0;
+
+	/* decoded once for all the variants */
+	err = __thumbnail_decode(job->image_path, &pixels, &width, &height,
+				&charged);
+
+	for (i = 0; i < job->n_variants; i++) {
+		if (err)
+			job->variants[i].error = err;
+		else
+			job->variants[i].error = __thumbnail_write(pixels,
+						width, height, &job->variants[i]);
+	}
+	free(pixels);
+	util_memory_uncharge(UTIL_MEMORY_THUMBNAILS, charged);
+
+	g_idle_add(__thumbnail_job_done, job);
+}
+
+guint util_thumbnail_fit_width(guint width)
+{
+	guint i = 0;
+
+	for (i = 0; i < G_N_ELEMENTS(thumbnail_widths); i++) {
+		if (thumbnail_widths[i] >= width)
+			return thumbnail_widths[i];
+	}
+
+	return 0;
+}
+
+char *util_thumbnail_get_path(const char *image_path, const char *id, guint width)
+{
+	char *dir = NULL;
+	char *name = NULL;
+	char *path = NULL;
+
+	retv_if(!image_path, NULL);
+	retv_if(!id, NULL);
+
+	dir = g_path_get_dirname(image_path);
+	name = g_strdup_printf("%s-%u.jpg", id, width);
+	path = g_build_filename(dir, THUMBNAIL_DIR_NAME, name, NULL);
+	g_free(name);
+	g_free(dir);
+
+	return path;
+}
+
+void util_thumbnail_generate(const char *image_path, const char *id, guint width,
+				util_thumbnail_cb callback, gpointer user_data)
+{
+	struct thumbnail_job *job = NULL;
+	guint i = 0;
+
+	if (!thumbnail.pool || !image_path || !id
+		|| (width && util_thumbnail_fit_width(width) != width)) {
+		if (callback)
+			callback(NULL, EINVAL, user_data);
+		return;
+	}
+
+	job = g_new0(struct thumbnail_job, 1);
+
+	for (i = 0; i < G_N_ELEMENTS(thumbnail_widths); i++) {
+		struct thumbnail_waiter *waiter = NULL;
+		GSList *waiters = NULL;
+		char *path = NULL;
+		gboolean inflight = FALSE;
+
+		if (width && thumbnail_widths[i] != width)
+			continue;
+
+		path = util_thumbnail_get_path(image_path, id, thumbnail_widths[i]);
+		inflight = g_hash_table_contains(thumbnail.inflight, path);
+
+		/* on upload, only the missing ones */
+		if (!width && !inflight && g_file_test(path, G_FILE_TEST_EXISTS)) {
+			g_free(path);
+			continue;
+		}
+
+		if (callback) {
+			waiter = g_new0(struct thumbnail_waiter, 1);
+			waiter->callback = callback;
+			waiter->user_data = user_data;
+		}
+
+		waiters = g_hash_table_lookup(thumbnail.inflight, path);
+		if (waiter)
+			waiters = g_slist_append(waiters, waiter);
+
+		g_hash_table_insert(thumbnail.inflight, g_strdup(path), waiters);
+
+		/* the same variant is being generated, wait for it */
+		if (inflight) {
+			g_free(path);
+			continue;
+		}
+
+		job->variants[job->n_variants].width = thumbnail_widths[i];
+		job->variants[job->n_variants].path = path;
+		job->n_variants++;
+	}
+
+	if (!job->n_variants) {
+		__thumbnail_job_free(job);
+		return;
+	}
+
+	job->image_path = g_strdup(image_path);
+	g_thread_pool_push(thumbnail.pool, job, NULL);
+}
+
+int util_thumbnail_init(void)
+{
+	GError *error = NULL;
+
+	if (thumbnail.pool)
+		return 0;
+
+	thumbnail.pool = g_thread_pool_new(__thumbnail_worker, NULL,
+						util_memory_is_low() ? 1 : THUMBNAIL_WORKERS,
+						FALSE, &error);
+	if (!thumbnail.pool) {
+		_E("failed to create thumbnail workers - %s", error->message);
+		g_error_free(error);
+		return -1;
+	}
+
+	thumbnail.inflight = g_hash_table_new_full(g_str_hash, g_str_equal,
+							g_free, NULL);
+
+	return 0;
+}
+
+void util_thumbnail_fini(void)
+{
+	GHashTable *inflight = NULL;
+	GHashTableIter iter;
+	gpointer waiters = NULL;
+	GSList *l = NULL;
+
+	if (!thumbnail.pool)
+		return;
+
+	g_thread_pool_free(thumbnail.pool, FALSE, TRUE);
+	thumbnail.pool = NULL;
+
+	/* finished jobs still queued to the main loop find nobody waiting */
+	inflight = thumbnail.inflight;
+	thumbnail.inflight = NULL;
+
+	g_hash_table_iter_init(&iter, inflight);
+	while (g_hash_table_iter_next(&iter, NULL, &waiters)) {
+		for (l = waiters; l; l = l->next) {
+			struct thumbnail_waiter *waiter = l->data;
+			waiter->callback(NULL, ECANCELED, waiter->user_data);
+		}
+		g_slist_free_full(waiters, g_free);
+	}
+	g_hash_table_destroy(inflight);
+}
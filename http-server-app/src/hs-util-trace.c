@@ -0,0 +1,87 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include "http-server-log-private.h"
+#include "hs-util-trace.h"
+
+/* about 80 KiB, a few hundred requests */
+#define TRACE_MAX_EVENTS 2048
+
+int util_trace_on;
+
+static GMutex trace_lock;
+static struct util_trace_event *events;
+static guint64 events_count;
+
+int util_trace_set_enabled(gboolean enabled)
+{
+	struct util_trace_event *old = NULL;
+
+	g_mutex_lock(&trace_lock);
+	if (enabled && !events) {
+		events = g_try_new0(struct util_trace_event, TRACE_MAX_EVENTS);
+		if (!events) {
+			g_mutex_unlock(&trace_lock);
+			_E("failed to alloc trace buffer");
+			return -1;
+		}
+		events_count = 0;
+	} else if (!enabled) {
+		old = events;
+		events = NULL;
+	}
+	util_trace_on = enabled;
+	g_mutex_unlock(&trace_lock);
+
+	g_free(old);
+
+	return 0;
+}
+
+void util_trace_span(guint id, const char *name, gint64 begin, gint64 end)
+{
+	struct util_trace_event *event = NULL;
+
+	g_mutex_lock(&trace_lock);
+	if (events) {
+		event = &events[events_count++ % TRACE_MAX_EVENTS];
+		event->name = name;
+		event->id = id;
+		event->tid = (int)syscall(SYS_gettid);
+		event->ts = begin;
+		event->dur = end - begin;
+	}
+	g_mutex_unlock(&trace_lock);
+}
+
+void util_trace_foreach(util_trace_foreach_cb callback, gpointer user_data)
+{
+	guint64 i = 0;
+
+	ret_if(!callback);
+
+	g_mutex_lock(&trace_lock);
+	if (events) {
+		if (events_count > TRACE_MAX_EVENTS)
+			i = events_count - TRACE_MAX_EVENTS;
+		for (; i < events_count; i++)
+			callback(&events[i % TRACE_MAX_EVENTS], user_data);
+	}
+	g_mutex_unlock(&trace_lock);
+}
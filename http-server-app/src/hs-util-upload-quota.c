@@ -0,0 +1,89 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include "http-server-log-private.h"
+#include "hs-util-upload-quota.h"
+
+#define QUOTA_CLIENT_BYTES (128 * 1024 * 1024)
+#define QUOTA_PERIOD_US (G_GINT64_CONSTANT(60 * 60) * G_USEC_PER_SEC)
+#define QUOTA_MAX_CLIENTS 64
+
+struct client_quota {
+	gint64 period_start;
+	goffset used;
+};
+
+static GHashTable *quotas;
+
+static gboolean __quota_expired_cb(gpointer key, gpointer value, gpointer user_data)
+{
+	struct client_quota *quota = value;
+	gint64 *now = user_data;
+
+	return *now - quota->period_start >= QUOTA_PERIOD_US;
+}
+
+static struct client_quota *__client_quota_get(const char *host)
+{
+	struct client_quota *quota = NULL;
+	gint64 now = g_get_monotonic_time();
+
+	if (!quotas)
+		quotas = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+
+	quota = g_hash_table_lookup(quotas, host);
+	if (quota && now - quota->period_start < QUOTA_PERIOD_US)
+		return quota;
+
+	if (!quota) {
+		if (g_hash_table_size(quotas) >= QUOTA_MAX_CLIENTS)
+			g_hash_table_foreach_remove(quotas, __quota_expired_cb, &now);
+
+		quota = g_new0(struct client_quota, 1);
+		g_hash_table_insert(quotas, g_strdup(host), quota);
+	}
+
+	quota->period_start = now;
+	quota->used = 0;
+
+	return quota;
+}
+
+gboolean util_upload_quota_check(const char *host, goffset length)
+{
+	if (!host)
+		return TRUE;
+
+	if (__client_quota_get(host)->used + length > QUOTA_CLIENT_BYTES) {
+		_E("[%s] is over its upload quota", host);
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void util_upload_quota_charge(const char *host, goffset length)
+{
+	ret_if(!host);
+
+	__client_quota_get(host)->used += length;
+}
+
+void util_upload_quota_fini(void)
+{
+	g_clear_pointer(&quotas, g_hash_table_destroy);
+}
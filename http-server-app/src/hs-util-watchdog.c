@@ -0,0 +1,133 @@
+ /*
+ * Copyright (c) 2019 Samsung Electronics Co., Ltd.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an AS IS BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <glib.h>
+#include <string.h>
+#include "http-server-log-private.h"
+#include "hs-util-watchdog.h"
+
+#define WATCHDOG_TICK_MS 100
+
+static GMutex watchdog_lock;
+static GCond watchdog_cond;
+static GThread *watchdog_thread;
+static gboolean watchdog_stop;
+static guint tick_source;
+static gint64 stall_us;
+static gint64 last_beat;
+static const char *activity;
+static struct util_watchdog_stats stats;
+
+static gboolean __watchdog_tick_cb(gpointer user_data)
+{
+	gint64 now = g_get_monotonic_time();
+	gint64 lag = 0;
+
+	g_mutex_lock(&watchdog_lock);
+	lag = MAX(now - last_beat - WATCHDOG_TICK_MS * G_TIME_SPAN_MILLISECOND, 0);
+	last_beat = now;
+
+	stats.lag_avg += (lag - stats.lag_avg) / 8;
+	if (lag > stats.lag_max)
+		stats.lag_max = lag;
+	g_mutex_unlock(&watchdog_lock);
+
+	if (lag >= stall_us)
+		_W("main loop was blocked for %lld ms", (long long)(lag / 1000));
+
+	return G_SOURCE_CONTINUE;
+}
+
+static gpointer __watchdog_thread(gpointer data)
+{
+	gboolean stalled = FALSE;
+	const char *name = NULL;
+	gint64 blocked = 0;
+	gint64 now = 0;
+
+	g_mutex_lock(&watchdog_lock);
+	while (!watchdog_stop) {
+		g_cond_wait_until(&watchdog_cond, &watchdog_lock,
+			g_get_monotonic_time() + WATCHDOG_TICK_MS * G_TIME_SPAN_MILLISECOND);
+
+		now = g_get_monotonic_time();
+		blocked = now - last_beat;
+		if (blocked < stall_us + WATCHDOG_TICK_MS * G_TIME_SPAN_MILLISECOND) {
+			stalled = FALSE;
+			continue;
+		}
+
+		/* once for each stall, the tick tells how long it took at last */
+		if (stalled)
+			continue;
+		stalled = TRUE;
+		stats.stalls++;
+		name = g_atomic_pointer_get(&activity);
+		_W("main loop is stuck for %lld ms in [%s]",
+			(long long)(blocked / 1000), name ? name : "unknown");
+	}
+	g_mutex_unlock(&watchdog_lock);
+
+	return NULL;
+}
+
+int util_watchdog_start(unsigned int stall_ms)
+{
+	retvm_if(watchdog_thread, -1, "watchdog is already started");
+	retvm_if(!stall_ms, -1, "stall_ms is 0");
+
+	stall_us = (gint64)stall_ms * G_TIME_SPAN_MILLISECOND;
+	last_beat = g_get_monotonic_time();
+	watchdog_stop = FALSE;
+	memset(&stats, 0, sizeof(stats));
+
+	watchdog_thread = g_thread_try_new("hs-watchdog", __watchdog_thread, NULL, NULL);
+	retvm_if(!watchdog_thread, -1, "failed to create watchdog thread");
+
+	tick_source = g_timeout_add(WATCHDOG_TICK_MS, __watchdog_tick_cb, NULL);
+
+	return 0;
+}
+
+void util_watchdog_stop(void)
+{
+	ret_if(!watchdog_thread);
+
+	g_source_remove(tick_source);
+	tick_source = 0;
+
+	g_mutex_lock(&watchdog_lock);
+	watchdog_stop = TRUE;
+	g_cond_signal(&watchdog_cond);
+	g_mutex_unlock(&watchdog_lock);
+
+	g_thread_join(watchdog_thread);
+	watchdog_thread = NULL;
+}
+
+void util_watchdog_activity_set(const char *name)
+{
+	g_atomic_pointer_set(&activity, name);
+}
+
+void util_watchdog_get_stats(struct util_watchdog_stats *s)
+{
+	ret_if(!s);
+
+	g_mutex_lock(&watchdog_lock);
+	*s = stats;
+	g_mutex_unlock(&watchdog_lock);
+}
@@ -17,121 +17,1604 @@
 #include <glib.h>
 #include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <netinet/in.h>
+#include <gio/gio.h>
 #include <libsoup/soup.h>
 #include <service_app.h>
 #include <app_common.h>
 #include "http-server-log-private.h"
 #include "http-server-route.h"
+#include "http-server-common.h"
+#include "hs-util-arena.h"
+#include "hs-util-heap.h"
+#include "hs-util-listen-fd.h"
+#include "hs-util-memory.h"
+#include "hs-util-pressure.h"
+#include "hs-util-probe.h"
+#include "hs-util-trace.h"
+#include "hs-util-watchdog.h"
 
 #define SIGNAL_DEBUG 0
 #define HTDIGEST_FILE "/auth-data/auth-passwd.dat"
+#define ADMIN_REALM "admin"
+
+#define MESSAGE_CANCELLABLE_KEY "hs-message-cancellable"
+#define MESSAGE_PAUSE_KEY "hs-message-pause"
+#define MESSAGE_CLIENT_KEY "hs-message-client"
+#define MESSAGE_TRACE_KEY "hs-message-trace"
+#define MESSAGE_ARENA_KEY "hs-message-arena"
+#define SERVER_TIMING_HEADER "X-Server-Timing"
+#define SERVER_TIMING_QUERY "serverTiming"
+#define CLIENT_RATE_CHECKED_KEY "hs-client-rate-checked"
+/* one bucket is about 80 bytes, the table stays small on any network */
+#define CLIENT_RATE_MAX_CLIENTS 256
+#define HTTP_STATUS_TOO_MANY_REQUESTS 429
+#define ROUTE_LIMIT_RETRY_AFTER "2"
+#define ROUTE_SHED_RETRY_AFTER "10"
+/* overruns in a row before a handler is moved off the main loop */
+#define ROUTE_BUDGET_STRIKES 3
+#define ROUTE_BUDGET_RECOVER 16
+#define ROUTE_OFFLOAD_THREADS 2
+#define ROUTE_LOOKUP_BUF_SIZE 256
+#define REQUEST_DECODER_KEY "hs-request-decoder"
+#define REQUEST_CHARGE_KEY "hs-request-charge"
+#define REQUEST_DECODER_BUF_SIZE 16384
+/* a body may inflate this much, plus some slack for tiny bodies */
+#define REQUEST_DECODE_MAX_RATIO 100
+#define REQUEST_DECODE_SLACK (1024 * 1024)
+/* limit of a decoded body kept in memory for the route */
+#define REQUEST_DECODE_MAX_BUFFERED (16 * 1024 * 1024)
+
+#define RESPONSE_ENCODED_KEY "hs-response-encoded"
+#define RESPONSE_ENCODER_BUF_SIZE 16384
+/* compressed bodies of recent responses, polled APIs repeat themselves */
+#define RESPONSE_CACHE_MAX_ENTRIES 16
+#define RESPONSE_CACHE_MAX_SIZE (256 * 1024)
 
 struct route_callback_data {
+	char *path;
 	http_server_route_callback callback;
 	gpointer user_data;
 	GDestroyNotify destroy_func;
 };
 
+struct route_headers_data {
+	http_server_route_headers_callback callback;
+	gpointer user_data;
+	GDestroyNotify destroy_func;
+};
+
+struct request_decoder {
+	GConverter *converter;
+	goffset encoded;
+	goffset decoded;
+	gsize charged;
+	gboolean buffered;
+	gboolean emitting;
+	gboolean finished;
+	gboolean failed;
+};
+
+struct response_cache_entry {
+	char *key;
+	GBytes *bytes;
+	GList *link;
+};
+
+enum {
+	MESSAGE_PAUSE_NONE,
+	MESSAGE_PAUSE_PAUSED,
+	MESSAGE_PAUSE_UNPAUSED,
+};
+
+struct route_limit {
+	gint ref;
+	char *path;
+	guint max_in_flight;
+	guint max_queued;
+	guint in_flight;
+	guint64 rejected;
+	GQueue waiting;
+	guint drain_source;
+};
+
+struct route_budget {
+	gint64 budget;
+	guint strikes;
+	guint streak;
+	guint64 overruns;
+	gboolean offloaded;
+};
+
+struct route_waiter {
+	struct route_limit *limit;
+	gint64 queued;
+	SoupMessage *msg;
+	char *path;
+	GHashTable *query;
+	SoupClientContext *client;
+};
+
+/* phases of Server-Timing */
+enum {
+	TIMING_AUTH,
+	TIMING_QUEUE,
+	TIMING_HANDLER,
+	TIMING_PLATFORM,
+	TIMING_SERIALIZE,
+	TIMING_MAX,
+};
+
+/* begin times of the spans in progress, 0 where none is */
+struct request_trace {
+	guint id;
+	gboolean timed;
+	gint64 started;
+	gint64 auth;
+	gint64 body;
+	gint64 paused;
+	gint64 writing;
+	gint64 timing[TIMING_MAX];
+};
+
+/* a handler running on a worker, on a copy of the message */
+struct route_offload {
+	struct route_callback_data *cd;
+	SoupMessage *msg;
+	SoupMessage *copy;
+	char *path;
+	GHashTable *query;
+	/* spans of the worker, added to the trace of msg on the main loop */
+	struct request_trace trace;
+	gint64 elapsed;
+};
+
+struct client_bucket {
+	char host[INET6_ADDRSTRLEN];
+	float tokens;
+	gint64 updated;
+	GList *link;
+};
+
+struct internal_message {
+	SoupMessage *msg;
+	http_server_dispatch_done_cb done;
+	gpointer user_data;
+	gboolean paused;
+	guint complete_source;
+	struct route_limit *limit;
+};
+
 static SoupServer *g_server;
 static SoupAuthDomain *default_auth_domain;
+static SoupAuthDomain *admin_auth_domain;
+/* admin paths whose GET and HEAD stay in the default realm */
+static GHashTable *admin_read_table;
+static GHashTable *route_table;
+static GHashTable *internal_messages;
+static GHashTable *headers_table;
+static GHashTable *limits_table;
+static GHashTable *costs_table;
+static guint64 shed_count;
+static GHashTable *rate_costs_table;
+static GHashTable *budgets_table;
+static GThreadPool *offload_pool;
+static GHashTable *clients_table;
+static GQueue clients_lru = G_QUEUE_INIT;
+static unsigned int client_rate;
+static unsigned int client_burst;
+static GHashTable *response_cache;
+static GQueue response_cache_lru = G_QUEUE_INIT;
+static gsize response_cache_size;
+static unsigned int compress_min_size;
+static int compress_level;
+static unsigned int server_port;
+static http_server_handoff_cb handoff_cb;
+static void *handoff_cb_data;
+static guint trace_last_id;
+static const char *timing_names[TIMING_MAX] = {
+	"auth", "queue", "handler", "platform", "serialize",
+};
+
+static gpointer __route_lookup(GHashTable *table, const char *path);
+static void __route_limit_leave(struct route_limit *limit);
+
+/* Every request has one, unless it is looked at it costs a few clock reads */
+static struct request_trace *__request_trace_new(SoupMessage *msg)
+{
+	struct request_trace *trace = g_new0(struct request_trace, 1);
+
+	trace->id = ++trace_last_id;
+	trace->started = g_get_monotonic_time();
+	g_object_set_data_full(G_OBJECT(msg), MESSAGE_TRACE_KEY, trace, g_free);
+
+	return trace;
+}
+
+static struct request_trace *__request_trace_get(SoupMessage *msg)
+{
+	return g_object_get_data(G_OBJECT(msg), MESSAGE_TRACE_KEY);
+}
+
+/* Returns the begin time of a span, 0 if neither trace nor timing is on */
+static gint64 __request_span_begin(struct request_trace *trace)
+{
+	if (!trace || (!trace->timed && !util_trace_enabled()))
+		return 0;
+
+	return g_get_monotonic_time();
+}
+
+/*
+ * Ends the span of name begun at *begin, if there is one. It is added up
+ * in timing for Server-Timing, unless timing is -1.
+ */
+static void __request_span_end(struct request_trace *trace, int timing,
+				const char *name, gint64 *begin)
+{
+	gint64 now = 0;
+
+	if (!trace || !*begin)
+		return;
+
+	now = g_get_monotonic_time();
+	if (timing >= 0)
+		trace->timing[timing] += now - *begin;
+	if (util_trace_enabled())
+		util_trace_span(trace->id, name, *begin, now);
+	*begin = 0;
+}
+
+static void __request_trace_finish(SoupMessage *msg)
+{
+	struct request_trace *trace = __request_trace_get(msg);
+
+	if (!trace)
+		return;
+
+	HS_PROBE3(request__done, trace->id, soup_message_get_uri(msg)->path,
+		msg->status_code);
+
+	__request_span_end(trace, -1, "paused", &trace->paused);
+	__request_span_end(trace, -1, "write response", &trace->writing);
+	__request_span_end(trace, -1, "request", &trace->started);
+}
+
+static gboolean __request_wants_timing(SoupMessage *msg)
+{
+	SoupURI *uri = soup_message_get_uri(msg);
+	GHashTable *form = NULL;
+	gboolean wanted = FALSE;
+
+	if (soup_message_headers_get_one(msg->request_headers, SERVER_TIMING_HEADER))
+		return TRUE;
+
+	if (!uri->query || !strstr(uri->query, SERVER_TIMING_QUERY))
+		return FALSE;
+
+	form = soup_form_decode(uri->query);
+	wanted = g_hash_table_contains(form, SERVER_TIMING_QUERY);
+	g_hash_table_destroy(form);
+
+	return wanted;
+}
+
+/* e.g. Server-Timing: auth;dur=0.41, handler;dur=3.20, total;dur=4.02 */
+static void __response_add_server_timing(SoupMessage *msg)
+{
+	struct request_trace *trace = __request_trace_get(msg);
+	char dur[G_ASCII_DTOSTR_BUF_SIZE];
+	GString *value = NULL;
+	int i = 0;
+
+	if (!trace || !trace->timed)
+		return;
+
+	value = g_string_new(NULL);
+	for (i = 0; i < TIMING_MAX; i++) {
+		if (!trace->timing[i] && i != TIMING_HANDLER)
+			continue;
+		g_ascii_formatd(dur, sizeof(dur), "%.2f", trace->timing[i] / 1000.0);
+		g_string_append_printf(value, "%s;dur=%s, ", timing_names[i], dur);
+	}
+	g_ascii_formatd(dur, sizeof(dur), "%.2f",
+			(g_get_monotonic_time() - trace->started) / 1000.0);
+	g_string_append_printf(value, "total;dur=%s", dur);
+
+	soup_message_headers_replace(msg->response_headers, "Server-Timing", value->str);
+	g_string_free(value, TRUE);
+}
+
+static void wrote_headers_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct request_trace *trace = __request_trace_get(msg);
+
+	if (trace)
+		trace->writing = __request_span_begin(trace);
+}
 
-#if SIGNAL_DEBUG
 static void
 request_aborted_cb(SoupServer *server, SoupMessage *message,
 				SoupClientContext *client, gpointer user_data)
 {
+#if SIGNAL_DEBUG
 	_D("request-aborted : [%s]", soup_client_context_get_host(client));
+#endif /* SIGNAL_DEBUG */
+
+	__request_trace_finish(message);
+	http_server_message_cancel(message);
 }
 
 static void
 request_finished_cb(SoupServer *server, SoupMessage *message,
 				SoupClientContext *client, gpointer user_data)
 {
-	_D("request-finished : [%s]", soup_client_context_get_host(client));
+#if SIGNAL_DEBUG
+	_D("request-finished : [%s]", soup_client_context_get_host(client));
+#endif /* SIGNAL_DEBUG */
+
+	__request_trace_finish(message);
+
+	/* the response is out, nothing points into it any more */
+	g_object_set_data(G_OBJECT(message), MESSAGE_ARENA_KEY, NULL);
+}
+
+/*
+ * libsoup sets 100 Continue before got-headers for a client which sent
+ * "Expect: 100-continue", that is no answer yet. A final status set in
+ * its place is sent instead and the body is never read.
+ */
+static gboolean __message_is_answered(SoupMessage *msg)
+{
+	return msg->status_code != SOUP_STATUS_NONE
+		&& msg->status_code != SOUP_STATUS_CONTINUE;
+}
+
+static void __request_reject(SoupMessage *msg, guint status)
+{
+	soup_message_body_set_accumulate(msg->request_body, FALSE);
+	soup_message_headers_replace(msg->response_headers, "Connection", "close");
+	soup_message_set_status(msg, status);
+}
+
+static gboolean __route_is_expensive(const char *path)
+{
+	if (!costs_table)
+		return FALSE;
+
+	return GPOINTER_TO_INT(__route_lookup(costs_table, path))
+		== HTTP_SERVER_ROUTE_COST_HIGH;
+}
+
+/*
+ * Expensive routes are refused while the system is critically short of
+ * memory or io, so cheap ones still get through. Returns TRUE if msg is
+ * refused.
+ */
+static gboolean __route_shed(SoupMessage *msg, const char *path)
+{
+	const struct util_pressure *pressure = NULL;
+
+	if (!__route_is_expensive(path))
+		return FALSE;
+
+	pressure = util_pressure_get();
+	if (pressure->level < UTIL_PRESSURE_CRITICAL)
+		return FALSE;
+
+	_W("[%s] is shed under [%s] pressure", path,
+		util_pressure_level_to_str(pressure->level));
+	shed_count++;
+	soup_message_headers_replace(msg->response_headers,
+				"Retry-After", ROUTE_SHED_RETRY_AFTER);
+
+	return TRUE;
+}
+
+static void __client_bucket_free(gpointer data)
+{
+	struct client_bucket *bucket = data;
+
+	g_queue_delete_link(&clients_lru, bucket->link);
+	g_free(bucket);
+}
+
+/* buckets of clients not seen for longest make room for new ones */
+static struct client_bucket *__client_bucket_get(const char *host, gint64 now)
+{
+	struct client_bucket *bucket = NULL;
+
+	bucket = g_hash_table_lookup(clients_table, host);
+	if (bucket) {
+		g_queue_unlink(&clients_lru, bucket->link);
+		g_queue_push_head_link(&clients_lru, bucket->link);
+		return bucket;
+	}
+
+	while (clients_lru.length >= CLIENT_RATE_MAX_CLIENTS) {
+		bucket = g_queue_peek_tail(&clients_lru);
+		g_hash_table_remove(clients_table, bucket->host);
+	}
+
+	bucket = g_new0(struct client_bucket, 1);
+	g_strlcpy(bucket->host, host, sizeof(bucket->host));
+	bucket->tokens = client_burst;
+	bucket->updated = now;
+	g_queue_push_head(&clients_lru, bucket);
+	bucket->link = clients_lru.head;
+	g_hash_table_insert(clients_table, bucket->host, bucket);
+
+	return bucket;
+}
+
+static guint __route_rate_cost(const char *path)
+{
+	gpointer cost = NULL;
+
+	cost = __route_lookup(rate_costs_table, path);
+	if (!cost)
+		return 1;
+
+	/* stored plus one, as NULL is no cost set */
+	return GPOINTER_TO_UINT(cost) - 1;
+}
+
+/*
+ * Takes the tokens of path from the bucket of client. Returns 0 if the
+ * request may go on, or else the seconds until the client has enough.
+ */
+static guint __client_rate_take(SoupClientContext *client, const char *path)
+{
+	struct client_bucket *bucket = NULL;
+	const char *host = NULL;
+	gint64 now = 0;
+	guint cost = 0;
+
+	if (!client_rate || !clients_table || !client)
+		return 0;
+
+	host = soup_client_context_get_host(client);
+	if (!host)
+		return 0;
+
+	cost = MIN(__route_rate_cost(path), client_burst);
+	if (!cost)
+		return 0;
+
+	now = g_get_monotonic_time();
+	bucket = __client_bucket_get(host, now);
+	bucket->tokens = MIN(client_burst, bucket->tokens
+				+ (float)(now - bucket->updated) * client_rate / G_USEC_PER_SEC);
+	bucket->updated = now;
+
+	if (bucket->tokens >= cost) {
+		bucket->tokens -= cost;
+		return 0;
+	}
+
+	return (guint)((cost - bucket->tokens) / client_rate) + 1;
+}
+
+static void __client_rate_reject(SoupMessage *msg, guint retry_after)
+{
+	char *value = g_strdup_printf("%u", retry_after);
+
+	soup_message_headers_replace(msg->response_headers, "Retry-After", value);
+	g_free(value);
+
+	/* soup has no phrase of its own for it */
+	soup_message_set_status_full(msg, HTTP_STATUS_TOO_MANY_REQUESTS,
+				"Too Many Requests");
+}
+
+/*
+ * Checks msg once, from whichever runs first of the auth filter and
+ * got-headers. Returns FALSE if it is answered with 429.
+ */
+static gboolean __client_rate_check(SoupMessage *msg)
+{
+	SoupClientContext *client = NULL;
+	guint retry_after = 0;
+
+	if (g_object_get_data(G_OBJECT(msg), CLIENT_RATE_CHECKED_KEY))
+		return msg->status_code != HTTP_STATUS_TOO_MANY_REQUESTS;
+	g_object_set_data(G_OBJECT(msg), CLIENT_RATE_CHECKED_KEY, GINT_TO_POINTER(1));
+
+	client = g_object_get_data(G_OBJECT(msg), MESSAGE_CLIENT_KEY);
+	retry_after = __client_rate_take(client, soup_message_get_uri(msg)->path);
+	if (!retry_after)
+		return TRUE;
+
+	_W("[%s] is over its rate on [%s]", soup_client_context_get_host(client),
+		soup_message_get_uri(msg)->path);
+	__request_reject(msg, HTTP_STATUS_TOO_MANY_REQUESTS);
+	__client_rate_reject(msg, retry_after);
+
+	return FALSE;
+}
+
+static void __request_decoder_free(gpointer data)
+{
+	struct request_decoder *decoder = data;
+
+	util_memory_uncharge(UTIL_MEMORY_REQUEST_BODIES, decoder->charged);
+	g_object_unref(decoder->converter);
+	g_free(decoder);
+}
+
+static void __request_decoder_emit(SoupMessage *msg,
+				struct request_decoder *decoder, const char *data, gsize len)
+{
+	SoupBuffer *buffer = soup_buffer_new(SOUP_MEMORY_COPY, data, len);
+
+	if (decoder->buffered)
+		soup_message_body_append_buffer(msg->request_body, buffer);
+
+	decoder->emitting = TRUE;
+	g_signal_emit_by_name(msg, "got-chunk", buffer);
+	decoder->emitting = FALSE;
+
+	soup_buffer_free(buffer);
+}
+
+static guint __request_decoder_feed(SoupMessage *msg,
+				struct request_decoder *decoder, const char *data, gsize len)
+{
+	char out[REQUEST_DECODER_BUF_SIZE];
+	GConverterResult result;
+	GError *error = NULL;
+	gsize bytes_read = 0;
+	gsize bytes_written = 0;
+
+	decoder->encoded += len;
+
+	while (!decoder->finished) {
+		result = g_converter_convert(decoder->converter, data, len,
+					out, sizeof(out), G_CONVERTER_NO_FLAGS,
+					&bytes_read, &bytes_written, &error);
+		if (result == G_CONVERTER_ERROR) {
+			/* everything is consumed, the rest comes with the next chunk */
+			if (g_error_matches(error, G_IO_ERROR, G_IO_ERROR_PARTIAL_INPUT)) {
+				g_error_free(error);
+				return SOUP_STATUS_OK;
+			}
+			_E("failed to decode request body - %s", error->message);
+			g_error_free(error);
+			return SOUP_STATUS_BAD_REQUEST;
+		}
+
+		data += bytes_read;
+		len -= bytes_read;
+		decoder->decoded += bytes_written;
+
+		if (decoder->decoded > decoder->encoded * REQUEST_DECODE_MAX_RATIO
+						+ REQUEST_DECODE_SLACK
+			|| (decoder->buffered
+				&& decoder->decoded > REQUEST_DECODE_MAX_BUFFERED)) {
+			_E("request body inflates too much - %" G_GOFFSET_FORMAT
+				" from %" G_GOFFSET_FORMAT, decoder->decoded, decoder->encoded);
+			return SOUP_STATUS_REQUEST_ENTITY_TOO_LARGE;
+		}
+
+		if (bytes_written && decoder->buffered) {
+			if (!util_memory_charge(UTIL_MEMORY_REQUEST_BODIES, bytes_written)) {
+				_W("no memory budget left for the decoded request body");
+				return SOUP_STATUS_SERVICE_UNAVAILABLE;
+			}
+			decoder->charged += bytes_written;
+		}
+
+		if (bytes_written)
+			__request_decoder_emit(msg, decoder, out, bytes_written);
+
+		if (result == G_CONVERTER_FINISHED)
+			decoder->finished = TRUE;
+		else if (!bytes_read && !bytes_written)
+			return SOUP_STATUS_OK;
+	}
+
+	if (len) {
+		_E("garbage after the encoded request body");
+		return SOUP_STATUS_BAD_REQUEST;
+	}
+
+	return SOUP_STATUS_OK;
+}
+
+/*
+ * Connected ahead of any route handler. The encoded chunk is kept from
+ * the others, which get the decoded data as their own got-chunk.
+ */
+static void __request_decoder_got_chunk_cb(SoupMessage *msg, SoupBuffer *chunk,
+				gpointer user_data)
+{
+	struct request_decoder *decoder = user_data;
+	guint status = SOUP_STATUS_OK;
+
+	if (decoder->emitting)
+		return;
+
+	g_signal_stop_emission_by_name(msg, "got-chunk");
+
+	if (decoder->failed)
+		return;
+
+	status = __request_decoder_feed(msg, decoder, chunk->data, chunk->length);
+	if (status != SOUP_STATUS_OK) {
+		decoder->failed = TRUE;
+		__request_reject(msg, status);
+	}
+}
+
+static struct request_decoder *__request_decoder_new(SoupMessage *msg)
+{
+	struct request_decoder *decoder = NULL;
+	const char *encoding = NULL;
+	GZlibCompressorFormat format;
+
+	encoding = soup_message_headers_get_one(msg->request_headers,
+						"Content-Encoding");
+	if (!encoding || !g_ascii_strcasecmp(encoding, "identity"))
+		return NULL;
+
+	if (!g_ascii_strcasecmp(encoding, "gzip")
+		|| !g_ascii_strcasecmp(encoding, "x-gzip")) {
+		format = G_ZLIB_COMPRESSOR_FORMAT_GZIP;
+	} else if (!g_ascii_strcasecmp(encoding, "deflate")) {
+		format = G_ZLIB_COMPRESSOR_FORMAT_ZLIB;
+	} else {
+		_E("unsupported request encoding [%s]", encoding);
+		soup_message_headers_replace(msg->response_headers,
+					"Accept-Encoding", "gzip, deflate");
+		__request_reject(msg, SOUP_STATUS_UNSUPPORTED_MEDIA_TYPE);
+		return NULL;
+	}
+
+	decoder = g_new0(struct request_decoder, 1);
+	decoder->converter = G_CONVERTER(g_zlib_decompressor_new(format));
+
+	g_object_set_data_full(G_OBJECT(msg), REQUEST_DECODER_KEY,
+				decoder, __request_decoder_free);
+	g_signal_connect(msg, "got-chunk",
+			G_CALLBACK(__request_decoder_got_chunk_cb), decoder);
+
+	return decoder;
+}
+
+static void
+request_read_cb(SoupServer *server, SoupMessage *message,
+				SoupClientContext *client, gpointer user_data)
+{
+	struct request_decoder *decoder = NULL;
+	struct request_trace *trace = __request_trace_get(message);
+	SoupBuffer *buffer = NULL;
+
+#if SIGNAL_DEBUG
+	_D("request-read : [%s]", soup_client_context_get_host(client));
+#endif /* SIGNAL_DEBUG */
+
+	if (trace)
+		__request_span_end(trace, -1, "read body", &trace->body);
+
+	decoder = g_object_get_data(G_OBJECT(message), REQUEST_DECODER_KEY);
+	if (!decoder || decoder->failed)
+		return;
+
+	if (!decoder->finished) {
+		_E("encoded request body is truncated");
+		__request_reject(message, SOUP_STATUS_BAD_REQUEST);
+		return;
+	}
+
+	/* soup flattens accumulated bodies only, the decoded one is appended */
+	if (decoder->buffered) {
+		buffer = soup_message_body_flatten(message->request_body);
+		soup_buffer_free(buffer);
+	}
+}
+
+static void __request_charge_free(gpointer data)
+{
+	gsize *charged = data;
+
+	util_memory_uncharge(UTIL_MEMORY_REQUEST_BODIES, *charged);
+	g_free(charged);
+}
+
+static void __request_body_got_chunk_cb(SoupMessage *msg, SoupBuffer *chunk,
+				gpointer user_data)
+{
+	gsize *charged = user_data;
+
+	/* rejected already, the rest is dropped as it comes */
+	if (__message_is_answered(msg))
+		return;
+
+	if (!util_memory_charge(UTIL_MEMORY_REQUEST_BODIES, chunk->length)) {
+		_W("no memory budget left for a request body of [%" G_GSIZE_FORMAT
+			"] and more", *charged + chunk->length);
+		__request_reject(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+		return;
+	}
+	*charged += chunk->length;
+}
+
+/*
+ * Plain bodies to be accumulated take their whole length from the memory
+ * budget before any of them is read, chunked ones as they come. Decoded
+ * ones are charged as they inflate.
+ */
+static gboolean __request_body_charge(SoupMessage *msg)
+{
+	SoupEncoding encoding;
+	gsize *charged = NULL;
+	goffset length = 0;
+
+	if (!soup_message_body_get_accumulate(msg->request_body))
+		return TRUE;
+
+	encoding = soup_message_headers_get_encoding(msg->request_headers);
+	if (encoding == SOUP_ENCODING_CONTENT_LENGTH) {
+		length = soup_message_headers_get_content_length(msg->request_headers);
+		if (length <= 0)
+			return TRUE;
+
+		if ((guint64)length > G_MAXSIZE
+			|| !util_memory_charge(UTIL_MEMORY_REQUEST_BODIES, (gsize)length)) {
+			_W("no memory budget left for a request body of [%"
+				G_GOFFSET_FORMAT "]", length);
+			return FALSE;
+		}
+	} else if (encoding != SOUP_ENCODING_CHUNKED) {
+		/* requests without either have no body */
+		return TRUE;
+	}
+
+	charged = g_new0(gsize, 1);
+	*charged = length;
+	g_object_set_data_full(G_OBJECT(msg), REQUEST_CHARGE_KEY,
+			charged, __request_charge_free);
+
+	if (encoding == SOUP_ENCODING_CHUNKED)
+		g_signal_connect(msg, "got-chunk",
+				G_CALLBACK(__request_body_got_chunk_cb), charged);
+
+	return TRUE;
+}
+
+static void got_headers_cb(SoupMessage *msg, gpointer user_data)
+{
+	SoupClientContext *client = user_data;
+	struct route_headers_data *hd = NULL;
+	struct request_decoder *decoder = NULL;
+	struct request_trace *trace = __request_trace_get(msg);
+	const char *path = soup_message_get_uri(msg)->path;
+	gint64 begin = 0;
+
+	if (trace) {
+		HS_PROBE3(request__start, trace->id, path, msg->method);
+
+		/* the core answers 401 if the digest is not accepted */
+		if (trace->auth)
+			HS_PROBE3(auth, trace->id, path, msg->status_code);
+
+		trace->timed = __request_wants_timing(msg);
+		begin = __request_span_begin(trace) ? trace->started : 0;
+		__request_span_end(trace, -1, "read headers", &begin);
+		__request_span_end(trace, TIMING_AUTH, "auth", &trace->auth);
+		trace->body = __request_span_begin(trace);
+	}
+
+	/* already answered, e.g. by the auth domain */
+	if (__message_is_answered(msg))
+		return;
+
+	if (!__client_rate_check(msg))
+		return;
+
+	/* before any of the body is read, uploads are the heaviest of all */
+	if (__route_shed(msg, path)) {
+		__request_reject(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+		return;
+	}
+
+	decoder = __request_decoder_new(msg);
+	if (__message_is_answered(msg))
+		return;
+
+	hd = __route_lookup(headers_table, path);
+	if (hd)
+		hd->callback(msg, path, client, hd->user_data);
+
+	/*
+	 * Routes which did not ask for streaming get the decoded body in
+	 * request_body, the encoded one is never kept.
+	 */
+	if (decoder) {
+		decoder->buffered = soup_message_body_get_accumulate(msg->request_body);
+		soup_message_body_set_accumulate(msg->request_body, FALSE);
+	} else if (!__message_is_answered(msg)
+		&& !__request_body_charge(msg)) {
+		__request_reject(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+	}
+}
+
+static gboolean __response_is_compressible(SoupMessage *msg)
+{
+	const char *content_type = NULL;
+
+	if (msg->status_code != SOUP_STATUS_OK
+		|| msg->method == SOUP_METHOD_HEAD
+		|| msg->response_body->length < compress_min_size)
+		return FALSE;
+
+	/* streamed or encoded by the route itself */
+	if (soup_message_headers_get_encoding(msg->response_headers)
+			== SOUP_ENCODING_CHUNKED
+		|| soup_message_headers_get_one(msg->response_headers,
+						"Content-Encoding"))
+		return FALSE;
+
+	content_type = soup_message_headers_get_content_type(msg->response_headers,
+								NULL);
+	if (!content_type)
+		return FALSE;
+
+	return g_str_has_prefix(content_type, "text/")
+		|| !strcmp(content_type, "application/json")
+		|| !strcmp(content_type, "application/javascript")
+		|| !strcmp(content_type, "application/xml")
+		|| g_str_has_suffix(content_type, "+json")
+		|| g_str_has_suffix(content_type, "+xml");
+}
+
+static gboolean __request_accepts_gzip(SoupMessage *msg)
+{
+	const char *header = NULL;
+	GSList *codings = NULL;
+	GSList *unacceptable = NULL;
+	GSList *l = NULL;
+	gboolean accepted = FALSE;
+
+	header = soup_message_headers_get_list(msg->request_headers,
+						"Accept-Encoding");
+	if (!header)
+		return FALSE;
+
+	codings = soup_header_parse_quality_list(header, &unacceptable);
+	for (l = codings; l && !accepted; l = l->next)
+		accepted = !g_ascii_strcasecmp(l->data, "gzip") || !strcmp(l->data, "*");
+	for (l = unacceptable; l && accepted; l = l->next)
+		accepted = g_ascii_strcasecmp(l->data, "gzip") != 0;
+
+	soup_header_free_list(codings);
+	soup_header_free_list(unacceptable);
+
+	return accepted;
+}
+
+static void __response_cache_entry_free(gpointer data)
+{
+	struct response_cache_entry *entry = data;
+
+	response_cache_size -= g_bytes_get_size(entry->bytes);
+	util_memory_uncharge(UTIL_MEMORY_RESPONSE_CACHE, g_bytes_get_size(entry->bytes));
+	g_queue_delete_link(&response_cache_lru, entry->link);
+	g_bytes_unref(entry->bytes);
+	g_free(entry->key);
+	g_free(entry);
+}
+
+static GBytes *__response_cache_lookup(const char *key)
+{
+	struct response_cache_entry *entry = NULL;
+
+	if (!response_cache)
+		return NULL;
+
+	entry = g_hash_table_lookup(response_cache, key);
+	if (!entry)
+		return NULL;
+
+	g_queue_unlink(&response_cache_lru, entry->link);
+	g_queue_push_head_link(&response_cache_lru, entry->link);
+
+	return g_bytes_ref(entry->bytes);
+}
+
+static void __response_cache_insert(const char *key, GBytes *bytes)
+{
+	struct response_cache_entry *entry = NULL;
+	gsize size = g_bytes_get_size(bytes);
+
+	if (!response_cache || size > RESPONSE_CACHE_MAX_SIZE)
+		return;
+
+	while (response_cache_lru.length
+		&& (response_cache_lru.length >= RESPONSE_CACHE_MAX_ENTRIES
+			|| response_cache_size + size > RESPONSE_CACHE_MAX_SIZE)) {
+		entry = g_queue_peek_tail(&response_cache_lru);
+		g_hash_table_remove(response_cache, entry->key);
+	}
+
+	/* the cache is the first to give way when memory is short */
+	while (!util_memory_charge(UTIL_MEMORY_RESPONSE_CACHE, size)) {
+		if (!response_cache_lru.length)
+			return;
+		entry = g_queue_peek_tail(&response_cache_lru);
+		g_hash_table_remove(response_cache, entry->key);
+	}
+
+	entry = g_new0(struct response_cache_entry, 1);
+	entry->key = g_strdup(key);
+	entry->bytes = g_bytes_ref(bytes);
+	g_queue_push_head(&response_cache_lru, entry);
+	entry->link = response_cache_lru.head;
+	response_cache_size += size;
+
+	g_hash_table_replace(response_cache, entry->key, entry);
+}
+
+static GBytes *__response_deflate(SoupBuffer *body)
+{
+	GConverter *converter = NULL;
+	GConverterResult result;
+	GByteArray *out = NULL;
+	GError *error = NULL;
+	const char *in = body->data;
+	gsize in_len = body->length;
+	gsize used = 0;
+	gsize bytes_read = 0;
+	gsize bytes_written = 0;
+
+	converter = G_CONVERTER(g_zlib_compressor_new(G_ZLIB_COMPRESSOR_FORMAT_GZIP,
+							compress_level));
+	out = g_byte_array_sized_new(body->length / 4 + RESPONSE_ENCODER_BUF_SIZE);
+
+	do {
+		g_byte_array_set_size(out, used + RESPONSE_ENCODER_BUF_SIZE);
+		result = g_converter_convert(converter, in, in_len,
+					out->data + used, RESPONSE_ENCODER_BUF_SIZE,
+					G_CONVERTER_INPUT_AT_END,
+					&bytes_read, &bytes_written, &error);
+		if (result == G_CONVERTER_ERROR) {
+			_E("failed to compress response - %s", error->message);
+			g_error_free(error);
+			g_byte_array_unref(out);
+			g_object_unref(converter);
+			return NULL;
+		}
+		in += bytes_read;
+		in_len -= bytes_read;
+		used += bytes_written;
+	} while (result != G_CONVERTER_FINISHED);
+
+	g_object_unref(converter);
+	g_byte_array_set_size(out, used);
+
+	return g_byte_array_free_to_bytes(out);
+}
+
+/* Called once the response of a message bound to a connection is filled */
+static void __response_compress(SoupMessage *msg)
+{
+	SoupBuffer *body = NULL;
+	SoupBuffer *buffer = NULL;
+	GBytes *bytes = NULL;
+	char *key = NULL;
+
+	if (!compress_level)
+		return;
+
+	if (g_object_get_data(G_OBJECT(msg), RESPONSE_ENCODED_KEY))
+		return;
+	g_object_set_data(G_OBJECT(msg), RESPONSE_ENCODED_KEY, GINT_TO_POINTER(1));
+
+	if (!__response_is_compressible(msg))
+		return;
+
+	soup_message_headers_append(msg->response_headers, "Vary", "Accept-Encoding");
+	if (!__request_accepts_gzip(msg))
+		return;
+
+	body = soup_message_body_flatten(msg->response_body);
+
+	/* hashing is much cheaper than deflating it again */
+	key = g_compute_checksum_for_data(G_CHECKSUM_SHA1,
+					(const guchar *)body->data, body->length);
+	bytes = __response_cache_lookup(key);
+	if (!bytes) {
+		bytes = __response_deflate(body);
+		if (bytes)
+			__response_cache_insert(key, bytes);
+	}
+	g_free(key);
+
+	if (!bytes || g_bytes_get_size(bytes) >= body->length) {
+		if (bytes)
+			g_bytes_unref(bytes);
+		soup_buffer_free(body);
+		return;
+	}
+	soup_buffer_free(body);
+
+	buffer = soup_buffer_new_with_owner(g_bytes_get_data(bytes, NULL),
+					g_bytes_get_size(bytes),
+					bytes, (GDestroyNotify)g_bytes_unref);
+	soup_message_body_truncate(msg->response_body);
+	soup_message_body_append_buffer(msg->response_body, buffer);
+	soup_buffer_free(buffer);
+
+	soup_message_headers_replace(msg->response_headers, "Content-Encoding", "gzip");
+	soup_message_headers_set_content_length(msg->response_headers,
+						msg->response_body->length);
+}
+
+static void
+request_started_cb(SoupServer *server, SoupMessage *message,
+				SoupClientContext *client, gpointer user_data)
+{
+#if SIGNAL_DEBUG
+	_D("request-started : [%s]", soup_client_context_get_host(client));
+#endif /* SIGNAL_DEBUG */
+
+	/* for the auth filter, which is not given the client */
+	g_object_set_data(G_OBJECT(message), MESSAGE_CLIENT_KEY, client);
+
+	__request_trace_new(message);
+	if (util_trace_enabled())
+		g_signal_connect(message, "wrote-headers",
+				G_CALLBACK(wrote_headers_cb), NULL);
+
+	/* soup_server connected its own got-headers handler before this */
+	g_signal_connect(message, "got-headers", G_CALLBACK(got_headers_cb), client);
+}
+
+static char *
+digest_auth_cb(SoupAuthDomain *domain, SoupMessage *msg,
+	const char *username, gpointer user_data)
+{
+	char *res_path = NULL;
+	char *digest_path = NULL;
+	GKeyFile *key_file = NULL;
+	char *password = NULL;
+
+	_D("requested user - [%s]", username);
+
+	res_path = app_get_resource_path();
+	digest_path = g_strdup_printf("%s%s", res_path, HTDIGEST_FILE);
+	g_clear_pointer(&res_path, g_free);
+
+	key_file = g_key_file_new();
+	if (!g_key_file_load_from_file(key_file,
+			digest_path, G_KEY_FILE_NONE, NULL)) {
+		_E("failed to load htdigest file");
+		return NULL;
+	}
+	g_clear_pointer(&digest_path, g_free);
+
+	password = g_key_file_get_string(key_file,
+					soup_auth_domain_get_realm(domain), username, NULL);
+
+	g_key_file_unref(key_file);
+
+	return password;
+}
+
+/*
+ * Runs before the credentials are checked, so a client guessing them is
+ * slowed down too. A refused message is not covered, soup_server does not
+ * call any handler of a message which has a status.
+ */
+static gboolean auth_filter_cb(SoupAuthDomain *domain, SoupMessage *msg,
+				gpointer user_data)
+{
+	struct request_trace *trace = __request_trace_get(msg);
+
+	/* libsoup lets in what any covering realm accepts, admin paths are its alone */
+	if (domain != admin_auth_domain && admin_auth_domain
+		&& soup_auth_domain_covers(admin_auth_domain, msg))
+		return FALSE;
+
+	/*
+	 * The digest is checked right after, until got-headers of the core.
+	 * Whether the span is wanted is only known by then.
+	 */
+	if (trace)
+		trace->auth = g_get_monotonic_time();
+
+	return __client_rate_check(msg);
+}
+
+static gboolean admin_auth_filter_cb(SoupAuthDomain *domain, SoupMessage *msg,
+				gpointer user_data)
+{
+	if ((msg->method == SOUP_METHOD_GET || msg->method == SOUP_METHOD_HEAD)
+		&& __route_lookup(admin_read_table, soup_message_get_uri(msg)->path))
+		return FALSE;
+
+	return auth_filter_cb(domain, msg, user_data);
+}
+
+static int auth_domain_create(SoupServer *server)
+{
+	SoupAuthDomain *sad = NULL;
+	retv_if(!server, -1);
+
+	sad = soup_auth_domain_digest_new(SOUP_AUTH_DOMAIN_REALM, "default", NULL);
+	retvm_if(!sad, -1, "failed to soup_auth_domain_digest_new");
+
+	soup_auth_domain_digest_set_auth_callback(sad, digest_auth_cb, NULL, NULL);
+	soup_auth_domain_set_filter(sad, auth_filter_cb, NULL, NULL);
+	soup_server_add_auth_domain(server, sad);
+	default_auth_domain = sad;
+
+	/* debugging and settings, users of the default realm only read */
+	sad = soup_auth_domain_digest_new(SOUP_AUTH_DOMAIN_REALM, ADMIN_REALM, NULL);
+	retvm_if(!sad, -1, "failed to soup_auth_domain_digest_new");
+
+	soup_auth_domain_digest_set_auth_callback(sad, digest_auth_cb, NULL, NULL);
+	soup_auth_domain_set_filter(sad, admin_auth_filter_cb, NULL, NULL);
+	soup_server_add_auth_domain(server, sad);
+	admin_auth_domain = sad;
+	admin_read_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					g_free, NULL);
+
+	return 0;
+}
+
+static void __route_headers_data_free(gpointer data)
+{
+	struct route_headers_data *hd = data;
+
+	if (hd->destroy_func)
+		hd->destroy_func(hd->user_data);
+
+	g_free(hd);
+}
+
+static struct route_limit *__route_limit_ref(struct route_limit *limit)
+{
+	limit->ref++;
+
+	return limit;
+}
+
+static void __route_limit_unref(gpointer data)
+{
+	struct route_limit *limit = data;
+
+	if (--limit->ref)
+		return;
+
+	if (limit->drain_source)
+		g_source_remove(limit->drain_source);
+	g_free(limit->path);
+	g_free(limit);
+}
+
+static void __route_limit_finished_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct route_limit *limit = user_data;
+
+	g_signal_handlers_disconnect_by_func(msg, __route_limit_finished_cb, limit);
+	__route_limit_leave(limit);
+}
+
+/* msg is released by finished, internal ones when they are completed */
+static void __route_limit_enter(struct route_limit *limit, SoupMessage *msg)
+{
+	limit->in_flight++;
+	__route_limit_ref(limit);
+
+	if (msg)
+		g_signal_connect(msg, "finished",
+				G_CALLBACK(__route_limit_finished_cb), limit);
+}
+
+static void __route_limit_reject(struct route_limit *limit, SoupMessage *msg)
+{
+	limit->rejected++;
+	soup_message_headers_replace(msg->response_headers,
+				"Retry-After", ROUTE_LIMIT_RETRY_AFTER);
+	soup_message_set_status(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+}
+
+static void __route_offload_free(struct route_offload *job)
+{
+	g_object_unref(job->msg);
+	g_object_unref(job->copy);
+	g_free(job->path);
+	if (job->query)
+		g_hash_table_unref(job->query);
+	g_free(job);
+}
+
+static void __headers_copy_cb(const char *name, const char *value,
+				gpointer user_data)
+{
+	soup_message_headers_append(user_data, name, value);
+}
+
+static void __route_budget_charge(struct route_budget *budget, const char *path,
+				gint64 elapsed)
+{
+	if (elapsed <= budget->budget) {
+		budget->strikes = 0;
+		if (!budget->offloaded || ++budget->streak < ROUTE_BUDGET_RECOVER)
+			return;
+
+		budget->offloaded = FALSE;
+		budget->streak = 0;
+		_I("[%s] is in budget %d times in a row, it runs on the main loop again",
+			path, ROUTE_BUDGET_RECOVER);
+		return;
+	}
+
+	budget->streak = 0;
+	budget->overruns++;
+	_W("handler of [%s] ran for %lld ms, its budget is %lld ms",
+		path, (long long)(elapsed / 1000), (long long)(budget->budget / 1000));
+	if (budget->offloaded)
+		return;
+
+	if (++budget->strikes < ROUTE_BUDGET_STRIKES)
+		return;
+
+	budget->offloaded = TRUE;
+	_W("[%s] is over budget %d times in a row, it runs on workers from now on",
+		path, ROUTE_BUDGET_STRIKES);
+}
+
+static gboolean __route_offload_done_cb(gpointer user_data)
+{
+	struct route_offload *job = user_data;
+	SoupMessage *msg = job->msg;
+	struct request_trace *trace = __request_trace_get(msg);
+	struct route_budget *budget = NULL;
+	SoupBuffer *body = NULL;
+	int i = 0;
+
+	if (trace) {
+		for (i = 0; i < TIMING_MAX; i++)
+			trace->timing[i] += job->trace.timing[i];
+	}
+
+	budget = budgets_table ? g_hash_table_lookup(budgets_table, job->cd->path) : NULL;
+	if (budget)
+		__route_budget_charge(budget, job->cd->path, job->elapsed);
+
+	if (g_cancellable_is_cancelled(http_server_message_get_cancellable(msg))) {
+		__route_offload_free(job);
+		return G_SOURCE_REMOVE;
+	}
+
+	if (job->copy->status_code == SOUP_STATUS_NONE) {
+		_E("handler of [%s] left no status on a worker", job->path);
+		soup_message_set_status(msg, SOUP_STATUS_INTERNAL_SERVER_ERROR);
+	} else {
+		soup_message_set_status_full(msg, job->copy->status_code,
+					job->copy->reason_phrase);
+		soup_message_headers_foreach(job->copy->response_headers,
+					__headers_copy_cb, msg->response_headers);
+
+		body = soup_message_body_flatten(job->copy->response_body);
+		if (body->length)
+			soup_message_body_append_buffer(msg->response_body, body);
+		soup_buffer_free(body);
+	}
+
+	http_server_unpause_message(msg);
+	__route_offload_free(job);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void __route_offload_worker(gpointer data, gpointer user_data)
+{
+	struct route_offload *job = data;
+	struct request_trace *trace = &job->trace;
+	gint64 begin = __request_span_begin(trace);
+	gint64 started = g_get_monotonic_time();
+	const char *route = util_heap_route_set(job->cd->path);
+
+	HS_PROBE2(handler__entry, trace->id, job->path);
+	job->cd->callback(job->copy, job->path, job->query, NULL, job->cd->user_data);
+	HS_PROBE3(handler__return, trace->id, job->path, job->copy->status_code);
+
+	util_heap_route_set(route);
+	job->elapsed = g_get_monotonic_time() - started;
+	__request_span_end(trace, TIMING_HANDLER, "handler", &begin);
+
+	g_main_context_invoke(NULL, __route_offload_done_cb, job);
+}
+
+/*
+ * Nothing but the main loop touches msg, the handler fills a copy which
+ * shares its cancellable, and the result is copied back. The copy gets a
+ * trace of its own, the shared one is only written on the main loop.
+ */
+static gboolean __route_offload(struct route_callback_data *cd,
+				SoupMessage *msg, const char *path, GHashTable *query)
+{
+	struct route_offload *job = NULL;
+	struct request_trace *trace = NULL;
+	SoupBuffer *body = NULL;
+	GError *error = NULL;
+
+	if (!offload_pool) {
+		offload_pool = g_thread_pool_new(__route_offload_worker, NULL,
+					util_memory_is_low() ? 1 : ROUTE_OFFLOAD_THREADS,
+					FALSE, &error);
+		if (!offload_pool) {
+			_E("failed to create offload pool - %s",
+				error ? error->message : "unknown");
+			g_clear_error(&error);
+			return FALSE;
+		}
+	}
+
+	job = g_new0(struct route_offload, 1);
+	job->cd = cd;
+	job->msg = g_object_ref(msg);
+	job->copy = soup_message_new_from_uri(msg->method, soup_message_get_uri(msg));
+	job->path = g_strdup(path);
+	job->query = query ? g_hash_table_ref(query) : NULL;
+
+	soup_message_headers_foreach(msg->request_headers,
+				__headers_copy_cb, job->copy->request_headers);
+	if (msg->request_body->length) {
+		body = soup_message_body_flatten(msg->request_body);
+		soup_message_body_append_buffer(job->copy->request_body, body);
+		soup_buffer_free(body);
+	}
+
+	trace = __request_trace_get(msg);
+	if (trace) {
+		job->trace.id = trace->id;
+		job->trace.timed = trace->timed;
+		g_object_set_data(G_OBJECT(job->copy), MESSAGE_TRACE_KEY, &job->trace);
+	}
+	g_object_set_data_full(G_OBJECT(job->copy), MESSAGE_CANCELLABLE_KEY,
+				g_object_ref(http_server_message_get_cancellable(msg)),
+				g_object_unref);
+
+	http_server_pause_message(msg);
+	g_thread_pool_push(offload_pool, job, NULL);
+
+	return TRUE;
+}
+
+static void __route_call(struct route_callback_data *cd, SoupMessage *msg,
+				const char *path, GHashTable *query,
+				SoupClientContext *client)
+{
+	struct request_trace *trace = NULL;
+	struct route_budget *budget = NULL;
+	const char *route = NULL;
+	gint64 started = 0;
+	gint64 begin = 0;
+
+	budget = budgets_table ? g_hash_table_lookup(budgets_table, cd->path) : NULL;
+	if (budget && budget->offloaded && __route_offload(cd, msg, path, query))
+		return;
+
+	trace = __request_trace_get(msg);
+	begin = __request_span_begin(trace);
+	route = util_heap_route_set(cd->path);
+	util_watchdog_activity_set(cd->path);
+	if (budget)
+		started = g_get_monotonic_time();
+
+	HS_PROBE2(handler__entry, trace ? trace->id : 0, path);
+	cd->callback(msg, path, query, client, cd->user_data);
+	HS_PROBE3(handler__return, trace ? trace->id : 0, path, msg->status_code);
+
+	if (budget)
+		__route_budget_charge(budget, cd->path, g_get_monotonic_time() - started);
+	util_watchdog_activity_set(NULL);
+	util_heap_route_set(route);
+
+	__request_span_end(trace, TIMING_HANDLER, "handler", &begin);
+}
+
+static void __route_waiter_free(struct route_waiter *w)
+{
+	__route_limit_unref(w->limit);
+	g_object_unref(w->msg);
+	g_free(w->path);
+	if (w->query)
+		g_hash_table_unref(w->query);
+	g_free(w);
+}
+
+static void __route_waiter_finished_cb(SoupMessage *msg, gpointer user_data)
+{
+	struct route_waiter *w = user_data;
+
+	/* gone while it was waiting for its turn */
+	g_signal_handlers_disconnect_by_func(msg, __route_waiter_finished_cb, w);
+	g_queue_remove(&w->limit->waiting, w);
+	__route_waiter_free(w);
+}
+
+static void __route_waiter_run(struct route_waiter *w)
+{
+	struct route_callback_data *cd = NULL;
+	struct request_trace *trace = NULL;
+	SoupMessage *msg = w->msg;
+	int pause = MESSAGE_PAUSE_NONE;
+
+	g_signal_handlers_disconnect_by_func(msg, __route_waiter_finished_cb, w);
+	__route_limit_enter(w->limit, msg);
+
+	trace = __request_trace_get(msg);
+	__request_span_end(trace, TIMING_QUEUE, "queued", &w->queued);
+
+	cd = route_table ? __route_lookup(route_table, w->path) : NULL;
+	if (cd) {
+		g_object_set_data(G_OBJECT(msg), MESSAGE_PAUSE_KEY,
+					GINT_TO_POINTER(MESSAGE_PAUSE_NONE));
+		__route_call(cd, msg, w->path, w->query, w->client);
+		pause = GPOINTER_TO_INT(g_object_get_data(G_OBJECT(msg),
+							MESSAGE_PAUSE_KEY));
+	} else {
+		soup_message_set_status(msg, SOUP_STATUS_NOT_FOUND);
+	}
+
+	/* it was paused to wait, the handler answered without keeping it */
+	if (pause == MESSAGE_PAUSE_NONE)
+		http_server_unpause_message(msg);
+}
+
+static gboolean __route_limit_drain_cb(gpointer user_data)
+{
+	struct route_limit *limit = user_data;
+	struct route_waiter *w = NULL;
+
+	limit->drain_source = 0;
+
+	while (limit->in_flight < limit->max_in_flight
+		&& (w = g_queue_pop_head(&limit->waiting))) {
+		__route_waiter_run(w);
+		__route_waiter_free(w);
+	}
+
+	return G_SOURCE_REMOVE;
 }
 
-static void
-request_read_cb(SoupServer *server, SoupMessage *message,
-				SoupClientContext *client, gpointer user_data)
+static void __route_limit_leave(struct route_limit *limit)
 {
-	_D("request-read : [%s]", soup_client_context_get_host(client));
+	limit->in_flight--;
+
+	/* the next one runs from the main loop, not from finished */
+	if (limit->waiting.length && !limit->drain_source)
+		limit->drain_source = g_idle_add(__route_limit_drain_cb, limit);
+
+	__route_limit_unref(limit);
 }
 
-static void
-request_started_cb(SoupServer *server, SoupMessage *message,
-				SoupClientContext *client, gpointer user_data)
+static void __route_limit_capacity(struct route_limit *limit, const char *path,
+				guint *max_in_flight, guint *max_queued)
 {
-	_D("request-started : [%s]", soup_client_context_get_host(client));
+	*max_in_flight = limit->max_in_flight;
+	*max_queued = limit->max_queued;
+
+	/* under pressure expensive routes run one at a time, nobody waits */
+	if (__route_is_expensive(path)
+		&& util_pressure_get()->level >= UTIL_PRESSURE_HIGH) {
+		*max_in_flight = 1;
+		*max_queued = 0;
+	}
 }
-#endif /* SIGNAL_DEBUG */
 
-static char *
-digest_auth_cb(SoupAuthDomain *domain, SoupMessage *msg,
-	const char *username, gpointer user_data)
+/* Returns TRUE if the handler may run now, or else msg is queued or refused */
+static gboolean __route_limit_admit(struct route_limit *limit, SoupMessage *msg,
+				const char *path, GHashTable *query,
+				SoupClientContext *client)
 {
-	char *res_path = NULL;
-	char *digest_path = NULL;
-	GKeyFile *key_file = NULL;
-	char *password = NULL;
+	struct route_waiter *w = NULL;
+	guint max_in_flight = 0;
+	guint max_queued = 0;
 
-	_D("requested user - [%s]", username);
+	__route_limit_capacity(limit, path, &max_in_flight, &max_queued);
 
-	res_path = app_get_resource_path();
-	digest_path = g_strdup_printf("%s%s", res_path, HTDIGEST_FILE);
-	g_clear_pointer(&res_path, g_free);
+	if (limit->in_flight < max_in_flight) {
+		__route_limit_enter(limit, msg);
+		return TRUE;
+	}
 
-	key_file = g_key_file_new();
-	if (!g_key_file_load_from_file(key_file,
-			digest_path, G_KEY_FILE_NONE, NULL)) {
-		_E("failed to load htdigest file");
-		return NULL;
+	if (limit->waiting.length >= max_queued) {
+		_W("[%s] is busy, [%u] in flight, [%u] queued", limit->path,
+			limit->in_flight, limit->waiting.length);
+		__route_limit_reject(limit, msg);
+		return FALSE;
 	}
-	g_clear_pointer(&digest_path, g_free);
 
-	password = g_key_file_get_string(key_file,
-					soup_auth_domain_get_realm(domain), username, NULL);
+	w = g_new0(struct route_waiter, 1);
+	w->limit = __route_limit_ref(limit);
+	w->queued = __request_span_begin(__request_trace_get(msg));
+	w->msg = g_object_ref(msg);
+	w->path = g_strdup(path);
+	w->query = query ? g_hash_table_ref(query) : NULL;
+	w->client = client;
+	g_queue_push_tail(&limit->waiting, w);
 
-	g_key_file_unref(key_file);
+	g_signal_connect(msg, "finished", G_CALLBACK(__route_waiter_finished_cb), w);
+	soup_server_pause_message(g_server, msg);
 
-	return password;
+	return FALSE;
 }
 
-static int auth_domain_create(SoupServer *server)
+static int __listener_get_fd(SoupServer *server)
 {
-	SoupAuthDomain *sad = NULL;
-	retv_if(!server, -1);
+	return soup_socket_get_fd(soup_server_get_listener(server));
+}
 
-	sad = soup_auth_domain_digest_new(SOUP_AUTH_DOMAIN_REALM, "default", NULL);
-	retvm_if(!sad, -1, "failed to soup_auth_domain_digest_new");
+/*
+ * libsoup 2.46 can not listen on a given socket, so the server binds an
+ * ephemeral port and the socket behind that fd is swapped for listen_fd.
+ * Connections queued on listen_fd are accepted once the server runs.
+ */
+static int __listener_adopt(SoupServer *server, int listen_fd)
+{
+	int fd = __listener_get_fd(server);
 
-	soup_auth_domain_digest_set_auth_callback(sad, digest_auth_cb, NULL, NULL);
-	soup_server_add_auth_domain(server, sad);
-	default_auth_domain = sad;
+	if (dup2(listen_fd, fd) < 0) {
+		_E("failed to adopt listener - %d", errno);
+		close(listen_fd);
+		return -1;
+	}
+	close(listen_fd);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
 
 	return 0;
 }
 
+static void __server_handed_off(gpointer user_data)
+{
+	/* queued and new connections are the successor's from now on */
+	if (g_server)
+		util_listen_fd_make_dormant(__listener_get_fd(g_server));
+
+	if (handoff_cb)
+		handoff_cb(handoff_cb_data);
+}
+
 int http_server_create(const char *name, unsigned int port)
 {
 	SoupServer *s = NULL;
+	int listen_fd = -1;
 
 	retv_if(!name, -1);
 	retvm_if(g_server, -1, "server is already created");
 
+	listen_fd = util_listen_fd_take(port);
+
 	s = soup_server_new(SOUP_SERVER_SERVER_HEADER, name,
-						SOUP_SERVER_PORT, port, NULL);
-	retvm_if(!s, -1, "failed to soup_server_new");
+						SOUP_SERVER_PORT, listen_fd < 0 ? port : 0, NULL);
+	if (!s) {
+		_E("failed to soup_server_new");
+		if (listen_fd >= 0)
+			close(listen_fd);
+		return -1;
+	}
+
+	if (listen_fd >= 0 && __listener_adopt(s, listen_fd)) {
+		g_object_unref(s);
+		return -1;
+	}
 
-#if SIGNAL_DEBUG
-	g_signal_connect(s, "request-aborted", G_CALLBACK(request_aborted_cb), NULL);
 	g_signal_connect(s, "request-finished", G_CALLBACK(request_finished_cb), NULL);
-	g_signal_connect(s, "request-read", G_CALLBACK(request_read_cb), NULL);
+	g_signal_connect(s, "request-aborted", G_CALLBACK(request_aborted_cb), NULL);
 	g_signal_connect(s, "request-started", G_CALLBACK(request_started_cb), NULL);
-#endif /* SIGNAL_DEBUG */
+	g_signal_connect(s, "request-read", G_CALLBACK(request_read_cb), NULL);
 
 	if (auth_domain_create(s)) {
 		_E("failed to auth_domain_create()");
@@ -140,6 +1623,23 @@ int http_server_create(const char *name, unsigned int port)
 	}
 
 	g_server = s;
+	server_port = port;
+	route_table = g_hash_table_new(g_str_hash, g_str_equal);
+	internal_messages = g_hash_table_new(g_direct_hash, g_direct_equal);
+	headers_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					g_free, __route_headers_data_free);
+	limits_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					NULL, __route_limit_unref);
+	costs_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					g_free, NULL);
+	rate_costs_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					g_free, NULL);
+	budgets_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					g_free, g_free);
+	clients_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+					NULL, __client_bucket_free);
+	response_cache = g_hash_table_new_full(g_str_hash, g_str_equal,
+					NULL, __response_cache_entry_free);
 
 	return 0;
 }
@@ -149,14 +1649,60 @@ void http_server_destroy(void)
 	if (!g_server)
 		return;
 
+	util_listen_fd_handoff_stop();
 	soup_server_disconnect(g_server);
 
 	if (default_auth_domain)
 		g_object_unref(default_auth_domain);
 	default_auth_domain = NULL;
+	g_clear_object(&admin_auth_domain);
+	g_clear_pointer(&admin_read_table, g_hash_table_destroy);
 
 	g_object_unref(g_server);
 	g_server = NULL;
+
+	/* lets handlers still running on workers finish, they use the routes */
+	if (offload_pool)
+		g_thread_pool_free(offload_pool, FALSE, TRUE);
+	offload_pool = NULL;
+
+	g_clear_pointer(&route_table, g_hash_table_destroy);
+	g_clear_pointer(&internal_messages, g_hash_table_destroy);
+	g_clear_pointer(&headers_table, g_hash_table_destroy);
+	g_clear_pointer(&limits_table, g_hash_table_destroy);
+	g_clear_pointer(&costs_table, g_hash_table_destroy);
+	g_clear_pointer(&rate_costs_table, g_hash_table_destroy);
+	g_clear_pointer(&budgets_table, g_hash_table_destroy);
+	g_clear_pointer(&clients_table, g_hash_table_destroy);
+	g_clear_pointer(&response_cache, g_hash_table_destroy);
+}
+
+int http_server_set_compression(unsigned int min_size, int level)
+{
+	retvm_if(level < 0 || level > 9, -1, "invalid level [%d]", level);
+
+	/* cached bodies were compressed at the old level */
+	if (response_cache && level != compress_level)
+		g_hash_table_remove_all(response_cache);
+
+	compress_min_size = min_size;
+	compress_level = level;
+
+	return 0;
+}
+
+int http_server_set_client_rate(unsigned int rate, unsigned int burst)
+{
+	retvm_if(rate && !burst, -1, "burst is 0");
+
+	/* buckets were filled for the old burst */
+	if (clients_table)
+		g_hash_table_remove_all(clients_table);
+
+	client_rate = rate;
+	client_burst = burst;
+
+	return 0;
 }
 
 int http_server_start(void)
@@ -165,6 +1711,18 @@ int http_server_start(void)
 
 	soup_server_run_async(g_server);
 
+	/* not fatal, the next instance binds the port after this one is gone */
+	util_listen_fd_handoff_start(server_port, __listener_get_fd(g_server),
+				__server_handed_off, NULL);
+
+	return 0;
+}
+
+int http_server_set_handoff_callback(http_server_handoff_cb callback, void *user_data)
+{
+	handoff_cb = callback;
+	handoff_cb_data = user_data;
+
 	return 0;
 }
 
@@ -180,9 +1738,16 @@ int http_server_stop(void)
 static void _route_callback_data_free(gpointer data)
 {
 	struct route_callback_data *cd = data;
+
+	/* the path may be taken by a newer handler already */
+	if (cd->path && route_table
+		&& g_hash_table_lookup(route_table, cd->path) == cd)
+		g_hash_table_remove(route_table, cd->path);
+
 	if (cd->destroy_func)
 		cd->destroy_func(cd->user_data);
 
+	g_free(cd->path);
 	g_free(cd);
 }
 
@@ -192,16 +1757,25 @@ _http_server_callback(SoupServer *server, SoupMessage *msg,
 					SoupClientContext *client, gpointer user_data)
 {
 	struct route_callback_data *cd = user_data;
+	struct route_limit *limit = NULL;
 
 	ret_if(!cd);
 	ret_if(!cd->callback);
 
-	_D("client : %s", soup_client_context_get_host(client));
-	_D("METHOD(%s) PATH(%s) URI_PATH(%s) HTTP/1.%d",
-		msg->method, path, soup_message_get_uri(msg)->path,
-		soup_message_get_http_version(msg));
+	_D("[%s] %s %s HTTP/1.%d", soup_client_context_get_host(client),
+		msg->method, path, soup_message_get_http_version(msg));
 
-	cd->callback(msg, path, query, client, cd->user_data);
+	limit = __route_lookup(limits_table, path);
+	if (limit && !__route_limit_admit(limit, msg, path, query, client))
+		return;
+
+	__route_call(cd, msg, path, query, client);
+
+	/* a paused message is compressed when it is unpaused */
+	if (__message_is_answered(msg)) {
+		__response_add_server_timing(msg);
+		__response_compress(msg);
+	}
 }
 
 int http_server_route_handler_add(const char *path, http_server_route_callback callback,
@@ -213,10 +1787,14 @@ int http_server_route_handler_add(const char *path, http_server_route_callback c
 
 	cd = g_try_new0(struct route_callback_data, 1);
 	retvm_if(!cd, -1, "failed to alloc route_callback_data");
+	cd->path = g_strdup(path);
 	cd->callback = callback;
 	cd->user_data = user_data;
 	cd->destroy_func = destroy;
 
+	if (cd->path)
+		g_hash_table_replace(route_table, cd->path, cd);
+
 	soup_server_add_handler(g_server, path,
 			_http_server_callback, cd, _route_callback_data_free);
 
@@ -232,20 +1810,381 @@ int http_server_route_handler_remove(const char *path)
 	return 0;
 }
 
+int http_server_route_headers_handler_add(const char *path,
+						http_server_route_headers_callback callback,
+						gpointer user_data, GDestroyNotify destroy)
+{
+	struct route_headers_data *hd = NULL;
+	retvm_if(!g_server, -1, "server is NOT created");
+	retvm_if(!path, -1, "path is NULL");
+	retvm_if(!callback, -1, "callback is NULL");
+
+	hd = g_try_new0(struct route_headers_data, 1);
+	retvm_if(!hd, -1, "failed to alloc route_headers_data");
+	hd->callback = callback;
+	hd->user_data = user_data;
+	hd->destroy_func = destroy;
+
+	g_hash_table_replace(headers_table, g_strdup(path), hd);
+
+	return 0;
+}
+
+int http_server_route_limit_set(const char *path,
+				unsigned int max_in_flight, unsigned int max_queued)
+{
+	struct route_limit *limit = NULL;
+
+	retvm_if(!g_server, -1, "server is NOT created");
+	retvm_if(!path, -1, "path is NULL");
+	retvm_if(!max_in_flight, -1, "max_in_flight is 0");
+
+	limit = g_new0(struct route_limit, 1);
+	limit->ref = 1;
+	limit->path = g_strdup(path);
+	limit->max_in_flight = max_in_flight;
+	limit->max_queued = max_queued;
+	g_queue_init(&limit->waiting);
+
+	g_hash_table_replace(limits_table, limit->path, limit);
+
+	return 0;
+}
+
+int http_server_route_cost_set(const char *path, http_server_route_cost_e cost)
+{
+	retvm_if(!g_server, -1, "server is NOT created");
+	retvm_if(!path, -1, "path is NULL");
+
+	if (cost == HTTP_SERVER_ROUTE_COST_NORMAL)
+		g_hash_table_remove(costs_table, path);
+	else
+		g_hash_table_replace(costs_table, g_strdup(path), GINT_TO_POINTER(cost));
+
+	return 0;
+}
+
+int http_server_route_rate_cost_set(const char *path, unsigned int tokens)
+{
+	retvm_if(!g_server, -1, "server is NOT created");
+	retvm_if(!path, -1, "path is NULL");
+
+	g_hash_table_replace(rate_costs_table, g_strdup(path),
+			GUINT_TO_POINTER(tokens + 1));
+
+	return 0;
+}
+
+int http_server_route_budget_set(const char *path, unsigned int budget_ms)
+{
+	struct route_budget *budget = NULL;
+
+	retvm_if(!g_server, -1, "server is NOT created");
+	retvm_if(!path, -1, "path is NULL");
+	retvm_if(!budget_ms, -1, "budget_ms is 0");
+
+	budget = g_new0(struct route_budget, 1);
+	budget->budget = (gint64)budget_ms * G_TIME_SPAN_MILLISECOND;
+	g_hash_table_replace(budgets_table, g_strdup(path), budget);
+
+	return 0;
+}
+
+void http_server_route_foreach_budget(http_server_route_budget_cb callback,
+				gpointer user_data)
+{
+	GHashTableIter iter;
+	gpointer key = NULL;
+	gpointer value = NULL;
+
+	ret_if(!callback);
+	ret_if(!budgets_table);
+
+	g_hash_table_iter_init(&iter, budgets_table);
+	while (g_hash_table_iter_next(&iter, &key, &value)) {
+		struct route_budget *budget = value;
+
+		callback(key, budget->overruns, budget->offloaded, user_data);
+	}
+}
+
+guint64 http_server_route_get_shed_count(void)
+{
+	return shed_count;
+}
+
+void http_server_route_foreach_stats(http_server_route_stats_cb callback,
+				gpointer user_data)
+{
+	GHashTableIter iter;
+	gpointer value = NULL;
+
+	ret_if(!callback);
+	ret_if(!limits_table);
+
+	g_hash_table_iter_init(&iter, limits_table);
+	while (g_hash_table_iter_next(&iter, NULL, &value)) {
+		struct route_limit *limit = value;
+
+		callback(limit->path, limit->in_flight, limit->waiting.length,
+			limit->rejected, user_data);
+	}
+}
+
+static gpointer __route_lookup(GHashTable *table, const char *path)
+{
+	char buf[ROUTE_LOOKUP_BUF_SIZE];
+	gpointer cd = NULL;
+	char *route_path = NULL;
+	char *slash = NULL;
+
+	/* runs a few times for each request, most paths fit on the stack */
+	if (g_strlcpy(buf, path, sizeof(buf)) < sizeof(buf))
+		route_path = buf;
+	else
+		route_path = g_strdup(path);
+
+	/* longest prefix match, same as soup_server */
+	while (!(cd = g_hash_table_lookup(table, route_path))) {
+		slash = strrchr(route_path, '/');
+		if (!slash || slash == route_path)
+			break;
+		*slash = '\0';
+	}
+	if (route_path != buf)
+		g_free(route_path);
+
+	return cd;
+}
+
+static gboolean __internal_message_complete(gpointer data)
+{
+	struct internal_message *im = data;
+
+	im->complete_source = 0;
+	if (im->paused)
+		return G_SOURCE_REMOVE;
+
+	if (internal_messages)
+		g_hash_table_remove(internal_messages, im->msg);
+
+	if (im->limit)
+		__route_limit_leave(im->limit);
+
+	__request_trace_finish(im->msg);
+	im->done(im->msg, im->user_data);
+
+	g_object_unref(im->msg);
+	g_free(im);
+
+	return G_SOURCE_REMOVE;
+}
+
+static void __internal_message_complete_later(struct internal_message *im)
+{
+	if (!im->complete_source)
+		im->complete_source = g_idle_add(__internal_message_complete, im);
+}
+
+int http_server_route_dispatch(SoupMessage *msg, const char *path,
+						GHashTable *query, SoupClientContext *client,
+						http_server_dispatch_done_cb done, gpointer user_data)
+{
+	struct route_callback_data *cd = NULL;
+	struct internal_message *im = NULL;
+	guint max_in_flight = 0;
+	guint max_queued = 0;
+	guint retry_after = 0;
+
+	retvm_if(!g_server, -1, "server is NOT created");
+	retvm_if(!msg, -1, "msg is NULL");
+	retvm_if(!path, -1, "path is NULL");
+	retvm_if(!done, -1, "done is NULL");
+
+	cd = __route_lookup(route_table, path);
+	retvm_if(!cd, -1, "no route for [%s]", path);
+
+	im = g_try_new0(struct internal_message, 1);
+	retvm_if(!im, -1, "failed to alloc internal_message");
+	im->msg = g_object_ref(msg);
+	im->done = done;
+	im->user_data = user_data;
+	g_hash_table_insert(internal_messages, msg, im);
+
+	/* parts of a batch are paid for one by one */
+	retry_after = __client_rate_take(client, path);
+	if (retry_after) {
+		__client_rate_reject(msg, retry_after);
+		__internal_message_complete_later(im);
+		return 0;
+	}
+
+	if (__route_shed(msg, path)) {
+		soup_message_set_status(msg, SOUP_STATUS_SERVICE_UNAVAILABLE);
+		__internal_message_complete_later(im);
+		return 0;
+	}
+
+	/* nobody would wait for a queued one, it is refused instead */
+	im->limit = __route_lookup(limits_table, path);
+	if (im->limit)
+		__route_limit_capacity(im->limit, path, &max_in_flight, &max_queued);
+	if (im->limit && im->limit->in_flight >= max_in_flight) {
+		__route_limit_reject(im->limit, msg);
+		im->limit = NULL;
+		__internal_message_complete_later(im);
+		return 0;
+	}
+	if (im->limit)
+		__route_limit_enter(im->limit, NULL);
+
+	__request_trace_new(msg);
+	__route_call(cd, msg, path, query, client);
+
+	/* handlers may have paused it, or paused and unpaused it already */
+	if (!im->paused)
+		__internal_message_complete_later(im);
+
+	return 0;
+}
+
+gint64 http_server_message_span_begin(SoupMessage *msg, const char *name)
+{
+	struct request_trace *trace = NULL;
+
+	retv_if(!msg, 0);
+
+	trace = __request_trace_get(msg);
+	HS_PROBE3(span__begin, trace ? trace->id : 0,
+		soup_message_get_uri(msg)->path, name);
+
+	return __request_span_begin(trace);
+}
+
+void http_server_message_span_end(SoupMessage *msg, http_server_span_e type,
+				const char *name, gint64 begin)
+{
+	struct request_trace *trace = NULL;
+
+	ret_if(!msg);
+
+	trace = __request_trace_get(msg);
+	HS_PROBE4(span__end, trace ? trace->id : 0,
+		soup_message_get_uri(msg)->path, name, type);
+
+	__request_span_end(trace,
+			type == HTTP_SERVER_SPAN_SERIALIZE ? TIMING_SERIALIZE : TIMING_PLATFORM,
+			name, &begin);
+}
+
+GCancellable *http_server_message_get_cancellable(SoupMessage *msg)
+{
+	GCancellable *cancellable = NULL;
+
+	retv_if(!msg, NULL);
+
+	cancellable = g_object_get_data(G_OBJECT(msg), MESSAGE_CANCELLABLE_KEY);
+	if (!cancellable) {
+		cancellable = g_cancellable_new();
+		g_object_set_data_full(G_OBJECT(msg), MESSAGE_CANCELLABLE_KEY,
+					cancellable, g_object_unref);
+	}
+
+	return cancellable;
+}
+
+struct util_arena *http_server_message_get_arena(SoupMessage *msg)
+{
+	struct util_arena *arena = NULL;
+
+	retv_if(!msg, NULL);
+
+	arena = g_object_get_data(G_OBJECT(msg), MESSAGE_ARENA_KEY);
+	if (!arena) {
+		arena = util_arena_new();
+		retv_if(!arena, NULL);
+		g_object_set_data_full(G_OBJECT(msg), MESSAGE_ARENA_KEY,
+					arena, (GDestroyNotify)util_arena_free);
+	}
+
+	return arena;
+}
+
+void http_server_message_cancel(SoupMessage *msg)
+{
+	struct internal_message *im = NULL;
+
+	ret_if(!msg);
+
+	g_cancellable_cancel(http_server_message_get_cancellable(msg));
+
+	/* its handler does not unpause it any more, nobody waits for it */
+	if (internal_messages)
+		im = g_hash_table_lookup(internal_messages, msg);
+	if (im) {
+		im->paused = FALSE;
+		__internal_message_complete_later(im);
+	}
+}
+
 int http_server_pause_message(SoupMessage *msg)
 {
+	struct internal_message *im = NULL;
+	struct request_trace *trace = NULL;
+
 	retvm_if(!g_server, -1, "server is NOT created");
 	retvm_if(!msg, -1, "msg is NULL");
+	retvm_if(!g_main_context_is_owner(g_main_context_default()), -1,
+		"not called from the main loop");
+
+	im = g_hash_table_lookup(internal_messages, msg);
+	if (im) {
+		im->paused = TRUE;
+		return 0;
+	}
+
+	trace = __request_trace_get(msg);
+	if (trace && !trace->paused)
+		trace->paused = __request_span_begin(trace);
+	HS_PROBE2(pause, trace ? trace->id : 0, soup_message_get_uri(msg)->path);
 
+	g_object_set_data(G_OBJECT(msg), MESSAGE_PAUSE_KEY,
+				GINT_TO_POINTER(MESSAGE_PAUSE_PAUSED));
 	soup_server_pause_message(g_server, msg);
 	return 0;
 }
 
 int http_server_unpause_message(SoupMessage *msg)
 {
+	struct internal_message *im = NULL;
+	struct request_trace *trace = NULL;
+
 	retvm_if(!g_server, -1, "server is NOT created");
 	retvm_if(!msg, -1, "msg is NULL");
+	retvm_if(!g_main_context_is_owner(g_main_context_default()), -1,
+		"not called from the main loop");
+
+	im = g_hash_table_lookup(internal_messages, msg);
+	if (im) {
+		im->paused = FALSE;
+		__internal_message_complete_later(im);
+		return 0;
+	}
+
+	trace = __request_trace_get(msg);
+	if (trace)
+		__request_span_end(trace, -1, "paused", &trace->paused);
+	HS_PROBE3(unpause, trace ? trace->id : 0, soup_message_get_uri(msg)->path,
+		msg->status_code);
+
+	/* also unpaused to read more of the request, then no status is set */
+	if (__message_is_answered(msg)) {
+		__response_add_server_timing(msg);
+		__response_compress(msg);
+	}
 
+	g_object_set_data(G_OBJECT(msg), MESSAGE_PAUSE_KEY,
+				GINT_TO_POINTER(MESSAGE_PAUSE_UNPAUSED));
 	soup_server_unpause_message(g_server, msg);
 	return 0;
 }
@@ -261,6 +2200,19 @@ int http_server_auth_default_realm_path_add(const char *path)
 	return 0;
 }
 
+int http_server_auth_admin_realm_path_add(const char *path, gboolean writes_only)
+{
+	retvm_if(!g_server, -1, "server is NOT created");
+	retvm_if(!admin_auth_domain, -1, "admin_auth_domain is NOT created");
+	retvm_if(!path, -1, "path is NULL");
+
+	soup_auth_domain_add_path(admin_auth_domain, path);
+	if (writes_only)
+		g_hash_table_replace(admin_read_table, g_strdup(path), GINT_TO_POINTER(1));
+
+	return 0;
+}
+
 int http_server_auth_default_realm_path_remove(const char *path)
 {
 	retvm_if(!g_server, -1, "server is NOT created");